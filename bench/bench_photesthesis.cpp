@@ -0,0 +1,117 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+// A micro-benchmark of the per-plan overhead photesthesis adds to a test: it
+// runs a small plan repeatedly through Test::runOnce and reports the time and
+// the number of heap allocations per run. After warm-up the allocation count
+// should be zero; anything else is a regression in the run loop.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <photesthesis/corpus.h>
+#include <photesthesis/grammar.h>
+#include <photesthesis/test.h>
+#include <photesthesis/value.h>
+
+static std::atomic<uint64_t> gAllocations{0};
+
+void*
+operator new(size_t sz)
+{
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(sz ? sz : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace ph = photesthesis;
+
+static const ph::RuleName EXPR{"expr"};
+static const ph::ParamName X{"x"};
+static const ph::ParamName Y{"y"};
+static const ph::VarName SUM{"sum"};
+static const ph::VarName SHAPE{"shape"};
+
+class BenchTest : public ph::Test
+{
+  public:
+    BenchTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : ph::Test(gram, corp, ph::TestName("BenchTest"), {})
+    {
+    }
+
+    void
+    run() override
+    {
+        ph::Value x = getParam(X);
+        ph::Value y = getParam(Y);
+        int64_t a = 0, b = 0;
+        if (x.match(EXPR, a) && y.match(EXPR, b) && a + b > 0)
+        {
+            check(SUM, a + b);
+            trace(SUM, a * b);
+        }
+        track(SHAPE, y);
+    }
+};
+
+int
+main(int argc, char** argv)
+{
+    uint64_t warmup = 1000;
+    uint64_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                   : 1000000;
+    ph::Grammar gram;
+    ph::Corpus corp("", false);
+    BenchTest test(gram, corp);
+
+    ph::Plan plan(ph::TestName("BenchTest"));
+    plan.addParam(X, ph::Value(std::vector<ph::Value>{
+                         ph::Value(EXPR), ph::Value::Int64(17)}));
+    plan.addParam(Y, ph::Value(std::vector<ph::Value>{
+                         ph::Value(EXPR), ph::Value::Int64(25)}));
+
+    ph::Trajectory traj = 0;
+    for (uint64_t i = 0; i < warmup; ++i)
+    {
+        traj += test.runOnce(plan);
+    }
+
+    uint64_t allocsBefore = gAllocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        traj += test.runOnce(plan);
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t allocs = gAllocations.load() - allocsBefore;
+
+    double nanos = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+    std::cout << "runs: " << iterations << std::endl;
+    std::cout << "ns/run: " << nanos / iterations << std::endl;
+    std::cout << "allocations/run: "
+              << static_cast<double>(allocs) / iterations << std::endl;
+    std::cout << "(trajectory checksum " << std::hex << traj << std::dec << ")"
+              << std::endl;
+    return allocs == 0 ? 0 : 1;
+}
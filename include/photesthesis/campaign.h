@@ -0,0 +1,89 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/corpus.h>
+#include <photesthesis/test.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace photesthesis
+{
+
+// A Campaign shares a global expansion budget between many Tests (typically
+// sharing one Corpus), rather than giving each the same number of expansion
+// steps. After checking each test's corpus it repeatedly picks one test and
+// runs a batch of expansion steps on it, choosing with a discounted-UCB
+// multi-armed bandit whose reward is each batch's novelty rate (new
+// trajectories per step). Tests that keep finding new trajectories thus get
+// most of the budget, while saturated ones are only revisited occasionally,
+// and discounting lets the campaign notice when a test's rate changes.
+//
+// Tests run interleaved in one process; to spread a campaign across worker
+// processes, give each worker its own copy of the corpus and a disjoint
+// subset of tests with `setWorker`, then merge the copies with
+// `photesthesis-merge`. If `PHOTESTHESIS_RANDOM_SEED` is set, each test is
+// seeded with its own stream of it (see `Test::seedWithValue`).
+class Campaign
+{
+    struct Arm
+    {
+        Test* mTest;
+        double mDiscountedPulls{0};
+        double mDiscountedReward{0};
+        uint64_t mPulls{0};
+        uint64_t mSteps{0};
+        uint64_t mNovel{0};
+        bool mRetired{false};
+    };
+
+    std::vector<Arm> mArms;
+    uint64_t mBatchSteps{100};
+    uint64_t mKPathLength{3};
+    uint64_t mRandomDepth{3};
+    double mDiscount{0.9};
+    double mExploration{0.5};
+    uint64_t mWorkerIndex{0};
+    uint64_t mWorkerCount{1};
+    uint64_t mVerboseLevel{0};
+
+    size_t pickArm() const;
+
+  public:
+    Campaign();
+
+    // Register a test. The test must outlive the campaign.
+    void add(Test& test);
+
+    // Expansion steps per bandit round (default 100, or
+    // `PHOTESTHESIS_CAMPAIGN_BATCH`).
+    void setBatchSteps(uint64_t steps);
+
+    // The K-path length and random depth passed on to each test.
+    void setKPathLength(uint64_t k);
+    void setRandomDepth(uint64_t depth);
+
+    // The bandit's per-round discount factor in (0, 1] (default 0.9) and the
+    // weight of its exploration bonus (default 0.5).
+    void setDiscount(double discount);
+    void setExploration(double exploration);
+
+    // Only run the tests whose registration index is congruent to `index`
+    // modulo `count`. Also settable as `PHOTESTHESIS_CAMPAIGN_WORKER=i/n`.
+    void setWorker(uint64_t index, uint64_t count);
+
+    // Check every test, then expand until `seconds` of wall-clock time or
+    // `executions` expansion steps are used up (either may be 0 for no
+    // limit, but not both), or every test has failed. The budgets may also
+    // be set through `PHOTESTHESIS_CAMPAIGN_SECONDS` and
+    // `PHOTESTHESIS_CAMPAIGN_EXECUTIONS`. Returns the failing plan hashes of
+    // each test that had any.
+    std::map<TestName, std::vector<PlanHash>> run(uint64_t seconds,
+                                                  uint64_t executions = 0);
+};
+
+} // namespace photesthesis
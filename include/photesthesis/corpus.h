@@ -11,8 +11,11 @@
 
 #include <cstdint>
 #include <map>
+#include <memory>
 #include <random>
+#include <string>
 #include <tuple>
+#include <vector>
 
 namespace photesthesis
 {
@@ -53,6 +56,7 @@ class Plan
     ParamSpecs getParamSpecs() const;
     void addParam(ParamName p, Value v);
     Value getParam(ParamName p) const;
+    Params const& getParams() const;
     bool hasParam(ParamName p) const;
     bool operator==(Plan const& other) const;
     bool operator<(Plan const& other) const;
@@ -63,10 +67,23 @@ class Plan
 std::ostream& operator<<(std::ostream& os, const Plan& plan);
 std::istream& operator>>(std::istream& is, Plan& plan);
 
+// Each variable in a transcript is either checked, tracked (checked and
+// traced) or measured. Measured variables hold a `(median mad)` summary of a
+// sample distribution and are compared with a tolerance rather than exactly.
+enum class VarKind
+{
+    Checked,
+    Tracked,
+    Measured,
+};
+
+using TranscriptVar = std::tuple<VarName, Value, VarKind>;
+using TranscriptVars = std::vector<TranscriptVar>;
+
 class Transcript
 {
     Plan mPlan;
-    std::vector<std::tuple<VarName, Value, bool>> mVars;
+    TranscriptVars mVars;
     friend std::ostream& operator<<(std::ostream& os,
                                     const Transcript& transcript);
     friend std::istream& operator>>(std::istream& is, Transcript& transcript);
@@ -75,33 +92,68 @@ class Transcript
     Transcript();
     Transcript(TestName tn);
     Transcript(Plan const& plan);
+    Transcript(Plan const& plan, TranscriptVars vars);
     TestName getTestName() const;
     Plan const& getPlan() const;
     void addTrackedVar(VarName var, Value val);
     void addCheckedVar(VarName var, Value val);
-    std::vector<std::tuple<VarName, Value, bool>> const& getVars() const;
+    void addMeasuredVar(VarName var, int64_t median, int64_t mad);
+    TranscriptVars const& getVars() const;
     void clearVars();
     bool operator<(Transcript const& other) const;
     bool operator==(Transcript const& other) const;
+
+    // Like operator== except that measured variables are considered equal if
+    // their medians differ by no more than `tolerance` times the larger of
+    // their two MADs.
+    bool matches(Transcript const& other, double tolerance) const;
+    static bool varMatches(TranscriptVar const& a, TranscriptVar const& b,
+                           double tolerance);
+    static bool varsMatch(TranscriptVars const& a, TranscriptVars const& b,
+                          double tolerance);
 };
 
 std::ostream& operator<<(std::ostream& os, const Transcript& transcript);
 std::istream& operator>>(std::istream& is, Transcript& transcript);
+class Sidecar;
+
 class Corpus
 {
     std::string mPath;
     bool mSaveOnDestroy;
     bool mDirty;
     std::map<TestName, std::set<Transcript>> mTranscripts;
+    std::map<std::string, std::unique_ptr<Sidecar>> mSidecars;
 
   public:
     Corpus(std::string const& path = "", bool saveOnDestroy = true);
     ~Corpus();
     void markDirty();
     void save();
+    std::string const& getPath() const;
+
+    // Return the Sidecar stored at this corpus' path plus `.` plus `suffix`,
+    // loading it on first use. Sidecars are saved whenever the corpus is.
+    Sidecar& getSidecar(std::string const& suffix);
+
     std::set<Transcript>& getTranscripts(TestName tname);
-    void addTranscript(Transcript const& ts);
-    void replaceTranscript(Transcript const& oldTs, Transcript const& newTs);
-    void updateTranscript(Transcript const& ts);
+    std::map<TestName, std::set<Transcript>> const& getAllTranscripts() const;
+
+    // These each return a reference to the transcript as stored in the
+    // corpus, which remains valid until it is itself replaced or updated.
+    Transcript const& addTranscript(Transcript ts);
+    Transcript const& replaceTranscript(Transcript const& oldTs,
+                                        Transcript newTs);
+    Transcript const& updateTranscript(Transcript ts);
+    void removeTranscript(Transcript const& ts);
+
+    // Apply to this corpus the changes that `changed` made relative to
+    // `base`: transcripts it added, updated or removed, and records of the
+    // named sidecars it added or changed. Used to merge back the corpora of
+    // sharded checks (see `Test::setShard`), whose changes touch disjoint sets
+    // of plans and so can be applied in any order.
+    void mergeChanges(Corpus& base, Corpus& changed,
+                      std::vector<std::string> const& sidecars = {
+                          "coverage", "impact", "schedule", "choices"});
 };
 } // namespace photesthesis
@@ -0,0 +1,99 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace photesthesis
+{
+
+class Sidecar;
+
+// The SUT's path-coverage counters, as registered by LLVM's
+// `-fsanitize-coverage=inline-8bit-counters` instrumentation. If the SUT was
+// not compiled with instrumentation, the region is empty.
+uint8_t* getCoverageCounters();
+size_t getCoverageCountersSize();
+
+// A SharedCoverage is a map of coverage counters in a POSIX shared-memory
+// segment, which instrumented processes other than the test's own add their
+// counters into, AFL-style: counter `i` of a process is added to
+// `mCounters[i % Size]`, saturating at 255. Tests append it to their own
+// counters when computing path trajectories.
+struct SharedCoverage
+{
+    static constexpr uint64_t Magic = 0x5048434f56455247; // "PHCOVERG"
+    static constexpr uint64_t Version = 1;
+    static constexpr size_t Size = 1 << 16;
+
+    uint64_t mMagic;
+    uint64_t mVersion;
+    uint8_t mCounters[Size];
+};
+
+// Return the process-wide SharedCoverage, creating its segment on first call
+// and naming it in the environment variable `PHOTESTHESIS_COVERAGE_SHM`, so
+// that processes started afterwards inherit it. Programs linked with
+// `libphotesthesis-runtime.a` that find the variable set attach to the
+// segment and add their counters into it as they exit. The segment is removed
+// when this process exits. Throws std::runtime_error if it can't be created.
+SharedCoverage& getSharedCoverage();
+
+// An Edge is the index of a coverage counter paired with its AFL-style
+// bucketed count.
+using Edge = std::pair<uint32_t, uint8_t>;
+
+// Encode the nonzero entries of `len` (bucketed) counters as a compact
+// string: each edge is a varint of the delta from the previous edge index
+// followed by its bucket byte, and the whole byte sequence is hex-encoded so
+// that it can be stored as a string Value in a Sidecar.
+std::string encodeEdges(uint8_t const* counters, size_t len);
+std::vector<Edge> decodeEdges(std::string const& encoded);
+
+// A CoverageFunction describes the contiguous range of coverage counters
+// belonging to a single function, as recovered from LLVM's
+// `-fsanitize-coverage=pc-table` instrumentation.
+struct CoverageFunction
+{
+    std::string mName;
+    std::string mFile;
+    size_t mFirstEdge{0};
+    size_t mNumEdges{0};
+    uintptr_t mEntryPC{0};
+    uintptr_t mMaxPC{0};
+};
+
+// Return the functions described by the pc-table, symbolized with the
+// sanitizer runtime's symbolizer if one is linked in, or `dladdr`
+// otherwise. Returns an empty vector if the SUT was not compiled with
+// `pc-table`.
+std::vector<CoverageFunction> const& getCoverageFunctions();
+
+// Return the names of the functions containing any nonzero counter in
+// `counters`, which must be indexed like the coverage counters.
+std::set<std::string> getCoveredFunctions(std::vector<uint8_t> const& counters);
+
+// Return a content fingerprint of each function described by the pc-table,
+// keyed by name: a hash of the function's machine code, as delimited by its
+// ELF symbol if `dladdr1` can find one, or by its lowest and highest
+// instrumented PCs otherwise. Copies of a function with the same name are
+// combined into one fingerprint of all of their code. Since code bytes
+// include relative call and data offsets, a change to one function can also
+// change the fingerprints of others; this errs on the side of reporting too
+// many changes.
+std::map<std::string, uint64_t> getFunctionFingerprints();
+
+// Write an aggregate per-function and per-file coverage report for every
+// transcript whose edges were recorded in `coverage` (see
+// `PHOTESTHESIS_COVERAGE_EXPORT`).
+void writeCoverageReport(Sidecar const& coverage, std::ostream& os);
+
+} // namespace photesthesis
@@ -0,0 +1,304 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/symbol.h>
+#include <photesthesis/value.h>
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace photesthesis
+{
+
+// Decoding converts a Value into a C++ type in a single walk, with the shape
+// to expect given by the type rather than by a chain of `match` calls:
+//
+//     auto [head, n, rest] =
+//         decode<std::tuple<Symbol, int64_t, std::vector<Value>>>(v);
+//
+// A Decoder<T> is composed at compile time for:
+//
+//   - Value (anything), Symbol, bool, int64_t, std::string, and
+//     std::vector<uint8_t> (a Blob);
+//   - std::tuple and std::pair, from a list of exactly as many elements;
+//   - std::vector, std::set and std::map, from a list of elements (or of
+//     two-element key/value lists), as the corresponding Value constructors
+//     build them; Nil decodes as empty;
+//   - std::optional, from Nil or from whatever its element decodes from;
+//   - user structs, by specializing Decoder as a StructDecoder of the
+//     struct's fields (see below).
+//
+// Each node is visited once, and its type is checked once; nothing is copied
+// except into the result.
+template <typename T, typename = void> struct Decoder;
+
+// `decode(v, out)` returns false (leaving `out` partly written) if `v` does
+// not have the shape T requires; `decode<T>(v)` throws std::runtime_error
+// instead.
+template <typename T>
+inline bool
+decode(Value const& v, T& out)
+{
+    return Decoder<T>::decode(v, out);
+}
+
+template <typename T>
+inline T
+decode(Value const& v)
+{
+    T out{};
+    if (!Decoder<T>::decode(v, out))
+    {
+        std::ostringstream oss;
+        oss << "cannot decode value: " << v;
+        throw std::runtime_error(oss.str());
+    }
+    return out;
+}
+
+template <> struct Decoder<Value>
+{
+    static bool
+    decode(Value const& v, Value& out)
+    {
+        out = v;
+        return true;
+    }
+};
+
+// The scalar decoders check the Type and read the payload directly.
+template <typename T, Type Ty, typename Impl> struct ScalarDecoder
+{
+    static bool
+    decode(Value const& v, T& out)
+    {
+        ValueImpl const* impl = v.getImpl();
+        if (!impl || impl->getType() != Ty)
+        {
+            return false;
+        }
+        out = static_cast<Impl const*>(impl)->getValue();
+        return true;
+    }
+};
+
+template <>
+struct Decoder<Symbol> : ScalarDecoder<Symbol, Type::Sym, SymValue>
+{
+};
+template <>
+struct Decoder<bool> : ScalarDecoder<bool, Type::Bool, BoolValue>
+{
+};
+template <>
+struct Decoder<int64_t> : ScalarDecoder<int64_t, Type::Int64, Int64Value>
+{
+};
+template <>
+struct Decoder<std::string>
+    : ScalarDecoder<std::string, Type::String, StringValue>
+{
+};
+template <>
+struct Decoder<std::vector<uint8_t>>
+    : ScalarDecoder<std::vector<uint8_t>, Type::Blob, BlobValue>
+{
+};
+
+// Walks the cells of a list, for the composite decoders. A cursor starts at
+// a Value that must be a list (or Nil, the empty list).
+class ListCursor
+{
+    PairValue const* mCell{nullptr};
+
+  public:
+    bool
+    start(Value const& v)
+    {
+        ValueImpl const* impl = v.getImpl();
+        if (!impl)
+        {
+            mCell = nullptr;
+            return true;
+        }
+        if (impl->getType() != Type::Pair)
+        {
+            return false;
+        }
+        mCell = static_cast<PairValue const*>(impl);
+        return true;
+    }
+
+    bool
+    done() const
+    {
+        return mCell == nullptr;
+    }
+
+    // Decode the next element into `out` and advance past it.
+    template <typename T>
+    bool
+    next(T& out)
+    {
+        if (!mCell)
+        {
+            return false;
+        }
+        auto const& pair = mCell->getValue();
+        if (!Decoder<T>::decode(pair.first, out))
+        {
+            return false;
+        }
+        mCell = pair.second.get();
+        return true;
+    }
+};
+
+template <typename... Ts> struct Decoder<std::tuple<Ts...>>
+{
+    template <size_t... I>
+    static bool
+    decodeElements(ListCursor& c, std::tuple<Ts...>& out,
+                   std::index_sequence<I...>)
+    {
+        return (c.next(std::get<I>(out)) && ...);
+    }
+
+    static bool
+    decode(Value const& v, std::tuple<Ts...>& out)
+    {
+        ListCursor c;
+        return c.start(v) &&
+               decodeElements(c, out, std::index_sequence_for<Ts...>{}) &&
+               c.done();
+    }
+};
+
+template <typename A, typename B> struct Decoder<std::pair<A, B>>
+{
+    static bool
+    decode(Value const& v, std::pair<A, B>& out)
+    {
+        ListCursor c;
+        return c.start(v) && c.next(out.first) && c.next(out.second) &&
+               c.done();
+    }
+};
+
+template <typename T>
+struct Decoder<std::vector<T>,
+               std::enable_if_t<!std::is_same<T, uint8_t>::value>>
+{
+    static bool
+    decode(Value const& v, std::vector<T>& out)
+    {
+        ListCursor c;
+        if (!c.start(v))
+        {
+            return false;
+        }
+        out.clear();
+        while (!c.done())
+        {
+            if (!c.next(out.emplace_back()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <typename T> struct Decoder<std::set<T>>
+{
+    static bool
+    decode(Value const& v, std::set<T>& out)
+    {
+        ListCursor c;
+        if (!c.start(v))
+        {
+            return false;
+        }
+        out.clear();
+        while (!c.done())
+        {
+            T elt{};
+            if (!c.next(elt))
+            {
+                return false;
+            }
+            out.emplace(std::move(elt));
+        }
+        return true;
+    }
+};
+
+template <typename K, typename V> struct Decoder<std::map<K, V>>
+{
+    static bool
+    decode(Value const& v, std::map<K, V>& out)
+    {
+        ListCursor c;
+        if (!c.start(v))
+        {
+            return false;
+        }
+        out.clear();
+        while (!c.done())
+        {
+            std::pair<K, V> kv{};
+            if (!c.next(kv))
+            {
+                return false;
+            }
+            out.emplace(std::move(kv));
+        }
+        return true;
+    }
+};
+
+template <typename T> struct Decoder<std::optional<T>>
+{
+    static bool
+    decode(Value const& v, std::optional<T>& out)
+    {
+        if (!v.getImpl())
+        {
+            out.reset();
+            return true;
+        }
+        return Decoder<T>::decode(v, out.emplace());
+    }
+};
+
+// A StructDecoder decodes a list of exactly as many elements as it is given
+// member pointers into those members of S, in order. Specialize Decoder for
+// a struct by deriving from it:
+//
+//     struct Point { Symbol tag; int64_t x; int64_t y; };
+//     template <>
+//     struct Decoder<Point>
+//         : StructDecoder<Point, &Point::tag, &Point::x, &Point::y> {};
+template <typename S, auto... Fields> struct StructDecoder
+{
+    static bool
+    decode(Value const& v, S& out)
+    {
+        ListCursor c;
+        return c.start(v) && (c.next(out.*Fields) && ...) && c.done();
+    }
+};
+
+} // namespace photesthesis
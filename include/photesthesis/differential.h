@@ -0,0 +1,49 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/test.h>
+
+#include <vector>
+
+namespace photesthesis
+{
+
+// A DifferentialTest checks an optimized implementation against a reference
+// one. Instead of `run`, subclasses override `runReference` and
+// `runOptimized`, each of which exercises its implementation on the current
+// plan and makes the same sequence of `check()`/`track()`/`measure()` calls.
+// Every plan is run against both, and any pairwise difference between their
+// observations is reported to `handleDivergence` and counts as a failure.
+//
+// Only the optimized run contributes to the trajectory (both its path
+// coverage and its traces) and to the transcript, so it is the optimized
+// implementation's behaviour that drives corpus expansion. The trajectory is
+// reset between the two runs, so the reference run's coverage is discarded:
+// code reached only by the reference implementation never makes a plan new.
+class DifferentialTest : public Test
+{
+    std::vector<Observation> mReference;
+    size_t mNumReference{0};
+
+    bool observationsAgree(Observation const& a, Observation const& b) const;
+
+  public:
+    using Test::Test;
+
+    virtual void runReference() = 0;
+    virtual void runOptimized() = 0;
+
+    void run() final;
+
+    // Called with the position of each reference/optimized observation pair
+    // that differs. Either side may be null if one run made fewer
+    // observations than the other. By default prints the plan and the pair
+    // if run with PHOTESTHESIS_VERBOSE.
+    virtual void handleDivergence(Plan const& plan, size_t index,
+                                  TranscriptVar const* reference,
+                                  TranscriptVar const* optimized);
+};
+} // namespace photesthesis
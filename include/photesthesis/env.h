@@ -0,0 +1,64 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+// Helpers for the library's translation units to read their configuration
+// from PHOTESTHESIS_* environment variables. Not included by any public
+// header.
+
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+namespace photesthesis
+{
+
+// If `evar` is set, parse it as an unsigned number (in any base strtoull
+// accepts) into `num` and return true.
+inline bool
+getEnvNum(char const* evar, uint64_t& num)
+{
+    if (auto* p = std::getenv(evar))
+    {
+        num = std::strtoull(p, nullptr, 0);
+        return true;
+    }
+    return false;
+}
+
+// As getEnvNum, for a floating-point number.
+inline bool
+getEnvDouble(char const* evar, double& num)
+{
+    if (auto* p = std::getenv(evar))
+    {
+        num = std::strtod(p, nullptr);
+        return true;
+    }
+    return false;
+}
+
+// If `evar` is set, parse it as `index/count` (both decimal) into `index` and
+// `count` and return true. Throws std::runtime_error if it has no `/`.
+inline bool
+getEnvIndexOfCount(char const* evar, uint64_t& index, uint64_t& count)
+{
+    if (auto* p = std::getenv(evar))
+    {
+        char* slash = nullptr;
+        index = std::strtoull(p, &slash, 10);
+        if (*slash != '/')
+        {
+            throw std::runtime_error(std::string(evar) +
+                                     " must be index/count, got " + p);
+        }
+        count = std::strtoull(slash + 1, nullptr, 10);
+        return true;
+    }
+    return false;
+}
+
+} // namespace photesthesis
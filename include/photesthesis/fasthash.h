@@ -0,0 +1,81 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/3rdparty/xxhash64.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace photesthesis
+{
+
+// FastHash is a 64-bit non-cryptographic hash in the style of XXH3, for
+// hashes that are recomputed every run and never persisted. Inputs of up to
+// 64 bytes take a short path of a few 64x64->128-bit multiplies. Longer
+// inputs are consumed in 64-byte stripes by eight independent accumulator
+// lanes doing 32x32->64-bit multiply-adds (with AVX2 or SSE2 when the build
+// enables them, and portable code otherwise), with the lanes scrambled every
+// 16 stripes and folded together at the end.
+//
+// It has the same interface as XXHash64, so either can be used where a
+// hasher type is a parameter: a streaming `add`/`hash` pair, and a static
+// one-shot `hash` that gives the same result as streaming the same bytes.
+class FastHash
+{
+  public:
+    static constexpr size_t StripeSize = 64;
+    static constexpr size_t Lanes = StripeSize / 8;
+    static constexpr size_t StripesPerBlock = 16;
+
+  private:
+    uint64_t mAcc[Lanes];
+    uint8_t mBuf[StripeSize];
+    size_t mBufLen{0};
+    uint64_t mTotal{0};
+    uint64_t mStripes{0};
+    uint64_t mSeed;
+
+    static void accumulate(uint64_t* acc, uint8_t const* data, size_t n,
+                           uint64_t& stripes);
+    static uint64_t finishLong(uint64_t const* acc, uint8_t const* tail,
+                               size_t tailLen, uint64_t stripes,
+                               uint64_t total, uint64_t seed);
+    static uint64_t hashShort(uint8_t const* data, size_t len, uint64_t seed);
+    void addSlow(uint8_t const* data, size_t len);
+
+  public:
+    explicit FastHash(uint64_t seed = 0);
+
+    inline void
+    add(void const* data, size_t len)
+    {
+        if (mBufLen + len <= StripeSize)
+        {
+            std::memcpy(mBuf + mBufLen, data, len);
+            mBufLen += len;
+            mTotal += len;
+            return;
+        }
+        addSlow(static_cast<uint8_t const*>(data), len);
+    }
+
+    uint64_t hash() const;
+
+    static uint64_t hash(void const* data, size_t len, uint64_t seed = 0);
+};
+
+// The hasher for trajectories (and anything else recomputed from scratch on
+// every run). Define `PHOTESTHESIS_XXHASH_TRAJECTORIES` to use XXHash64
+// instead. Plan hashes and function fingerprints are stored in corpora, so
+// they always use XXHash64.
+#ifdef PHOTESTHESIS_XXHASH_TRAJECTORIES
+using TrajectoryHasher = XXHash64;
+#else
+using TrajectoryHasher = FastHash;
+#endif
+
+} // namespace photesthesis
@@ -9,8 +9,8 @@
 #include <map>
 #include <memory>
 #include <photesthesis/corpus.h>
+#include <photesthesis/random.h>
 #include <photesthesis/value.h>
-#include <random>
 #include <string>
 #include <vector>
 
@@ -103,6 +103,7 @@ class Production
     friend Production notInContext(ParamName ctx, Production prod);
 
     Production(std::initializer_list<AtomPtr> atoms);
+    Production(std::vector<AtomPtr> atoms);
 };
 
 // Evidently we need to delcare these out-of-line from the class
@@ -116,6 +117,7 @@ struct Rule
 {
     const std::vector<Production> mProductions;
     Rule(std::initializer_list<Production> productions);
+    Rule(std::vector<Production> productions);
 };
 
 // A Context enables writing context-sensitive Productions in Grammars. The
@@ -147,6 +149,68 @@ class Context
 // We use this to generate a certain form of grammar coverage.
 using KPath = std::vector<AtomPtr>;
 
+// A Chooser makes the decisions involved in generating a Value from a
+// Grammar: which of `n` active productions of a rule to expand.
+class Chooser
+{
+  public:
+    virtual ~Chooser();
+    virtual size_t choose(size_t n) = 0;
+};
+
+// A RandomChooser picks uniformly using a random engine (drawing exactly as
+// `pickUniform` does), optionally appending each decision to a choice
+// sequence in the encoding read by ChoiceSequence.
+class RandomChooser : public Chooser
+{
+    RandomEngine& mGen;
+    std::vector<uint8_t>* mRecord;
+
+  public:
+    RandomChooser(RandomEngine& gen,
+                  std::vector<uint8_t>* record = nullptr);
+    size_t choose(size_t n) override;
+};
+
+// A ChoiceSequence reads decisions from a byte buffer, so that generation is
+// a deterministic function of the bytes. A decision among `n` alternatives
+// reads the fewest bytes that can hold `n - 1` (none if `n` is 1) as a
+// big-endian number and takes it modulo `n`. Reading past the end of the
+// buffer yields zeros, so every buffer decodes to some value, and bytes that
+// are shorter or smaller decode to values built from earlier productions.
+// The buffer is borrowed, not copied.
+class ChoiceSequence : public Chooser
+{
+    uint8_t const* mData;
+    size_t mSize;
+    size_t mPos{0};
+
+  public:
+    ChoiceSequence(uint8_t const* data, size_t size);
+    ChoiceSequence(std::vector<uint8_t> const& bytes);
+    size_t choose(size_t n) override;
+
+    // The number of bytes a decision among `n` alternatives reads.
+    static size_t width(size_t n);
+
+    // The number of bytes read so far; bytes past this did not affect the
+    // value generated.
+    size_t getPosition() const;
+};
+
+// A Reduction replaces the subtree at `mPath` of a derivation (a sequence of
+// list indices, where index 0 is a list's head symbol) with a simpler
+// derivation of the same rule. See `Grammar::reductions`.
+struct Reduction
+{
+    std::vector<size_t> mPath;
+    Value mReplacement;
+};
+
+// Return `v` with the subtree at `path` replaced by `replacement`.
+Value replaceAtPath(Value const& v, std::vector<size_t> const& path,
+                    Value const& replacement);
+
 // A Grammar is a set of named Rules as well as a factory for handing out
 // various types of Atom that populate Productions (and thus Rules). A Grammar
 // also has methods to populate a Plan using one of two strategies: randomly,
@@ -169,9 +233,9 @@ class Grammar
     getActiveProductions(RuleName rule, size_t depth_lim,
                          Context const& ctx) const;
 
-    // Return a random Vaule produced by a given rule with a given depth limit
-    // and Context.
-    Value randomValueFromRule(RuleName rule, std::default_random_engine& gen,
+    // Return a Vaule produced by a given rule with a given depth limit and
+    // Context, making each choice of production with `chooser`.
+    Value randomValueFromRule(RuleName rule, Chooser& chooser,
                               size_t depthLimit, Context& context) const;
 
     // Return the set of k-paths starting from `prefix`.
@@ -179,6 +243,29 @@ class Grammar
                                       Context& context,
                                       std::set<RefPtr>& pathRoots) const;
 
+    // Return the production of `rule` that `elts` (the elements of a list
+    // whose head is `rule`) was derived from, or nullptr if there is none.
+    Production const* derivingProduction(RuleName rule,
+                                         std::vector<Value> const& elts,
+                                         Context& context) const;
+
+    bool derivesInContext(RuleName rule, Value const& v,
+                          Context& context) const;
+
+    // Set `out` to the smallest expansion of `rule` no deeper than
+    // `depthLimit`, returning false if there is none.
+    bool minimalExpansionInContext(RuleName rule, size_t depthLimit,
+                                   Context& context, Value& out) const;
+    bool minimalExpansionInContext(RuleName rule, Context& context,
+                                   Value& out) const;
+
+    void nodeReductions(RuleName rule, Value const& v, Context& context,
+                        std::vector<size_t> const& path,
+                        std::vector<Reduction>& out) const;
+    size_t levelReductions(RuleName rule, Value const& v, Context& context,
+                           size_t level, std::vector<size_t>& path,
+                           std::vector<Reduction>& out) const;
+
     // Generate a k-path set from the given rule, in a given ParamSpecs
     // environment.
     std::set<KPath> generateKPathSet(size_t k, RuleName root,
@@ -208,14 +295,47 @@ class Grammar
     LitPtr Blob(std::vector<uint8_t> const&);
     LitPtr Str(std::string const&);
     void addRule(RuleName const& name, std::initializer_list<Production> prods);
+    void addRule(RuleName const& name, std::vector<Production> prods);
 
     Plan randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
-                              std::default_random_engine& gen,
+                              RandomEngine& gen,
                               size_t depthLimit) const;
 
+    // As above, but also append the choice sequence that reproduces the plan
+    // (with `populatePlanFromChoices`, given the same params and depth limit)
+    // to `choices`.
+    Plan randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
+                              RandomEngine& gen,
+                              size_t depthLimit,
+                              std::vector<uint8_t>& choices) const;
+
+    // Populate a plan by making the choices read from `choices`.
+    Plan populatePlanFromChoices(TestName tname, ParamSpecs const& params,
+                                 Chooser& choices, size_t depthLimit) const;
+
     std::set<Plan> populatePlansFromKPathCoverings(TestName tname,
                                                    ParamSpecs const& specs,
                                                    size_t k) const;
+
+    // Return whether `v` could have been produced from `rule` (with no depth
+    // limit) when populating a plan for `specs`.
+    bool derives(RuleName rule, Value const& v, ParamSpecs const& specs) const;
+
+    // Return the smallest expansion of `rule` (fewest leaves, then least by
+    // Value order) among those of least depth.
+    Value minimalExpansion(RuleName rule, ParamSpecs const& specs) const;
+
+    // Append to `out` the ways of simplifying each node `level` steps below
+    // the root of `v`, a derivation of `rule`: replacing it with its rule's
+    // minimal expansion, hoisting a descendant of the same rule into its
+    // place, or re-deriving it from another production of its rule that
+    // reuses a subsequence of its children (which drops list elements and
+    // picks smaller literals). Each node's reductions are strictly smaller
+    // than the node and are appended together, smallest first. Returns the
+    // number of nodes at `level`. Reductions are not guaranteed to leave a
+    // valid derivation in context-sensitive grammars; check with `derives`.
+    size_t reductions(RuleName rule, Value const& v, ParamSpecs const& specs,
+                      size_t level, std::vector<Reduction>& out) const;
 };
 
 } // namespace photesthesis
@@ -0,0 +1,80 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/corpus.h>
+#include <photesthesis/test.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace photesthesis
+{
+
+// A FuzzTarget lets libFuzzer drive a Test. Each fuzzer input is decoded as a
+// choice sequence (see `ChoiceSequence`) into a plan for `specs`, which is
+// then run. Inputs whose trajectory is new to the test's corpus are recorded
+// in it as readable transcripts, as `administer` would record them, and the
+// corpus is saved at most once every `setSaveInterval` seconds (default 10)
+// and when the target is destroyed. A failing plan saves the corpus and
+// aborts, so that libFuzzer records the input as a crash.
+//
+// The custom mutator works on whole decisions: it keeps a random prefix of
+// the input's choices and regenerates the rest at random, which replaces one
+// subtree of the plan and everything after it. Half the time it defers to
+// libFuzzer's own byte-level mutator instead.
+//
+// Define the entry points with `PHOTESTHESIS_FUZZ_TARGET`, and build
+// photesthesis with `-DPHOTESTHESIS_LIBFUZZER` so that it leaves the
+// sanitizer-coverage callbacks to libFuzzer.
+class FuzzTarget
+{
+    Test& mTest;
+    ParamSpecs mSpecs;
+    uint64_t mDepth;
+    bool mPrepared{false};
+    uint64_t mSaveInterval{10};
+    uint64_t mLastSave{0};
+    bool mDirty{false};
+    std::vector<uint8_t> mPrefix;
+
+    void saveIfDue(bool force);
+
+  public:
+    FuzzTarget(Test& test, ParamSpecs const& specs, uint64_t depth = 8);
+    ~FuzzTarget();
+
+    void setSaveInterval(uint64_t seconds);
+
+    // Check (or initialize) the test's corpus and collect its trajectories.
+    // Called from LLVMFuzzerInitialize, or else by the first input.
+    void initialize();
+
+    // The bodies of LLVMFuzzerTestOneInput and LLVMFuzzerCustomMutator.
+    int testOneInput(uint8_t const* data, size_t size);
+    size_t mutate(uint8_t* data, size_t size, size_t maxSize, unsigned seed);
+};
+
+} // namespace photesthesis
+
+// Define libFuzzer's entry points to call `target`, an expression denoting a
+// FuzzTarget that is evaluated on every call (typically a function returning
+// a reference to a function-local static).
+#define PHOTESTHESIS_FUZZ_TARGET(target)                                       \
+    extern "C" int LLVMFuzzerInitialize(int*, char***)                         \
+    {                                                                          \
+        (target).initialize();                                                 \
+        return 0;                                                              \
+    }                                                                          \
+    extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size)    \
+    {                                                                          \
+        return (target).testOneInput(data, size);                              \
+    }                                                                          \
+    extern "C" size_t LLVMFuzzerCustomMutator(uint8_t* data, size_t size,      \
+                                              size_t maxSize, unsigned seed)   \
+    {                                                                          \
+        return (target).mutate(data, size, maxSize, seed);                     \
+    }
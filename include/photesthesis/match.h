@@ -0,0 +1,184 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/symbol.h>
+#include <photesthesis/value.h>
+
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace photesthesis
+{
+
+// A MatchTable dispatches a list Value on its head Symbol, for interpreters
+// of generated plans. Rather than trying `v.match(ADD, b, c)`, then
+// `v.match(SUB, b, c)` and so on, each re-walking the list, an interpreter
+// registers a handler per head symbol:
+//
+//     MatchTable<int64_t> eval;
+//     eval.on(ADD, [&](Value b, Value c) { return eval(b) + eval(c); })
+//         .on(NEG, [&](Value b) { return -eval(b); })
+//         .otherwise([](Value v) { return int64_t(0); });
+//
+// and `dispatch` looks the head up in a vector indexed by `Symbol::getId`,
+// then matches the elements after the head into the handler's parameters
+// as `Value::match` would (so a parameter may be a Value, Symbol, bool,
+// int64_t, std::string or blob, and elements beyond the last are ignored).
+// The handler for a Value that is not a list headed by a registered symbol,
+// or whose elements do not match the handler's parameters, is the
+// `otherwise` handler, which gets the whole Value; without one, `dispatch`
+// throws std::runtime_error.
+template <typename R> class MatchTable
+{
+    // A case matches the list after the head into its handler's arguments
+    // and calls it, storing the result in `*out` (unless R is void), or
+    // returns false if the list does not match.
+    using Case = std::function<bool(PairValue const* tail, void* out)>;
+    using Result = std::conditional_t<std::is_void<R>::value, bool,
+                                      std::optional<R>>;
+
+    std::vector<Case> mCases;
+    std::function<R(Value const&)> mOtherwise;
+
+    template <typename F> struct Params : Params<decltype(&F::operator())>
+    {
+    };
+    template <typename C, typename Ret, typename... Args>
+    struct Params<Ret (C::*)(Args...) const>
+    {
+        using Tuple = std::tuple<std::decay_t<Args>...>;
+    };
+    template <typename C, typename Ret, typename... Args>
+    struct Params<Ret (C::*)(Args...)>
+    {
+        using Tuple = std::tuple<std::decay_t<Args>...>;
+    };
+    template <typename Ret, typename... Args> struct Params<Ret (*)(Args...)>
+    {
+        using Tuple = std::tuple<std::decay_t<Args>...>;
+    };
+
+    template <typename T>
+    static bool
+    matchNext(PairValue const*& p, T& out)
+    {
+        if (!p || !p->getValue().first.match(out))
+        {
+            return false;
+        }
+        p = p->getValue().second.get();
+        return true;
+    }
+
+    template <typename Tuple, size_t... I>
+    static bool
+    matchAll(PairValue const* p, Tuple& args, std::index_sequence<I...>)
+    {
+        return (matchNext(p, std::get<I>(args)) && ...);
+    }
+
+    bool
+    tryCases(Value const& v, void* out) const
+    {
+        ValueImpl const* impl = v.getImpl();
+        if (!impl || impl->getType() != Type::Pair)
+        {
+            return false;
+        }
+        auto const& pair = static_cast<PairValue const*>(impl)->getValue();
+        ValueImpl const* head = pair.first.getImpl();
+        if (!head || head->getType() != Type::Sym)
+        {
+            return false;
+        }
+        uint32_t id = static_cast<SymValue const*>(head)->getValue().getId();
+        if (id >= mCases.size() || !mCases[id])
+        {
+            return false;
+        }
+        return mCases[id](pair.second.get(), out);
+    }
+
+    R
+    fallBack(Value const& v) const
+    {
+        if (!mOtherwise)
+        {
+            throw std::runtime_error("no MatchTable case matches value");
+        }
+        return mOtherwise(v);
+    }
+
+  public:
+    // Register `handler` for lists headed by `head`, replacing any earlier
+    // handler for it. Returns the table, so that calls can be chained.
+    template <typename F>
+    MatchTable&
+    on(Symbol head, F handler)
+    {
+        using Tuple = typename Params<F>::Tuple;
+        uint32_t id = head.getId();
+        if (id >= mCases.size())
+        {
+            mCases.resize(id + 1);
+        }
+        mCases[id] = [handler](PairValue const* tail, void* out) {
+            using Indices =
+                std::make_index_sequence<std::tuple_size<Tuple>::value>;
+            Tuple args;
+            if (!matchAll(tail, args, Indices{}))
+            {
+                return false;
+            }
+            if constexpr (std::is_void<R>::value)
+            {
+                std::apply(handler, std::move(args));
+            }
+            else
+            {
+                static_cast<Result*>(out)->emplace(
+                    std::apply(handler, std::move(args)));
+            }
+            return true;
+        };
+        return *this;
+    }
+
+    template <typename F>
+    MatchTable&
+    otherwise(F handler)
+    {
+        mOtherwise = handler;
+        return *this;
+    }
+
+    R
+    dispatch(Value const& v) const
+    {
+        Result result{};
+        if (!tryCases(v, &result))
+        {
+            return fallBack(v);
+        }
+        if constexpr (!std::is_void<R>::value)
+        {
+            return std::move(*result);
+        }
+    }
+
+    R
+    operator()(Value const& v) const
+    {
+        return dispatch(v);
+    }
+};
+
+} // namespace photesthesis
@@ -4,8 +4,14 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include <photesthesis/campaign.h>
 #include <photesthesis/corpus.h>
+#include <photesthesis/decode.h>
 #include <photesthesis/grammar.h>
+#include <photesthesis/match.h>
+#include <photesthesis/remote.h>
+#include <photesthesis/stateful.h>
+#include <photesthesis/static_grammar.h>
 #include <photesthesis/symbol.h>
 #include <photesthesis/test.h>
 #include <photesthesis/value.h>
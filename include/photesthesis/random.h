@@ -0,0 +1,98 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <cstdint>
+#include <limits>
+
+namespace photesthesis
+{
+
+// Xoshiro256 is the xoshiro256** generator of Blackman and Vigna: 256 bits of
+// state, a period of 2^256 - 1, and a few shifts, rotates and multiplies per
+// 64-bit output. It is a UniformRandomBitGenerator, so it works with the
+// standard distributions, but `below` is the fast path for the bounded
+// integers that random generation mostly wants.
+//
+// `jump` advances the state by 2^128 outputs, and `split` returns a copy of
+// the generator and jumps this one past it, so a seed can be split into many
+// reproducible streams that never overlap in practice.
+class Xoshiro256
+{
+    uint64_t mState[4];
+
+    static inline uint64_t
+    rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+  public:
+    using result_type = uint64_t;
+
+    // Seeds with zero.
+    Xoshiro256();
+    explicit Xoshiro256(uint64_t seed);
+
+    // Expand `seed` into the full state with splitmix64, as the authors
+    // recommend, so that similar seeds give unrelated streams.
+    void seed(uint64_t seed);
+
+    void jump();
+    Xoshiro256 split();
+
+    static constexpr result_type
+    min()
+    {
+        return 0;
+    }
+
+    static constexpr result_type
+    max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    inline result_type
+    operator()()
+    {
+        uint64_t result = rotl(mState[1] * 5, 7) * 9;
+        uint64_t t = mState[1] << 17;
+        mState[2] ^= mState[0];
+        mState[3] ^= mState[1];
+        mState[1] ^= mState[2];
+        mState[0] ^= mState[3];
+        mState[2] ^= t;
+        mState[3] = rotl(mState[3], 45);
+        return result;
+    }
+
+    // A uniformly distributed integer in [0, n), by Lemire's
+    // multiply-and-shift method: unbiased, and without a division except
+    // on the rare draws that land in the biased sliver. `n` must be nonzero.
+    inline uint64_t
+    below(uint64_t n)
+    {
+        __uint128_t m = static_cast<__uint128_t>((*this)()) * n;
+        uint64_t low = static_cast<uint64_t>(m);
+        if (low < n)
+        {
+            uint64_t threshold = -n % n;
+            while (low < threshold)
+            {
+                m = static_cast<__uint128_t>((*this)()) * n;
+                low = static_cast<uint64_t>(m);
+            }
+        }
+        return static_cast<uint64_t>(m >> 64);
+    }
+};
+
+// The engine used for every random decision in Tests and Grammars. Another
+// engine can be substituted here if it offers the same `seed`, `jump`,
+// `split` and `below` members as well as being a UniformRandomBitGenerator.
+using RandomEngine = Xoshiro256;
+
+} // namespace photesthesis
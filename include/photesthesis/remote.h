@@ -0,0 +1,69 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/corpus.h>
+#include <photesthesis/runtime.h>
+#include <photesthesis/test.h>
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace photesthesis
+{
+
+// A RemoteTest runs its plans in a separate SUT program rather than in the
+// test's own address space, for SUTs that are separate binaries or that
+// must not share a process with the harness (global state, calls to `exit`,
+// sanitizer aborts). The SUT links `libphotesthesis-runtime.a` and calls
+// `serveRemote` from `main` with a function playing the part of `run`; the
+// RemoteTest starts it once as a forkserver (see runtime.h), and each plan
+// then runs in a child forked from it.
+//
+// The child's `check`, `track`, `trace` and `invariant` calls are replayed
+// into this test in order, and its coverage counters are added into the
+// shared coverage map (see `setSubprocessCoverage`, which a RemoteTest always
+// enables), so corpus expansion and checking work as for an in-process
+// test. A child that exits with a nonzero
+// status, dies of a signal, or runs for longer than `setTimeout`
+// milliseconds (default 1000, or `PHOTESTHESIS_REMOTE_TIMEOUT_MS`; 0 for no
+// limit) fails the plan: the outcome is tracked as the variable `exit` and
+// passed to `handleRemoteFailure` (which `replay` also calls, though it
+// ignores observations).
+class RemoteTest : public Test
+{
+    std::vector<std::string> mArgv;
+    std::string mSegmentName;
+    RemoteSegment* mSegment{nullptr};
+    pid_t mServerPid{-1};
+    int mControlFd{-1};
+    int mStatusFd{-1};
+    uint64_t mTimeoutMillis{1000};
+    std::vector<uint8_t> mBuffer;
+
+    void startServer();
+    void stopServer();
+    bool runChild(int& status);
+    void replayObservations();
+
+  public:
+    // `argv` is the SUT's command line; `argv[0]` is looked up in PATH.
+    RemoteTest(Grammar const& gram, Corpus& corp, TestName testName,
+               std::vector<ParamSpecs> const& seedSpecs,
+               std::vector<std::string> const& argv);
+    ~RemoteTest();
+
+    void setTimeout(uint64_t millis);
+
+    // Called when a plan's child exits abnormally; `how` is "exit N",
+    // "signal N" or "timeout". By default prints the plan when verbose.
+    virtual void handleRemoteFailure(Plan const& plan, std::string const& how);
+
+    void run() final;
+};
+
+} // namespace photesthesis
@@ -0,0 +1,118 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/decode.h>
+#include <photesthesis/symbol.h>
+#include <photesthesis/value.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace photesthesis
+{
+
+// The protocol between a RemoteTest (see remote.h) and the runtime linked
+// into an out-of-process SUT.
+//
+// The RemoteTest creates a RemoteSegment in a POSIX shared-memory segment
+// and starts the SUT with the segment's name in the environment variable
+// `PHOTESTHESIS_REMOTE`, a control pipe on `RemoteControlFd` and a status
+// pipe on `RemoteStatusFd`. The SUT's `serveRemote` maps the segment and
+// writes `RemoteHello` to the status pipe. Then, for each run, the
+// RemoteTest writes a plan to `mPlan` and 4 bytes to the control pipe; the
+// SUT forks a child to run the plan and writes the child's pid and then its
+// `waitpid` status to the status pipe, 4 bytes each.
+//
+// The plan is encoded with `encodeValue` as a list of (param value) lists.
+// The child appends its observations to `mObservations`, each a
+// RemoteRecord byte followed by the encoded variable name and value (and for
+// invariants, the value it got). Coverage travels separately, through the
+// SharedCoverage segment named in `PHOTESTHESIS_COVERAGE_SHM` (see
+// coverage.h), which the SUT and any instrumented processes it starts add
+// their counters into as they exit.
+struct RemoteSegment
+{
+    static constexpr uint64_t Magic = 0x504852454d4f5445; // "PHREMOTE"
+    static constexpr uint64_t Version = 2;
+    static constexpr size_t PlanSize = 1 << 20;
+    static constexpr size_t ObservationsSize = 1 << 20;
+
+    uint64_t mMagic;
+    uint64_t mVersion;
+    uint64_t mPlanLen;
+    uint64_t mObservationsLen;
+    // Set if the child had more observations than fit.
+    uint64_t mOverflow;
+    uint8_t mPlan[PlanSize];
+    uint8_t mObservations[ObservationsSize];
+};
+
+constexpr int RemoteControlFd = 198;
+constexpr int RemoteStatusFd = 199;
+constexpr uint32_t RemoteHello = 0x50484653; // "PHFS"
+
+enum class RemoteRecord : uint8_t
+{
+    Check = 'c',
+    Track = 't',
+    Trace = 'r',
+    Invariant = 'i',
+    Reject = 'x',
+};
+
+// A RemoteRun is the SUT's view of the plan being run, with the subset of
+// Test's methods that make sense across the process boundary. Observations
+// are written through to the shared segment as they are made, so those made
+// before a crash are kept.
+class RemoteRun
+{
+    RemoteSegment& mSegment;
+    std::map<Symbol, Value> mParams;
+    std::vector<uint8_t> mRecord;
+
+    void beginRecord(RemoteRecord kind, Symbol var);
+    void endRecord();
+
+  public:
+    explicit RemoteRun(RemoteSegment& segment);
+
+    Value getParam(Symbol param) const;
+    bool hasParam(Symbol param) const;
+
+    // The parameter decoded as a T (see decode.h).
+    template <typename T>
+    T
+    getParam(Symbol param) const
+    {
+        return decode<T>(getParam(param));
+    }
+
+    void check(Symbol var, Value seen);
+    void track(Symbol var, Value seen);
+    void trace(Symbol var, Value seen);
+    void invariant(Symbol var, Value expected, Value got);
+
+    // Reject the plan, as throwing RejectPlan from `Test::run` would. Ends
+    // the child process.
+    [[noreturn]] void reject();
+};
+
+// Programs linked with the runtime attach to the SharedCoverage segment named
+// in `PHOTESTHESIS_COVERAGE_SHM` when they start, if it is set, and add their
+// coverage counters into it when they exit (normally, or on a fatal signal).
+// A process forked from one starts counting afresh.
+
+// Serve plans from the RemoteTest that started this process, calling `fn` in
+// a fresh child process for each. Call this from `main` once the SUT is
+// ready; plans then run from that state. Returns 0 when the RemoteTest
+// closes the control pipe, or 1 if this process was not started by a
+// RemoteTest.
+int serveRemote(std::function<void(RemoteRun&)> const& fn);
+
+} // namespace photesthesis
@@ -0,0 +1,46 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/corpus.h>
+#include <photesthesis/symbol.h>
+#include <photesthesis/value.h>
+
+#include <map>
+#include <string>
+#include <utility>
+
+namespace photesthesis
+{
+
+using SidecarKey = std::pair<TestName, PlanHash>;
+using SidecarRecord = std::map<Symbol, Value>;
+
+// A Sidecar is a file stored next to a Corpus holding machine-generated,
+// per-transcript records (coverage, timings, and so on) keyed by test name and
+// plan hash. Unlike the corpus itself, its content is not meant for human
+// approval, so it is kept in a separate file that can be ignored by revision
+// control or regenerated at will.
+//
+// Sidecars are obtained from `Corpus::getSidecar` and saved along with it.
+class Sidecar
+{
+    std::string mPath;
+    bool mDirty{false};
+    std::map<SidecarKey, SidecarRecord> mRecords;
+
+  public:
+    Sidecar(std::string const& path);
+    void save();
+    std::string const& getPath() const;
+
+    bool has(TestName tname, PlanHash hash, Symbol key) const;
+    Value get(TestName tname, PlanHash hash, Symbol key) const;
+    void set(TestName tname, PlanHash hash, Symbol key, Value val);
+    void erase(TestName tname, PlanHash hash);
+    std::map<SidecarKey, SidecarRecord> const& getRecords() const;
+};
+
+} // namespace photesthesis
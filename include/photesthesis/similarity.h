@@ -0,0 +1,76 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/corpus.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace photesthesis
+{
+
+// An EdgeSignature is a MinHash sketch of the edge set of a run: the set of
+// (counter index, bucketed count) pairs for the nonzero path counters. Two
+// signatures estimate the Jaccard similarity of their edge sets as the
+// fraction of bins in which they agree.
+//
+// It is built by one-permutation hashing, so computing it costs a single
+// hash and compare per nonzero counter rather than one per bin; bins that no
+// element lands in are filled from their nearest nonempty neighbour so that
+// small edge sets still give a usable estimate.
+struct EdgeSignature
+{
+    static constexpr size_t Bins = 64;
+    std::array<uint32_t, Bins> mMins;
+    bool mEmpty{true};
+
+    // `counters` are bucketed path counters, as hashed into the path
+    // trajectory.
+    EdgeSignature(uint8_t const* counters, size_t len);
+
+    double similarity(EdgeSignature const& other) const;
+};
+
+// A NearDuplicateIndex holds the EdgeSignatures of a set of trajectories and
+// finds those similar to a new one by locality-sensitive hashing: each
+// signature is split into bands of rows, and only signatures that agree
+// exactly on some band are compared. With 16 bands of 4 rows, a signature
+// with similarity 0.8 is found with probability 0.9998, and one with
+// similarity 0.3 is compared at all with probability 0.12.
+//
+// Signatures are only compared if their runs had the same user trajectory,
+// since runs that observed different values are never duplicates.
+class NearDuplicateIndex
+{
+    static constexpr size_t Bands = 16;
+    static constexpr size_t Rows = EdgeSignature::Bins / Bands;
+
+    struct Entry
+    {
+        EdgeSignature mSignature;
+        Trajectory mUserTrajectory;
+    };
+    std::vector<Entry> mEntries;
+    std::unordered_map<uint64_t, std::vector<size_t>> mBuckets;
+
+    static uint64_t bandKey(EdgeSignature const& sig, Trajectory userTraj,
+                            size_t band);
+
+  public:
+    void clear();
+    void insert(EdgeSignature const& sig, Trajectory userTraj);
+
+    // Return the greatest similarity to `sig` of any indexed signature with
+    // the same user trajectory that is at least `threshold`, or 0 if there
+    // is none.
+    double findSimilar(EdgeSignature const& sig, Trajectory userTraj,
+                       double threshold) const;
+};
+
+} // namespace photesthesis
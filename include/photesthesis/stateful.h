@@ -0,0 +1,117 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/fasthash.h>
+#include <photesthesis/test.h>
+
+#include <any>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace photesthesis
+{
+
+// A StatefulTest runs a sequence of commands against a stateful SUT. Its plans
+// have a single parameter, the command sequence, which is typically produced by
+// a right-recursive grammar rule such as:
+//
+//     gram.addRule(SEQ, {{gram.Int64(0)}, {gram.Ref(CMD), gram.Ref(SEQ)}});
+//
+// Instead of `run`, subclasses override `reset` to put the SUT in its initial
+// state and `apply` to perform one command, which may `check`, `track` or
+// `trace` as usual.
+//
+// If subclasses also override `snapshot` and `restore`, plans that share a
+// prefix of commands share its execution: the state after each executed
+// prefix is kept in a prefix tree (along with the coverage counters, traces
+// and observations made so far), and a later plan starting with the same
+// commands restores the deepest such state and applies only the rest. Each
+// state keeps only the counters and observations that changed since its
+// parent's. The number of states kept is bounded by `setMaxSnapshots` or the
+// environment variable `PHOTESTHESIS_STATEFUL_SNAPSHOTS` (default 1024, 0 to
+// disable), and the memory they take besides the client's snapshots by
+// `setMaxSnapshotBytes` or `PHOTESTHESIS_STATEFUL_SNAPSHOT_BYTES` (default
+// 64MiB); when either is reached the tree is discarded and rebuilt. The
+// re-runs that check a plan's stability always run every command.
+class StatefulTest : public Test
+{
+    struct PrefixState
+    {
+        std::any mSnapshot;
+        // The coverage counters that differ from the parent's, as (index,
+        // value) pairs.
+        std::vector<std::pair<uint32_t, uint8_t>> mCounterDelta;
+        TrajectoryHasher mHasher{0};
+        // The observations made since the parent's.
+        std::vector<Observation> mObservations;
+        bool mFailed{false};
+    };
+
+    struct PrefixNode
+    {
+        std::map<Value, std::unique_ptr<PrefixNode>> mChildren;
+        std::unique_ptr<PrefixState> mState;
+    };
+
+    ParamName mSequenceParam;
+    PrefixNode mRoot;
+    size_t mNumSnapshots{0};
+    uint64_t mMaxSnapshots{1024};
+    size_t mSnapshotBytes{0};
+    uint64_t mMaxSnapshotBytes{64 << 20};
+    bool mSnapshotsSupported{true};
+    std::vector<Value> mCommands;
+    uint64_t mStepsApplied{0};
+    uint64_t mStepsReused{0};
+
+    // The nodes along the current plan's commands, and the coverage counters
+    // and number of observations as of the last state saved or restored in
+    // the current run, which the next saved state is a delta from.
+    std::vector<PrefixNode*> mPath;
+    std::vector<uint8_t> mPrefixCounters;
+    size_t mPrefixObservations{0};
+
+    bool saveState(PrefixState& state);
+    void restoreStates(size_t depth);
+
+  public:
+    StatefulTest(Grammar const& gram, Corpus& corp, TestName testName,
+                 ParamName sequenceParam, RuleName sequenceRule);
+
+    // Put the SUT in its initial state. Called at the start of every run
+    // that does not restore a snapshot.
+    virtual void reset();
+
+    // Perform one command against the SUT.
+    virtual void apply(Value command) = 0;
+
+    // Return a copy of the SUT's state, or an empty std::any (the default)
+    // if snapshots are not supported.
+    virtual std::any snapshot();
+
+    // Put the SUT back in a state returned by `snapshot`.
+    virtual void restore(std::any const& snapshot);
+
+    // Append the commands in the sequence parameter `sequence` to `out`. By
+    // default this walks a right-recursive sequence: the elements of the list
+    // following its head symbol are commands, except that a last element with
+    // the same head symbol is itself walked, and scalar elements (such as
+    // the `0` terminating the rule above) are skipped.
+    virtual void commands(Value sequence, std::vector<Value>& out) const;
+
+    void setMaxSnapshots(uint64_t maxSnapshots);
+    void setMaxSnapshotBytes(uint64_t maxSnapshotBytes);
+
+    // The number of commands actually applied, and the number skipped by
+    // restoring a snapshot, over the life of this test.
+    uint64_t getStepsApplied() const;
+    uint64_t getStepsReused() const;
+
+    void run() final;
+};
+
+} // namespace photesthesis
@@ -0,0 +1,399 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/corpus.h>
+#include <photesthesis/grammar.h>
+#include <photesthesis/random.h>
+#include <photesthesis/value.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace photesthesis
+{
+
+// A static grammar is a Grammar declared as a constexpr value, so that it is
+// checked by the compiler and stored as flat constant tables rather than
+// built from heap-allocated Atoms at startup:
+//
+//     using namespace photesthesis::dsl;
+//     constexpr auto calc = grammar(
+//         rule("add", prod(int64(0)), prod(ref("expr"), ref("expr"))),
+//         rule("let", prod(int64(0)),
+//              prod(sym("x"), ref("expr"), addContext("x", ref("expr")))),
+//         rule("var", prod(sym("x"))),
+//         rule("expr", prod(int64(1)), prod(ref("add")), prod(ref("let")),
+//              inContext("x", prod(ref("var")))));
+//
+// declares the same grammar as the equivalent `addRule` calls. Evaluating
+// `grammar` in a constant expression fails to compile if a rule is defined
+// twice or has no productions, if a `ref` names an undefined rule, if a
+// production both requires and forbids the same context name, or if a rule
+// has no finite expansion at all (ignoring context guards).
+//
+// A StaticGenerator populates plans from the tables directly, making the
+// same choices and producing the same values as the equivalent Grammar
+// would. Everything else (k-path coverings, shrinking, `derives`) is done by
+// the Grammar that `toGrammar` builds.
+
+// A fixed-capacity set of context names, for guards and context extensions.
+struct StaticNames
+{
+    static constexpr size_t Capacity = 4;
+    std::array<std::string_view, Capacity> mNames{};
+    size_t mCount{0};
+
+    constexpr void
+    add(std::string_view name)
+    {
+        if (contains(name))
+        {
+            return;
+        }
+        if (mCount == Capacity)
+        {
+            throw std::logic_error(
+                "static grammar: too many context names in one place");
+        }
+        mNames[mCount++] = name;
+    }
+
+    constexpr bool
+    contains(std::string_view name) const
+    {
+        for (size_t i = 0; i < mCount; ++i)
+        {
+            if (mNames[i] == name)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+struct StaticAtom
+{
+    enum class Kind : uint8_t
+    {
+        Ref,
+        Sym,
+        Bool,
+        Int64,
+        Str,
+    };
+    Kind mKind{Kind::Int64};
+    // The rule name of a Ref, the symbol of a Sym or the text of a Str.
+    std::string_view mText;
+    // The value of a Bool or Int64, or the index of a Ref's rule.
+    int64_t mInt64{0};
+    // The context names a Ref adds.
+    StaticNames mCtxExt;
+};
+
+struct StaticProductionEntry
+{
+    size_t mFirstAtom{0};
+    size_t mNumAtoms{0};
+    StaticNames mCtxReq;
+    StaticNames mCtxReqNot;
+    bool mHasRefs{false};
+};
+
+struct StaticRuleEntry
+{
+    std::string_view mName;
+    size_t mFirstProduction{0};
+    size_t mNumProductions{0};
+};
+
+// The tables of a static grammar of any size, for the code that reads them.
+struct StaticGrammarView
+{
+    StaticRuleEntry const* mRules;
+    size_t mNumRules;
+    StaticProductionEntry const* mProductions;
+    StaticAtom const* mAtoms;
+
+    // Build the equivalent Grammar.
+    Grammar toGrammar() const;
+};
+
+template <size_t N> struct StaticProduction
+{
+    std::array<StaticAtom, N> mAtoms;
+    StaticNames mCtxReq;
+    StaticNames mCtxReqNot;
+};
+
+template <size_t NP, size_t NA> struct StaticRule
+{
+    std::string_view mName;
+    std::array<StaticProductionEntry, NP> mProductions;
+    std::array<StaticAtom, NA> mAtoms;
+};
+
+template <size_t NR, size_t NP, size_t NA> struct StaticGrammar
+{
+    std::array<StaticRuleEntry, NR> mRules{};
+    std::array<StaticProductionEntry, NP> mProductions{};
+    std::array<StaticAtom, NA> mAtoms{};
+
+    constexpr StaticGrammarView
+    view() const
+    {
+        return {mRules.data(), NR, mProductions.data(), mAtoms.data()};
+    }
+
+    Grammar
+    toGrammar() const
+    {
+        return view().toGrammar();
+    }
+};
+
+namespace dsl
+{
+
+constexpr StaticAtom
+ref(std::string_view rule)
+{
+    return {StaticAtom::Kind::Ref, rule, 0, {}};
+}
+
+constexpr StaticAtom
+addContext(std::string_view ctx, StaticAtom ref)
+{
+    if (ref.mKind != StaticAtom::Kind::Ref)
+    {
+        throw std::logic_error("static grammar: addContext on a literal");
+    }
+    ref.mCtxExt.add(ctx);
+    return ref;
+}
+
+constexpr StaticAtom
+sym(std::string_view s)
+{
+    return {StaticAtom::Kind::Sym, s, 0, {}};
+}
+
+constexpr StaticAtom
+boolean(bool b)
+{
+    return {StaticAtom::Kind::Bool, {}, b ? 1 : 0, {}};
+}
+
+constexpr StaticAtom
+int64(int64_t i)
+{
+    return {StaticAtom::Kind::Int64, {}, i, {}};
+}
+
+constexpr StaticAtom
+str(std::string_view s)
+{
+    return {StaticAtom::Kind::Str, s, 0, {}};
+}
+
+template <typename... Atoms>
+constexpr StaticProduction<sizeof...(Atoms)>
+prod(Atoms... atoms)
+{
+    return {{atoms...}, {}, {}};
+}
+
+template <size_t N>
+constexpr StaticProduction<N>
+inContext(std::string_view ctx, StaticProduction<N> p)
+{
+    p.mCtxReq.add(ctx);
+    return p;
+}
+
+template <size_t N>
+constexpr StaticProduction<N>
+notInContext(std::string_view ctx, StaticProduction<N> p)
+{
+    p.mCtxReqNot.add(ctx);
+    return p;
+}
+
+template <size_t... Ns>
+constexpr StaticRule<sizeof...(Ns), (Ns + ... + 0)>
+rule(std::string_view name, StaticProduction<Ns> const&... prods)
+{
+    StaticRule<sizeof...(Ns), (Ns + ... + 0)> r{name, {}, {}};
+    size_t np = 0;
+    size_t na = 0;
+    auto append = [&](auto const& p) {
+        StaticProductionEntry& e = r.mProductions[np++];
+        e.mFirstAtom = na;
+        e.mNumAtoms = p.mAtoms.size();
+        e.mCtxReq = p.mCtxReq;
+        e.mCtxReqNot = p.mCtxReqNot;
+        for (size_t i = 0; i < e.mCtxReq.mCount; ++i)
+        {
+            if (e.mCtxReqNot.contains(e.mCtxReq.mNames[i]))
+            {
+                throw std::logic_error("static grammar: production both "
+                                       "requires and forbids a context name");
+            }
+        }
+        for (auto const& atom : p.mAtoms)
+        {
+            e.mHasRefs = e.mHasRefs || atom.mKind == StaticAtom::Kind::Ref;
+            r.mAtoms[na++] = atom;
+        }
+    };
+    (append(prods), ...);
+    return r;
+}
+
+template <typename... Rules>
+constexpr auto
+grammar(Rules const&... rules)
+{
+    constexpr size_t NR = sizeof...(Rules);
+    constexpr size_t NP = (std::tuple_size<decltype(rules.mProductions)>::value +
+                           ... + 0);
+    constexpr size_t NA =
+        (std::tuple_size<decltype(rules.mAtoms)>::value + ... + 0);
+    StaticGrammar<NR, NP, NA> g;
+    size_t nr = 0;
+    size_t np = 0;
+    size_t na = 0;
+    auto append = [&](auto const& r) {
+        if (r.mProductions.size() == 0)
+        {
+            throw std::logic_error("static grammar: rule has no productions");
+        }
+        for (size_t i = 0; i < nr; ++i)
+        {
+            if (g.mRules[i].mName == r.mName)
+            {
+                throw std::logic_error("static grammar: duplicate rule");
+            }
+        }
+        g.mRules[nr++] = {r.mName, np, r.mProductions.size()};
+        for (auto e : r.mProductions)
+        {
+            e.mFirstAtom += na;
+            g.mProductions[np++] = e;
+        }
+        for (auto const& atom : r.mAtoms)
+        {
+            g.mAtoms[na++] = atom;
+        }
+    };
+    (append(rules), ...);
+
+    // Resolve every Ref to the index of its rule.
+    for (auto& atom : g.mAtoms)
+    {
+        if (atom.mKind != StaticAtom::Kind::Ref)
+        {
+            continue;
+        }
+        size_t i = 0;
+        while (i < NR && g.mRules[i].mName != atom.mText)
+        {
+            ++i;
+        }
+        if (i == NR)
+        {
+            throw std::logic_error("static grammar: ref to undefined rule");
+        }
+        atom.mInt64 = static_cast<int64_t>(i);
+    }
+
+    // A rule is productive if one of its productions refers only to
+    // productive rules; iterate to a fixed point.
+    std::array<bool, NR> productive{};
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t i = 0; i < NR; ++i)
+        {
+            StaticRuleEntry const& r = g.mRules[i];
+            for (size_t p = 0; !productive[i] && p < r.mNumProductions; ++p)
+            {
+                StaticProductionEntry const& e =
+                    g.mProductions[r.mFirstProduction + p];
+                bool all = true;
+                for (size_t a = 0; a < e.mNumAtoms; ++a)
+                {
+                    StaticAtom const& atom = g.mAtoms[e.mFirstAtom + a];
+                    if (atom.mKind == StaticAtom::Kind::Ref &&
+                        !productive[static_cast<size_t>(atom.mInt64)])
+                    {
+                        all = false;
+                    }
+                }
+                if (all)
+                {
+                    productive[i] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < NR; ++i)
+    {
+        if (!productive[i])
+        {
+            throw std::logic_error(
+                "static grammar: rule has no finite expansion");
+        }
+    }
+    return g;
+}
+
+} // namespace dsl
+
+// A StaticGenerator populates plans from a static grammar's tables, as
+// `Grammar::populatePlanFromChoices` and `Grammar::randomlyPopulatePlan` do
+// from the equivalent Grammar (including the choices made and recorded).
+// Constructing one interns the grammar's symbols and builds its literal
+// Values once; the grammar itself is only read.
+class StaticGenerator
+{
+    StaticGrammarView mGrammar;
+    std::vector<Value> mRuleHeads;
+    std::vector<RuleName> mRuleNames;
+    std::vector<Value> mLiterals;
+    std::vector<std::vector<ParamName>> mAtomCtxExt;
+    std::vector<std::vector<ParamName>> mProdCtxReq;
+    std::vector<std::vector<ParamName>> mProdCtxReqNot;
+
+    size_t ruleIndex(RuleName rule) const;
+    bool isActive(size_t prod, Context const& ctx) const;
+    Value randomValueFromRule(size_t rule, Chooser& chooser,
+                              size_t depthLimit, Context& ctx) const;
+
+  public:
+    explicit StaticGenerator(StaticGrammarView grammar);
+
+    template <size_t NR, size_t NP, size_t NA>
+    explicit StaticGenerator(StaticGrammar<NR, NP, NA> const& grammar)
+        : StaticGenerator(grammar.view())
+    {
+    }
+
+    Plan populatePlanFromChoices(TestName tname, ParamSpecs const& params,
+                                 Chooser& chooser, size_t depthLimit) const;
+    Plan randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
+                              RandomEngine& gen, size_t depthLimit) const;
+    Plan randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
+                              RandomEngine& gen, size_t depthLimit,
+                              std::vector<uint8_t>& choices) const;
+};
+
+} // namespace photesthesis
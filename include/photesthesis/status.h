@@ -0,0 +1,117 @@
+#pragma once
+
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace photesthesis
+{
+
+enum class StatusPhase : uint64_t
+{
+    Idle = 0,
+    Initializing = 1,
+    Checking = 2,
+    Expanding = 3,
+    Replaying = 4,
+    Done = 5,
+};
+
+// A StatusPage is a fixed-layout block of counters published in a named POSIX
+// shared-memory segment while tests run, so that a separate process (the
+// `photesthesis-stat` tool) can watch a long campaign without slowing it
+// down. The running process is the only writer, and updates every field with
+// relaxed atomic stores; readers may observe a mix of old and new fields.
+//
+// The layout is versioned by `Version`; only ever append fields.
+struct StatusPage
+{
+    static constexpr uint64_t Magic = 0x5048535441545553; // "PHSTATUS"
+    static constexpr uint64_t Version = 1;
+    static constexpr size_t TestNameSize = 64;
+
+    uint64_t mMagic;
+    uint64_t mVersion;
+    uint64_t mPid;
+    char mTestName[TestNameSize];
+
+    std::atomic<uint64_t> mPhase;
+    // All times are nanoseconds since the unix epoch.
+    std::atomic<uint64_t> mStartTime;
+    std::atomic<uint64_t> mUpdateTime;
+    std::atomic<uint64_t> mLastNoveltyTime;
+    std::atomic<uint64_t> mExecutions;
+    std::atomic<uint64_t> mExecsPerSec;
+    std::atomic<uint64_t> mTrajectories;
+    std::atomic<uint64_t> mRejections;
+    std::atomic<uint64_t> mHangs;
+    std::atomic<uint64_t> mFailures;
+
+    // Private to the writer: the execution count and time at which
+    // mExecsPerSec was last recalculated.
+    std::atomic<uint64_t> mRateExecutions;
+    std::atomic<uint64_t> mRateTime;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "StatusPage needs lock-free 64-bit atomics to be shareable");
+
+// Return the process-wide StatusPage, creating the shared-memory segment named
+// by the environment variable `PHOTESTHESIS_STATUS` (eg. `/photesthesis-job1`)
+// on first call. Returns nullptr if the variable is unset or the segment can't
+// be created. The segment is left in place at exit so its final state can
+// still be inspected; remove it with `photesthesis-stat -r` or by deleting it
+// from `/dev/shm`.
+StatusPage* getStatusPage();
+
+// Map the StatusPage published in the shared-memory segment `name` read-only,
+// as a reader such as `photesthesis-stat` does. Returns nullptr if there is
+// no such segment, or it is too small or doesn't start with the magic number
+// of a current-or-later version. Release the page with `unmapStatusPage`.
+StatusPage const* mapStatusPage(std::string const& name);
+void unmapStatusPage(StatusPage const* page);
+
+// Current time in nanoseconds since the unix epoch, as used by StatusPage.
+uint64_t statusNow();
+
+// Set the current phase and test name.
+void setStatusPhase(StatusPage& page, StatusPhase phase, char const* testName);
+
+// Record the completion of one execution that took `nanos` nanoseconds,
+// counting it as a hang if that exceeds `hangNanos` (when nonzero).
+inline void
+noteStatusExecution(StatusPage& page, uint64_t now, uint64_t nanos,
+                    uint64_t hangNanos)
+{
+    auto relaxed = std::memory_order_relaxed;
+    uint64_t execs = page.mExecutions.load(relaxed) + 1;
+    page.mExecutions.store(execs, relaxed);
+    page.mUpdateTime.store(now, relaxed);
+    if (hangNanos != 0 && nanos > hangNanos)
+    {
+        page.mHangs.store(page.mHangs.load(relaxed) + 1, relaxed);
+    }
+    uint64_t rateTime = page.mRateTime.load(relaxed);
+    if (now - rateTime >= 1000000000)
+    {
+        uint64_t rateExecs = page.mRateExecutions.load(relaxed);
+        page.mExecsPerSec.store(
+            (execs - rateExecs) * 1000000000 / (now - rateTime), relaxed);
+        page.mRateExecutions.store(execs, relaxed);
+        page.mRateTime.store(now, relaxed);
+    }
+}
+
+inline void
+bumpStatusCounter(std::atomic<uint64_t>& counter, uint64_t n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+}
+
+} // namespace photesthesis
@@ -19,8 +19,18 @@ namespace photesthesis
 /// in a Grammar, either as a terminal or nonterminal.
 class Symbol
 {
-    std::shared_ptr<std::string> mInterned;
-    static std::shared_ptr<std::string> intern(std::string const&);
+  public:
+    // Each distinct string is interned once, and numbered in order of
+    // interning.
+    struct Interned
+    {
+        std::string mString;
+        uint32_t mId;
+    };
+
+  private:
+    std::shared_ptr<const Interned> mInterned;
+    static std::shared_ptr<const Interned> intern(std::string const&);
 
   public:
     Symbol(std::string const& s);
@@ -36,8 +46,18 @@ class Symbol
     std::string const&
     getString() const
     {
-        return *mInterned;
+        return mInterned->mString;
     };
+
+    // A small dense number identifying the symbol within this process, for
+    // indexing tables by symbol. IDs are assigned as symbols are first
+    // created, so they are not stable between runs and must not be stored.
+    uint32_t
+    getId() const
+    {
+        return mInterned->mId;
+    }
+
     friend std::ostream& operator<<(std::ostream& os, const Symbol& sym);
     friend std::istream& operator>>(std::istream& is, Symbol& sym);
 };
@@ -6,9 +6,20 @@
 
 #include "photesthesis/3rdparty/xxhash64.h"
 #include <photesthesis/corpus.h>
+#include <photesthesis/decode.h>
+#include <photesthesis/fasthash.h>
 #include <photesthesis/grammar.h>
+#include <photesthesis/similarity.h>
+#include <photesthesis/status.h>
+#include <photesthesis/util.h>
 #include <photesthesis/value.h>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+
 namespace photesthesis
 {
 
@@ -18,14 +29,203 @@ class RejectPlan
 {
 };
 
+// When online checking is enabled (see Test::administer), check() and track()
+// throw TranscriptMismatch out of Test::run() as soon as an observation
+// diverges from the transcript being checked. Like RejectPlan it deliberately
+// does not derive from std::exception; clients should let it propagate.
+class TranscriptMismatch
+{
+};
+
+// A ReplayTiming summarizes the wall-clock latency of repeatedly running a
+// single transcript's plan in Test::replay. All times are in nanoseconds.
+struct ReplayTiming
+{
+    TestName mTestName;
+    PlanHash mPlanHash{0};
+    uint64_t mIterations{0};
+    uint64_t mMin{0};
+    uint64_t mMedian{0};
+    uint64_t mP99{0};
+};
+
+class DifferentialTest;
+class StatefulTest;
+class Test;
+
+// A TaskObserver lets one task of a concurrent SUT make `trace`, `check`,
+// `track` and `invariant` calls without synchronizing with other tasks.
+// The calls are appended to a buffer owned by the observer, and when the
+// observer is destroyed (or `submit` is called) the buffer is handed to the
+// test with a single lock-free push. When `run` returns, the test merges the
+// buffers of all the tasks in order of their `key`, making each buffered call
+// as if `run` itself had made them all after its own, so the trajectory and
+// transcript do not depend on how the tasks were scheduled.
+//
+// Keys must be distinct within a run (the index of a work item, say, or a
+// sequence number handed out in a deterministic order), and every observer
+// must be submitted before `run` returns. Each observer must only be used
+// from one thread at a time.
+class TaskObserver
+{
+  public:
+    enum class Call : uint8_t
+    {
+        Trace,
+        Check,
+        Track,
+        Invariant,
+    };
+
+    // One buffered call. As in Test's observations, scalars and strings are
+    // held unboxed when mType is not Nil; mExpected is only used by
+    // invariants.
+    struct Record
+    {
+        Call mCall;
+        VarName mName;
+        Type mType{Type::Nil};
+        int64_t mScalar{0};
+        std::string mText;
+        Value mValue;
+        Value mExpected;
+    };
+
+    struct Buffer
+    {
+        uint64_t mKey{0};
+        std::vector<Record> mRecords;
+        Buffer* mNext{nullptr};
+    };
+
+  private:
+    Test& mTest;
+    std::unique_ptr<Buffer> mBuffer;
+
+    Record* append(Call call, VarName vn);
+
+    // Buffer one call of any kind, holding scalars and strings unboxed.
+    void record(Call call, VarName vn, Value seen);
+    void record(Call call, VarName vn, bool seen);
+    void record(Call call, VarName vn, int64_t seen);
+    void record(Call call, VarName vn, std::string_view seen);
+
+    void
+    record(Call call, VarName vn, char const* seen)
+    {
+        record(call, vn, std::string_view(seen));
+    }
+
+    void
+    record(Call call, VarName vn, std::string const& seen)
+    {
+        record(call, vn, std::string_view(seen));
+    }
+
+    template <typename T,
+              std::enable_if_t<std::is_integral<T>::value &&
+                                   !std::is_same<T, bool>::value,
+                               int> = 0>
+    void
+    record(Call call, VarName vn, T seen)
+    {
+        record(call, vn, static_cast<int64_t>(seen));
+    }
+
+  public:
+    TaskObserver(Test& test, uint64_t key);
+    ~TaskObserver();
+    TaskObserver(TaskObserver const&) = delete;
+    TaskObserver& operator=(TaskObserver const&) = delete;
+
+    // Hand the calls made so far to the test; later calls are ignored.
+    void submit();
+
+    void invariant(VarName, Value expected, Value got);
+    void trace(VarName, uint8_t const* data, size_t len);
+
+    // These take a Value or any of the scalar and string types that Test's
+    // typed forms of the same calls take.
+    template <typename T>
+    void
+    trace(VarName vn, T const& seen)
+    {
+        record(Call::Trace, vn, seen);
+    }
+
+    template <typename T>
+    void
+    check(VarName vn, T const& seen)
+    {
+        record(Call::Check, vn, seen);
+    }
+
+    template <typename T>
+    void
+    track(VarName vn, T const& seen)
+    {
+        record(Call::Track, vn, seen);
+    }
+};
+
 class Test
 {
+    friend class DifferentialTest;
+    friend class StatefulTest;
+    friend class FuzzTarget;
+    friend class RemoteTest;
+    friend class TaskObserver;
 
     Grammar const& mGram;
     Corpus& mCorp;
     uint64_t mLastSeed{0};
-    std::default_random_engine mGen;
+    RandomEngine mGen;
     bool mFailed{false};
+    bool mReplaying{false};
+    double mMeasureTolerance{3.0};
+    uint64_t mCoverageExport{0};
+    uint64_t mIncrementalCheck{0};
+    uint64_t mOnlineCheck{0};
+    uint64_t mSchedule{0};
+    uint64_t mFailFast{0};
+    uint64_t mShardIndex{0};
+    uint64_t mShardCount{1};
+    bool mShardBalanced{false};
+    Transcript const* mExpected{nullptr};
+    bool mOnlineMismatch{false};
+    StatusPage* mStatus{nullptr};
+    uint64_t mHangNanos{0};
+    uint64_t mShrinkLimit{0};
+    uint64_t mShrinkFork{1};
+    bool mShrinking{false};
+    // Set while runPlanAndStabilize re-runs a plan to check its stability.
+    bool mStabilizing{false};
+
+    // How a shrink candidate's run ended. A candidate only replaces the plan
+    // being shrunk if it ends the same way, so a shrink cannot slip from an
+    // invariant failure to an unrelated crash or vice versa.
+    enum class RunOutcome
+    {
+        Passed,
+        Failed,
+        Crashed,
+    };
+
+    // The state of the shrink in progress: the outcome of every plan run so
+    // far (so that none runs twice), the outcome being preserved, and
+    // whether candidates run in a forked child.
+    std::map<PlanHash, RunOutcome> mShrinkOutcomes;
+    RunOutcome mShrinkTarget{RunOutcome::Failed};
+    uint64_t mShrinkExecutions{0};
+    uint64_t mShrinkMaxExecutions{0};
+    bool mShrinkIsolate{false};
+
+    // The choice sequence and depth limit the plan being run was generated
+    // from, if mChoicesValid.
+    std::vector<uint8_t> mChoices;
+    uint64_t mChoicesDepth{0};
+    bool mChoicesValid{false};
+    uint64_t mRecordChoices{0};
     uint64_t mVerboseLevel{0};
 
     // Trajectories are calculated from a combination of a path trajectory
@@ -38,29 +238,128 @@ class Test
     // trajectory is unstable, it's an error the user has to fix.
     std::vector<uint8_t> mPathTrajStabilityMask;
     std::vector<uint8_t> mPathTrajCounters;
-    XXHash64 mUserTrajHasher{0};
+    uint8_t* mSharedCounters{nullptr};
+    size_t mSharedCountersSize{0};
+    TrajectoryHasher mUserTrajHasher{0};
     Trajectory mPathTrajectory{0};
     Trajectory mUserTrajectory{0};
     Trajectory mTrajectory{0};
-    Transcript mTranscript;
 
-    using Trajectories = std::map<Trajectory, Transcript>;
+    // An Observation is a variable recorded by check(), track() or measure()
+    // during the current run. Scalars passed to the typed overloads of those
+    // are held unboxed in mType/mScalar/mText, and only boxed into a Value
+    // when a transcript is built from them; mType is Nil when mValue holds
+    // the observation instead.
+    struct Observation
+    {
+        VarName mName;
+        VarKind mKind{VarKind::Checked};
+        Value mValue;
+        Type mType{Type::Nil};
+        int64_t mScalar{0};
+        std::string mText;
+
+        Value box() const;
+        TranscriptVar toVar() const;
+        // Three-way comparison against a transcribed variable, ordered the
+        // same way as the TranscriptVar this observation would box to.
+        int compare(TranscriptVar const& var) const;
+    };
+
+    // The observations of the current run are accumulated in the first
+    // mNumObservations slots of mObservations while the plan being run is
+    // borrowed by pointer; a Transcript is only built from them when one
+    // needs recording. Slots are reused from run to run, which together with
+    // reusing the counter buffers above keeps steady-state runs free of heap
+    // allocation.
+    TestName mTestName;
+    Plan const* mPlan{nullptr};
+    std::vector<Observation> mObservations;
+    size_t mNumObservations{0};
+    std::vector<uint8_t> mSavedPathTrajCounters;
+
+    // The buffers TaskObservers have submitted during the current run, most
+    // recent first, waiting to be merged by `mergeTaskObservations`.
+    std::atomic<TaskObserver::Buffer*> mSubmittedTasks{nullptr};
+    void submitTask(std::unique_ptr<TaskObserver::Buffer> buffer);
+    std::vector<std::unique_ptr<TaskObserver::Buffer>> takeSubmittedTasks();
+    void mergeTaskObservations();
+
+    // Trajectories map to transcripts as stored in the corpus.
+    using Trajectories = std::map<Trajectory, Transcript const*>;
     using Failures = std::vector<PlanHash>;
 
+    // Trajectories found by `prepare` and extended by `expand`.
+    Trajectories mTrajectories;
+
+    // The edge signatures of the trajectories found so far, if near-duplicate
+    // runs are being kept out of the corpus (see `setNearDuplicateJaccard`).
+    double mNearDuplicateJaccard{0.0};
+    NearDuplicateIndex mNearDuplicates;
+    uint64_t mNearDuplicatesSkipped{0};
+
     void initPathTrajectory();
     void initUserTrajectory();
     void finiPathTrajectory();
     void finiUserTrajectory();
+    size_t pathCountersSize() const;
+    EdgeSignature edgeSignature() const;
 
-    Failures initializeCorpusFromKPaths(uint64_t kPathLength);
+    Failures initializeCorpusFromKPaths(Trajectories&, uint64_t kPathLength);
     Failures randomlyExpandCorpus(Trajectories&, uint64_t steps,
                                   uint64_t depth);
-    Failures checkCorpus(Trajectories&);
-    void checkTranscript(Transcript const&);
+    Failures checkCorpus(Trajectories&, bool incremental = false);
+
+    RunOutcome runShrinkCandidate(Plan const&, bool isolate);
+    bool beginShrink(Plan const&, uint64_t maxExecutions);
+    bool stillFails(Plan const&);
+    void endShrink(Plan const& from, Plan const& to);
+    Plan shrinkReductions(Plan best);
+    Plan shrinkChoiceBytes(Plan best, ParamSpecs const& specs,
+                           std::vector<uint8_t>& choices, uint64_t depth);
+    PlanHash shrinkFailure(Plan const&, Trajectories&);
+    Transcript const& checkTranscript(Transcript const&);
     void runPlan(Plan const&);
     void runPlanAndStabilize(Plan const&);
-    bool runPlanAndMaybeExpandCorpus(Plan const&, Trajectories&);
+    bool runPlanAndMaybeExpandCorpus(Plan const&, Trajectories&,
+                                     bool skipNearDuplicates = false);
     void reportFailures(Failures const&) const;
+    void noteStatusPhase(StatusPhase);
+    void noteStatusNovelty(size_t nTrajectories);
+    void noteStatusRejection();
+    void noteStatusFailure();
+    void reportReplayTimings(std::vector<ReplayTiming> const&) const;
+    std::vector<ReplayTiming>
+    summarizeReplay(std::vector<Transcript const*> const& selected,
+                    std::vector<std::vector<uint64_t>>& samples) const;
+    void recordCoverage(Plan const&);
+    void forgetCoverage(Plan const&);
+    void exportCoverageReport();
+    bool findChangedFunctions(std::set<std::string>& changed);
+    void saveFunctionFingerprints(bool fullCheck);
+    void scheduleTranscripts(std::vector<Transcript const*>& tss);
+    void noteScheduleResult(PlanHash hash, uint64_t nanos, bool failed);
+    void selectShard(std::vector<Transcript const*>& tss);
+    Transcript makeTranscript() const;
+    Observation& nextObservation(VarName vn, VarKind kind);
+    void observe(VarName vn, VarKind kind, Value seen);
+    void observe(VarName vn, VarKind kind, bool seen);
+    void observe(VarName vn, VarKind kind, int64_t seen);
+    void observe(VarName vn, VarKind kind, std::string_view seen);
+    void checkOnline();
+    bool observationMatches(size_t i, TranscriptVar const& var) const;
+    bool observationsMatch(TranscriptVars const& vars) const;
+    bool observationsLess(TranscriptVars const& vars) const;
+
+    Plan const&
+    currentPlan() const
+    {
+        if (!mPlan)
+        {
+            throw std::runtime_error("no plan is running");
+        }
+        return *mPlan;
+    }
 
   protected:
     void initTrajectory();
@@ -69,13 +368,23 @@ class Test
     Value
     getParam(ParamName p)
     {
-        return mTranscript.getPlan().getParam(p);
+        return currentPlan().getParam(p);
+    }
+
+    // The parameter decoded as a T, as by `decode<T>` (see decode.h): for
+    // example `getParam<std::tuple<Symbol, int64_t>>(N)` for a rule that
+    // expands to a number.
+    template <typename T>
+    T
+    getParam(ParamName p)
+    {
+        return decode<T>(currentPlan().getParam(p));
     }
 
     bool
     hasParam(ParamName p)
     {
-        return mTranscript.getPlan().hasParam(p);
+        return currentPlan().hasParam(p);
     }
 
     // Calling `invariant()` indicates a value you expect to be invariant across
@@ -94,6 +403,55 @@ class Test
     // Mnemonic: TRAced values contribute to TRAjectories.
     void trace(VarName, Value seen);
 
+    // Typed forms of `trace()` hash their argument directly rather than
+    // boxing it in a Value first, for use in hot code. Each traces the same
+    // trajectory as tracing the equivalent Value would: integers as Int64,
+    // strings as String, byte spans as Blob and other ranges as lists of
+    // their elements.
+    void trace(VarName, bool seen);
+    void trace(VarName, int64_t seen);
+    void trace(VarName, std::string_view seen);
+    void trace(VarName, uint8_t const* data, size_t len);
+
+    void
+    trace(VarName vn, char const* seen)
+    {
+        trace(vn, std::string_view(seen));
+    }
+
+    void
+    trace(VarName vn, std::string const& seen)
+    {
+        trace(vn, std::string_view(seen));
+    }
+
+    template <typename T,
+              std::enable_if_t<std::is_integral<T>::value &&
+                                   !std::is_same<T, bool>::value,
+                               int> = 0>
+    void
+    trace(VarName vn, T seen)
+    {
+        trace(vn, static_cast<int64_t>(seen));
+    }
+
+    template <typename R,
+              typename = decltype(std::begin(std::declval<R const&>())),
+              std::enable_if_t<!std::is_convertible<R const&, Value>::value &&
+                                   !std::is_convertible<
+                                       R const&, std::string_view>::value,
+                               int> = 0>
+    void
+    trace(VarName vn, R const& range)
+    {
+        if (mReplaying)
+        {
+            return;
+        }
+        addSymbolToHash(mUserTrajHasher, vn);
+        addStructureToHash(mUserTrajHasher, range);
+    }
+
     // Calling `check()` on a given value records the value to the transcript
     // and/or checks that the value is the same as the corresponding value
     // transcribed in a previous run, but does not `trace()` the value.
@@ -101,6 +459,34 @@ class Test
     // Mnemonic: checks can fail, and failures are reported.
     void check(VarName, Value seen);
 
+    // Typed forms of `check()` record their argument unboxed; it is only
+    // turned into a Value if the run's transcript is recorded or reported.
+    void check(VarName, bool seen);
+    void check(VarName, int64_t seen);
+    void check(VarName, std::string_view seen);
+
+    void
+    check(VarName vn, char const* seen)
+    {
+        check(vn, std::string_view(seen));
+    }
+
+    void
+    check(VarName vn, std::string const& seen)
+    {
+        check(vn, std::string_view(seen));
+    }
+
+    template <typename T,
+              std::enable_if_t<std::is_integral<T>::value &&
+                                   !std::is_same<T, bool>::value,
+                               int> = 0>
+    void
+    check(VarName vn, T seen)
+    {
+        check(vn, static_cast<int64_t>(seen));
+    }
+
     // Calling `track()` on a given value records it to the transcript for
     // checking _and_ traces it. It is equivalent to calling `trace` and `check`
     // except the word 'track' is put in the transcript instead of 'check',
@@ -109,12 +495,66 @@ class Test
     //
     // Mnemonic: TRACK = TRAce + cheCK
     void track(VarName, Value seen);
+    void track(VarName, bool seen);
+    void track(VarName, int64_t seen);
+    void track(VarName, std::string_view seen);
+
+    void
+    track(VarName vn, char const* seen)
+    {
+        track(vn, std::string_view(seen));
+    }
+
+    void
+    track(VarName vn, std::string const& seen)
+    {
+        track(vn, std::string_view(seen));
+    }
+
+    template <typename T,
+              std::enable_if_t<std::is_integral<T>::value &&
+                                   !std::is_same<T, bool>::value,
+                               int> = 0>
+    void
+    track(VarName vn, T seen)
+    {
+        track(vn, static_cast<int64_t>(seen));
+    }
+
+    // Calling `measure()` with a distribution of samples (timings, throughput,
+    // sizes, etc.) records a robust `(median mad)` summary of them to the
+    // transcript. Unlike `check()`, a measurement is compared against the
+    // stored summary with a statistical tolerance rather than for equality:
+    // see `setMeasureTolerance`. Measurements are not traced.
+    void measure(VarName, std::vector<int64_t> samples);
+
+    // Convenience form of `measure()` that calls `fn` `reps` times and
+    // measures the wall-clock duration of each call, in nanoseconds.
+    template <typename F>
+    void
+    measure(VarName vn, size_t reps, F&& fn)
+    {
+        std::vector<int64_t> samples;
+        samples.reserve(reps);
+        for (size_t i = 0; i < reps; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            auto end = std::chrono::steady_clock::now();
+            samples.emplace_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end -
+                                                                     start)
+                    .count());
+        }
+        measure(vn, std::move(samples));
+    }
 
   public:
     const std::vector<ParamSpecs> mSeedSpecs;
 
     Test(Grammar const& gram, Corpus& corp, TestName testName,
          std::vector<ParamSpecs> const& seedSpecs);
+    ~Test();
 
     // Seed the PRNG used in random decisions using the system random number
     // device. If not seeded with this function or seed_specific, it will be
@@ -123,7 +563,104 @@ class Test
 
     // Seed the PRNG used in random decisions using a specific value. If not
     // seeded with this function or seed_urandom, it will be seeded with zero.
-    void seedWithValue(uint64_t seed);
+    // A nonzero `stream` selects one of many non-overlapping streams of the
+    // same seed (by jumping the engine `stream` times), so that parallel
+    // workers can share a seed and still make independent, reproducible
+    // decisions. The environment variables `PHOTESTHESIS_RANDOM_SEED` and
+    // `PHOTESTHESIS_RANDOM_STREAM` set both when `administer` starts.
+    void seedWithValue(uint64_t seed, uint64_t stream = 0);
+
+    // Set how far a measured median may drift from its transcribed value
+    // before it counts as a mismatch, in multiples of the larger of the two
+    // MADs. Defaults to 3, and can also be set through the environment
+    // variable `PHOTESTHESIS_MEASURE_TOLERANCE`.
+    void setMeasureTolerance(double tolerance);
+
+    // Check only shard `index` (counting from 0) of `count` disjoint shards
+    // of the corpus, so that a large corpus can be split across CI jobs. By
+    // default transcripts are assigned to shards by plan hash; if `balanced`,
+    // they are instead assigned longest-processing-time-first using the
+    // runtimes recorded in the `schedule` sidecar (see `administer`), which
+    // every job must then share. Can also be set through the environment
+    // variable `PHOTESTHESIS_SHARD=index/count`, with
+    // `PHOTESTHESIS_SHARD_BALANCE` nonzero for balancing. Each job's corpus
+    // changes can be merged back with `Corpus::mergeChanges` or the
+    // `photesthesis-merge` tool.
+    //
+    // A shard only knows the trajectories of its own slice, so a sharded
+    // `administer` neither initializes an empty corpus nor expands one, and
+    // `prepare` and `expand` throw if asked to; do those unsharded.
+    void setShard(uint64_t index, uint64_t count, bool balanced = false);
+
+    // Include the coverage of processes that `run` starts (or that those
+    // start in turn) in trajectories, if they are instrumented and linked
+    // with `libphotesthesis-runtime.a`: see `getSharedCoverage`. Off by
+    // default except in RemoteTest; can also be set through the environment
+    // variable `PHOTESTHESIS_SUBPROCESS_COVERAGE`. Set this before running
+    // any plans.
+    void setSubprocessCoverage(bool enable);
+
+    // Keep a random run with a new trajectory out of the corpus if its edge
+    // set has an estimated Jaccard similarity of at least `jaccard` to that of a
+    // trajectory already found with the same user trajectory (see
+    // `NearDuplicateIndex`), so that the corpus does not fill with runs that
+    // differ by an incidental edge or two. Failing runs, and the k-path
+    // plans an empty corpus is initialized with, are always kept. 0
+    // (the default) disables this; can also be set through the environment
+    // variable `PHOTESTHESIS_NEAR_DUPLICATE_JACCARD`.
+    void setNearDuplicateJaccard(double jaccard);
+
+    // These break `administer` into steps, for driving several tests from a
+    // `Campaign`: `prepare` initializes or checks the corpus as `administer`
+    // would (but always collects trajectories), `expand` explores `steps`
+    // more random plans from them, and `finish` writes any coverage report.
+    // Each returns the hashes of any failing plans.
+    std::vector<PlanHash> prepare(uint64_t kPathLength = 3);
+    std::vector<PlanHash> expand(uint64_t steps, uint64_t randomDepth = 3);
+    void finish();
+    size_t getTrajectoryCount() const;
+
+    // Return a smaller plan that fails the same way as `plan` (by an
+    // invariant failure, or by crashing), or `plan` itself if none is found
+    // within `maxExecutions` runs. Candidates are grammar-valid reductions of
+    // the plan's parameters (see `Grammar::reductions`), tried level by level
+    // from the root of each parameter, first in chunks and then one node at a
+    // time, until no reduction still fails. No candidate is run twice. If
+    // `plan` crashes when run in a forked child, every candidate is run in a
+    // forked child too; `PHOTESTHESIS_SHRINK_FORK` set to 0 disables forking
+    // and 2 forces it.
+    //
+    // If `PHOTESTHESIS_SHRINK` is set to a nonzero number of runs, failures
+    // found while initializing or expanding a corpus are shrunk before being
+    // reported, and the shrunk plan is added to the corpus like any other.
+    Plan shrink(Plan const& plan, uint64_t maxExecutions = 1000);
+
+    // Plans can also be generated from a choice sequence (see
+    // `ChoiceSequence`): `planFromChoices` decodes one for `specs` and depth
+    // limit `depth`, which is much cheaper than reading a plan's Value text.
+    // Random plans generated while expanding a corpus have their choice
+    // sequence (and depth) stored in the "choices" sidecar if
+    // `PHOTESTHESIS_RECORD_CHOICES` is set; `getChoices` returns it.
+    Plan planFromChoices(ParamSpecs const& specs, uint8_t const* data,
+                         size_t size, uint64_t depth) const;
+    bool getChoices(Plan const& plan, std::vector<uint8_t>& choices,
+                    uint64_t& depth);
+
+    // Decode the choice sequence `data` into `plan` as `planFromChoices`
+    // does, and run it once, as a fuzzer input. Only if its trajectory is new
+    // or it fails is it stabilized and recorded, along with the choices it
+    // read, as `expand` records plans. Returns whether it failed, and sets
+    // `recorded` if the corpus changed. Throws RejectPlan if it is rejected.
+    bool runChoices(ParamSpecs const& specs, uint8_t const* data, size_t size,
+                    uint64_t depth, Plan& plan, bool& recorded);
+
+    // Shrink a failing choice sequence in place, by deleting, zeroing and
+    // lowering its bytes while the plan it decodes to still fails the same
+    // way, and return that plan. Failures found while expanding a corpus
+    // with `PHOTESTHESIS_SHRINK` set are shrunk this way before `shrink`.
+    Plan shrinkChoices(ParamSpecs const& specs, std::vector<uint8_t>& choices,
+                       uint64_t depth, uint64_t maxExecutions = 1000);
+    TestName const& getTestName() const;
 
     // Entrypoint for clients. Checks and/or grows a corpus.
     //
@@ -137,6 +674,40 @@ class Test
     // The corpus will be re-written if any checks fail or the corpus is
     // expanded.
     //
+    // If the environment variable `PHOTESTHESIS_INCREMENTAL_CHECK` is set to
+    // some nonzero N and `expansionSteps` is zero, only transcripts that
+    // covered a function whose machine code changed since the last passing
+    // check are re-run (see `getFunctionFingerprints`), with a full check
+    // forced after every N incremental ones. This needs the SUT to be
+    // compiled with `-fsanitize-coverage=inline-8bit-counters,pc-table`;
+    // without it every check is a full check.
+    //
+    // If the environment variable `PHOTESTHESIS_STATUS` names a shared-memory
+    // segment, progress is published there for `photesthesis-stat` to
+    // display (see `StatusPage`). Runs longer than `PHOTESTHESIS_HANG_MS`
+    // milliseconds, if set, are counted as hangs.
+    //
+    // If the environment variable `PHOTESTHESIS_COVERAGE_EXPORT` is nonzero,
+    // the bucketed path-coverage edges of every transcript run are recorded in
+    // the corpus' `coverage` sidecar, and an aggregate per-file and
+    // per-function report is written next to the corpus with the suffix
+    // `.coverage-report`.
+    //
+    // If the environment variable `PHOTESTHESIS_ONLINE_CHECK` is nonzero, each
+    // `check()` and `track()` made while checking a transcript is compared
+    // immediately against the transcript's corresponding variable, and the
+    // first divergence is reported through `handleOnlineMismatch`. With 1 the
+    // run is then aborted by throwing `TranscriptMismatch` and the transcript
+    // counts as failed; with 2 the run finishes and its new transcript is
+    // recorded as usual.
+    //
+    // If the environment variable `PHOTESTHESIS_SCHEDULE` is nonzero, the
+    // running time and last failure of each checked transcript are recorded
+    // in the corpus' `schedule` sidecar, and transcripts are checked
+    // recently-failing first and then longest first. If
+    // `PHOTESTHESIS_FAIL_FAST` is set to some nonzero N, checking stops after
+    // N failures.
+    //
     // `administer` returns a vector of PlanHashes that identify any transcripts
     // that failed.
     //
@@ -147,6 +718,27 @@ class Test
                                      uint64_t kPathLength = 3,
                                      uint64_t randomDepth = 3);
 
+    // Benchmark entrypoint. Runs each transcript in the corpus (or only the
+    // one selected by `PHOTESTHESIS_TEST_HASH`) `iterations` times with
+    // coverage, tracing and checking disabled, and reports min/median/p99
+    // latency for each. The corpus is never modified.
+    //
+    // The whole corpus is replayed `loops` times, with samples accumulating
+    // across loops; a `loops` value of 0 replays until every transcript has
+    // been rejected, reporting and discarding the samples after each loop,
+    // which is useful under `perf record` or as a throughput benchmark.
+    //
+    // `administer` calls this instead of checking the corpus if the
+    // environment variable `PHOTESTHESIS_REPLAY_ITERATIONS` is nonzero, taking
+    // the loop count from `PHOTESTHESIS_REPLAY_LOOPS`.
+    std::vector<ReplayTiming> replay(uint64_t iterations = 1,
+                                     uint64_t loops = 1);
+
+    // Run a single plan once, outside of any corpus bookkeeping, and return
+    // its trajectory. Once warmed up, this performs no heap allocation in
+    // photesthesis itself.
+    Trajectory runOnce(Plan const& plan);
+
     // You must override `run` in your own subclasses -- this runs your test!
     virtual void run() = 0;
 
@@ -155,7 +747,13 @@ class Test
     // if run with PHOTESTHESIS_VERBOSE, otherwise they do nothing.
     virtual void handleTranscriptMismatch(Transcript const& expected,
                                           Transcript const& got);
+    // Called during online checking with the position of the first
+    // observation that diverges from the expected transcript, before the run
+    // is aborted (or allowed to finish).
+    virtual void handleOnlineMismatch(Transcript const& expected, size_t index,
+                                      TranscriptVar const& got);
     virtual void handleInvariantFailure(Plan const& plan, VarName varname,
                                         Value expected, Value got);
 };
+
 } // namespace photesthesis
@@ -6,38 +6,185 @@
 
 #include <map>
 #include <photesthesis/3rdparty/xxhash64.h>
+#include <photesthesis/fasthash.h>
+#include <photesthesis/random.h>
 #include <photesthesis/symbol.h>
 #include <photesthesis/value.h>
-#include <random>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace photesthesis
 {
 
+template <typename H>
 inline void
-addStringToHash(XXHash64& h, std::string const& s)
+addStringToHash(H& h, std::string const& s)
 {
     h.add(s.c_str(), s.size());
 }
 
+template <typename H>
 inline void
-addValueToHash(XXHash64& h, Value v)
+addValueToHash(H& h, Value v)
 {
     std::ostringstream oss;
     oss << v;
     addStringToHash(h, oss.str());
 }
 
+template <typename H>
 inline void
-addSymbolToHash(XXHash64& h, Symbol s)
+addSymbolToHash(H& h, Symbol s)
 {
     addStringToHash(h, s.getString());
 }
 
+// The addStructureToHash overloads hash a Value (or a C++ value that has an
+// obvious Value equivalent) by walking its structure rather than hashing its
+// printed form, so they perform no allocation. Each typed overload hashes
+// identically to the Value it corresponds to: integers as Int64, strings as
+// String, byte vectors as Blob and other ranges as lists. These do not produce
+// the same hash as addValueToHash: use that for anything that is persisted.
+//
+// All of these work with any hasher offering `add(data, len)`, such as
+// XXHash64 or FastHash.
+template <typename H>
 inline void
-addKeyValueToHash(XXHash64& h, Symbol k, Value v)
+addTypeToHash(H& h, Type ty)
+{
+    uint8_t t = static_cast<uint8_t>(ty);
+    h.add(&t, 1);
+}
+
+template <typename H>
+inline void
+addBytesStructureToHash(H& h, Type ty, void const* data, size_t len)
+{
+    addTypeToHash(h, ty);
+    uint64_t len64 = len;
+    h.add(&len64, sizeof(len64));
+    h.add(data, len);
+}
+
+template <typename H>
+inline void
+addStructureToHash(H& h, bool b)
+{
+    uint8_t bytes[2] = {static_cast<uint8_t>(Type::Bool),
+                        static_cast<uint8_t>(b ? 1 : 0)};
+    h.add(bytes, sizeof(bytes));
+}
+
+template <typename H>
+inline void
+addStructureToHash(H& h, int64_t i)
+{
+    addTypeToHash(h, Type::Int64);
+    h.add(&i, sizeof(i));
+}
+
+template <typename H>
+inline void
+addStructureToHash(H& h, std::string_view s)
+{
+    addBytesStructureToHash(h, Type::String, s.data(), s.size());
+}
+
+template <typename H>
+inline void
+addStructureToHash(H& h, char const* s)
+{
+    addStructureToHash(h, std::string_view(s));
+}
+
+template <typename H>
+inline void
+addStructureToHash(H& h, std::string const& s)
+{
+    addStructureToHash(h, std::string_view(s));
+}
+
+template <typename H>
+inline void
+addStructureToHash(H& h, std::vector<uint8_t> const& blob)
+{
+    addBytesStructureToHash(h, Type::Blob, blob.data(), blob.size());
+}
+
+template <typename H>
+inline void
+addStructureToHash(H& h, Value const& v)
+{
+    ValueImpl const* vi = v.getImpl();
+    while (vi)
+    {
+        if (auto pv = dynamic_cast<PairValue const*>(vi))
+        {
+            addTypeToHash(h, Type::Pair);
+            addStructureToHash(h, pv->getValue().first);
+            vi = pv->getValue().second.get();
+            continue;
+        }
+        else if (auto sv = dynamic_cast<SymValue const*>(vi))
+        {
+            std::string const& str = sv->getValue().getString();
+            addBytesStructureToHash(h, Type::Sym, str.data(), str.size());
+        }
+        else if (auto bv = dynamic_cast<BoolValue const*>(vi))
+        {
+            addStructureToHash(h, bv->getValue());
+        }
+        else if (auto iv = dynamic_cast<Int64Value const*>(vi))
+        {
+            addStructureToHash(h, iv->getValue());
+        }
+        else if (auto blv = dynamic_cast<BlobValue const*>(vi))
+        {
+            addStructureToHash(h, blv->getValue());
+        }
+        else if (auto stv = dynamic_cast<StringValue const*>(vi))
+        {
+            addStructureToHash(h, std::string_view(stv->getValue()));
+        }
+        return;
+    }
+    // Nil, including the end of a list.
+    addTypeToHash(h, Type::Nil);
+}
+
+template <typename H, typename T,
+          std::enable_if_t<std::is_integral<T>::value &&
+                               !std::is_same<T, bool>::value,
+                           int> = 0>
+inline void
+addStructureToHash(H& h, T i)
+{
+    addStructureToHash(h, static_cast<int64_t>(i));
+}
+
+template <typename H, typename R,
+          typename = decltype(std::begin(std::declval<R const&>())),
+          std::enable_if_t<!std::is_convertible<R const&, Value>::value &&
+                               !std::is_convertible<R const&,
+                                                    std::string_view>::value,
+                           int> = 0>
+inline void
+addStructureToHash(H& h, R const& range)
+{
+    for (auto const& elt : range)
+    {
+        addTypeToHash(h, Type::Pair);
+        addStructureToHash(h, elt);
+    }
+    addTypeToHash(h, Type::Nil);
+}
+
+template <typename H>
+inline void
+addKeyValueToHash(H& h, Symbol k, Value v)
 {
     addSymbolToHash(h, k);
     addStringToHash(h, "=");
@@ -68,29 +215,50 @@ headSymbol(std::shared_ptr<const PairValue> pv)
     throw std::runtime_error("expected head symbol in list");
 }
 
+// Return the elements of a list Value (treating Nil as the empty list), or
+// throw if it is not a list.
+inline std::vector<Value>
+listElements(Value v)
+{
+    std::vector<Value> elts;
+    if (v.isNil())
+    {
+        return elts;
+    }
+    std::pair<Value, std::shared_ptr<const PairValue>> pair;
+    if (!v.match(pair))
+    {
+        throw std::runtime_error("expected list");
+    }
+    elts.emplace_back(pair.first);
+    for (auto p = pair.second; p; p = p->getValue().second)
+    {
+        elts.emplace_back(p->getValue().first);
+    }
+    return elts;
+}
+
 template <typename T>
 T const&
-pickUniform(std::default_random_engine& gen, std::vector<T> const& elts)
+pickUniform(RandomEngine& gen, std::vector<T> const& elts)
 {
     if (elts.empty())
     {
         throw std::runtime_error("pick_uniform on empty vector");
     }
-    std::uniform_int_distribution<size_t> dist(0, elts.size() - 1);
-    return elts.at(dist(gen));
+    return elts.at(gen.below(elts.size()));
 }
 
 template <typename K, typename V>
 std::pair<const K, V> const&
-pickUniform(std::default_random_engine& gen, std::map<K, V> const& elts)
+pickUniform(RandomEngine& gen, std::map<K, V> const& elts)
 {
     if (elts.empty())
     {
         throw std::runtime_error("pick_uniform on empty map");
     }
-    std::uniform_int_distribution<size_t> dist(0, elts.size() - 1);
     auto i = elts.cbegin();
-    std::advance(i, dist(gen));
+    std::advance(i, gen.below(elts.size()));
     return *i;
 }
 
@@ -177,4 +345,19 @@ vecMapAdd(std::vector<std::pair<K, V>>& map, K const& k, V const& v)
     map.emplace_back(k, v);
 }
 
+// The median of the nonempty, sorted `xs`: for an even count, the midpoint
+// of the middle two, computed without overflowing.
+template <typename T>
+T
+sortedMedian(std::vector<T> const& xs)
+{
+    size_t mid = xs.size() / 2;
+    if (xs.size() % 2 == 1)
+    {
+        return xs.at(mid);
+    }
+    T lo = xs.at(mid - 1);
+    return lo + (xs.at(mid) - lo) / 2;
+}
+
 } // namespace photesthesis
\ No newline at end of file
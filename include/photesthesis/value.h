@@ -161,6 +161,13 @@ class Value
     template <typename T, typename... Args>
     bool match(T const& head, Args const&... tail) const;
 
+    // Borrow the wrapped ValueImpl, for walking a Value without copying it.
+    ValueImpl const*
+    getImpl() const
+    {
+        return mImpl.get();
+    }
+
     friend std::ostream& operator<<(std::ostream& os, const Value& val);
     friend std::istream& operator>>(std::istream& is, Value& val);
 
@@ -182,6 +189,15 @@ struct Matcher : public MatcherBase, public std::optional<T>
 std::ostream& operator<<(std::ostream& os, const Value& val);
 std::istream& operator>>(std::istream& is, Value& val);
 
+// A compact binary encoding of Values, for passing them between processes
+// rather than storing them: each value is a Type byte followed, for
+// scalars, by its payload (varint lengths, zigzag-varint integers) and, for
+// lists, by a varint element count and the elements. `decodeValue` advances
+// `p` past the value it decodes and throws std::runtime_error if the bytes
+// before `end` are not a well-formed encoding.
+void encodeValue(Value const& val, std::vector<uint8_t>& out);
+void decodeValue(uint8_t const*& p, uint8_t const* end, Value& val);
+
 template <typename T> class TypedValue : public ValueImpl
 {
 
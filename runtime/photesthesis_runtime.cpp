@@ -0,0 +1,406 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+// The runtime linked into out-of-process SUTs driven by a RemoteTest, and
+// into instrumented programs a test starts, whose coverage it adds into the
+// test's shared coverage map. It is kept apart from src/ because it registers
+// the program's own coverage counters, which the harness library does for
+// the harness process.
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <photesthesis/coverage.h>
+#include <photesthesis/runtime.h>
+#include <pthread.h>
+#include <photesthesis/util.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+using photesthesis::RemoteSegment;
+using photesthesis::SharedCoverage;
+
+struct CounterRegion
+{
+    uint8_t* mStart;
+    size_t mLen;
+};
+
+constexpr size_t MaxCounterRegions = 64;
+CounterRegion gRegions[MaxCounterRegions];
+size_t gNumRegions{0};
+SharedCoverage* gShared{nullptr};
+bool gMerged{false};
+
+constexpr int FatalSignals[] = {SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL};
+struct sigaction gOldActions[sizeof(FatalSignals) / sizeof(int)];
+
+void
+zeroCounters()
+{
+    for (size_t r = 0; r < gNumRegions; ++r)
+    {
+        std::memset(gRegions[r].mStart, 0, gRegions[r].mLen);
+    }
+    gMerged = false;
+}
+
+// Add this process's counters into the shared map, saturating, folding
+// counter indices modulo its size. Only the first call since the counters
+// were last zeroed has any effect, and it only touches memory, so it is safe
+// from a signal handler.
+void
+mergeCounters()
+{
+    if (!gShared || gMerged)
+    {
+        return;
+    }
+    gMerged = true;
+    uint8_t* map = gShared->mCounters;
+    size_t idx = 0;
+    for (size_t r = 0; r < gNumRegions; ++r)
+    {
+        for (size_t i = 0; i < gRegions[r].mLen; ++i, ++idx)
+        {
+            uint8_t c = gRegions[r].mStart[i];
+            if (c != 0)
+            {
+                uint8_t& m = map[idx % SharedCoverage::Size];
+                m = (m > 255 - c) ? 255 : m + c;
+            }
+        }
+    }
+}
+
+void
+mergeCountersAtExit()
+{
+    mergeCounters();
+}
+
+// Merge, then hand the signal on to whatever handled it before (such as a
+// sanitizer's crash reporter, or the default action).
+void
+mergeCountersOnSignal(int sig)
+{
+    mergeCounters();
+    for (size_t i = 0; i < sizeof(FatalSignals) / sizeof(int); ++i)
+    {
+        if (FatalSignals[i] == sig)
+        {
+            sigaction(sig, &gOldActions[i], nullptr);
+        }
+    }
+    raise(sig);
+}
+
+SharedCoverage*
+openSharedCoverage(char const* name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        std::cerr << "photesthesis: unable to open coverage segment " << name
+                  << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    void* mem = mmap(nullptr, sizeof(SharedCoverage), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        std::cerr << "photesthesis: unable to map coverage segment " << name
+                  << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    auto shared = static_cast<SharedCoverage*>(mem);
+    if (shared->mMagic != SharedCoverage::Magic ||
+        shared->mVersion != SharedCoverage::Version)
+    {
+        std::cerr << "photesthesis: coverage segment " << name
+                  << " has the wrong magic number or version" << std::endl;
+        munmap(mem, sizeof(SharedCoverage));
+        return nullptr;
+    }
+    return shared;
+}
+
+// Attach to the shared coverage map named in the environment, if any, as the
+// program starts. The instrumentation registers its counters before any
+// static constructors run.
+struct SharedCoverageAttachment
+{
+    SharedCoverageAttachment()
+    {
+        char const* name = std::getenv("PHOTESTHESIS_COVERAGE_SHM");
+        if (!name || !*name || !(gShared = openSharedCoverage(name)))
+        {
+            return;
+        }
+        std::atexit(mergeCountersAtExit);
+        pthread_atfork(nullptr, nullptr, zeroCounters);
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = mergeCountersOnSignal;
+        sa.sa_flags = SA_NODEFER;
+        for (size_t i = 0; i < sizeof(FatalSignals) / sizeof(int); ++i)
+        {
+            sigaction(FatalSignals[i], &sa, &gOldActions[i]);
+        }
+    }
+} gSharedCoverageAttachment;
+
+bool
+readFull(int fd, void* buf, size_t len)
+{
+    auto p = static_cast<uint8_t*>(buf);
+    while (len != 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool
+writeFull(int fd, void const* buf, size_t len)
+{
+    auto p = static_cast<uint8_t const*>(buf);
+    while (len != 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+RemoteSegment*
+openSegment(char const* name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        std::cerr << "photesthesis: unable to open remote segment " << name
+                  << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    void* mem = mmap(nullptr, sizeof(RemoteSegment), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        std::cerr << "photesthesis: unable to map remote segment " << name
+                  << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    auto seg = static_cast<RemoteSegment*>(mem);
+    if (seg->mMagic != RemoteSegment::Magic ||
+        seg->mVersion != RemoteSegment::Version)
+    {
+        std::cerr << "photesthesis: remote segment " << name
+                  << " has the wrong magic number or version" << std::endl;
+        munmap(mem, sizeof(RemoteSegment));
+        return nullptr;
+    }
+    return seg;
+}
+
+[[noreturn]] void
+runChild(RemoteSegment& seg,
+         std::function<void(photesthesis::RemoteRun&)> const& fn)
+{
+    close(photesthesis::RemoteControlFd);
+    close(photesthesis::RemoteStatusFd);
+    photesthesis::RemoteRun run(seg);
+    fn(run);
+    mergeCounters();
+    _exit(0);
+}
+} // namespace
+
+extern "C" void
+__sanitizer_cov_8bit_counters_init(uint8_t* start, uint8_t* stop)
+{
+    if (gNumRegions < MaxCounterRegions && start < stop)
+    {
+        gRegions[gNumRegions++] = {start, static_cast<size_t>(stop - start)};
+    }
+}
+
+namespace photesthesis
+{
+
+RemoteRun::RemoteRun(RemoteSegment& segment) : mSegment(segment)
+{
+    uint8_t const* p = segment.mPlan;
+    uint8_t const* end = p + std::min<uint64_t>(segment.mPlanLen,
+                                                RemoteSegment::PlanSize);
+    Value plan;
+    decodeValue(p, end, plan);
+    for (auto const& elt : listElements(plan))
+    {
+        Symbol param;
+        Value val;
+        if (!elt.match(param, val))
+        {
+            throw std::runtime_error("malformed remote plan parameter");
+        }
+        mParams.emplace(param, val);
+    }
+}
+
+Value
+RemoteRun::getParam(Symbol param) const
+{
+    auto i = mParams.find(param);
+    if (i == mParams.end())
+    {
+        throw std::runtime_error("remote plan has no parameter " +
+                                 param.getString());
+    }
+    return i->second;
+}
+
+bool
+RemoteRun::hasParam(Symbol param) const
+{
+    return mParams.find(param) != mParams.end();
+}
+
+void
+RemoteRun::beginRecord(RemoteRecord kind, Symbol var)
+{
+    mRecord.clear();
+    mRecord.push_back(static_cast<uint8_t>(kind));
+    encodeValue(Value(var), mRecord);
+}
+
+void
+RemoteRun::endRecord()
+{
+    uint64_t len = mSegment.mObservationsLen;
+    if (mRecord.size() > RemoteSegment::ObservationsSize - len)
+    {
+        mSegment.mOverflow = 1;
+        return;
+    }
+    std::memcpy(mSegment.mObservations + len, mRecord.data(), mRecord.size());
+    mSegment.mObservationsLen = len + mRecord.size();
+}
+
+void
+RemoteRun::check(Symbol var, Value seen)
+{
+    beginRecord(RemoteRecord::Check, var);
+    encodeValue(seen, mRecord);
+    endRecord();
+}
+
+void
+RemoteRun::track(Symbol var, Value seen)
+{
+    beginRecord(RemoteRecord::Track, var);
+    encodeValue(seen, mRecord);
+    endRecord();
+}
+
+void
+RemoteRun::trace(Symbol var, Value seen)
+{
+    beginRecord(RemoteRecord::Trace, var);
+    encodeValue(seen, mRecord);
+    endRecord();
+}
+
+void
+RemoteRun::invariant(Symbol var, Value expected, Value got)
+{
+    beginRecord(RemoteRecord::Invariant, var);
+    encodeValue(expected, mRecord);
+    encodeValue(got, mRecord);
+    endRecord();
+}
+
+void
+RemoteRun::reject()
+{
+    mRecord.assign(1, static_cast<uint8_t>(RemoteRecord::Reject));
+    endRecord();
+    mergeCounters();
+    _exit(0);
+}
+
+int
+serveRemote(std::function<void(RemoteRun&)> const& fn)
+{
+    char const* name = std::getenv("PHOTESTHESIS_REMOTE");
+    if (!name || !*name)
+    {
+        std::cerr << "photesthesis: PHOTESTHESIS_REMOTE is not set; this "
+                     "program should be run by a RemoteTest"
+                  << std::endl;
+        return 1;
+    }
+    RemoteSegment* seg = openSegment(name);
+    if (!seg || !writeFull(RemoteStatusFd, &RemoteHello, 4))
+    {
+        return 1;
+    }
+    while (true)
+    {
+        uint32_t msg = 0;
+        if (!readFull(RemoteControlFd, &msg, 4))
+        {
+            return 0;
+        }
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            std::cerr << "photesthesis: remote fork failed: "
+                      << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        if (pid == 0)
+        {
+            runChild(*seg, fn);
+        }
+        int32_t pid32 = pid;
+        int status = 0;
+        if (!writeFull(RemoteStatusFd, &pid32, 4) ||
+            waitpid(pid, &status, 0) < 0 ||
+            !writeFull(RemoteStatusFd, &status, 4))
+        {
+            return 1;
+        }
+    }
+}
+
+} // namespace photesthesis
@@ -0,0 +1,239 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <photesthesis/campaign.h>
+#include <photesthesis/env.h>
+#include <stdexcept>
+
+namespace photesthesis
+{
+
+Campaign::Campaign()
+{
+    getEnvNum("PHOTESTHESIS_VERBOSE", mVerboseLevel);
+    getEnvNum("PHOTESTHESIS_CAMPAIGN_BATCH", mBatchSteps);
+    uint64_t index = 0, count = 0;
+    if (getEnvIndexOfCount("PHOTESTHESIS_CAMPAIGN_WORKER", index, count))
+    {
+        setWorker(index, count);
+    }
+}
+
+void
+Campaign::add(Test& test)
+{
+    mArms.emplace_back(Arm{&test});
+}
+
+void
+Campaign::setBatchSteps(uint64_t steps)
+{
+    mBatchSteps = steps;
+}
+
+void
+Campaign::setKPathLength(uint64_t k)
+{
+    mKPathLength = k;
+}
+
+void
+Campaign::setRandomDepth(uint64_t depth)
+{
+    mRandomDepth = depth;
+}
+
+void
+Campaign::setDiscount(double discount)
+{
+    if (!(discount > 0.0 && discount <= 1.0))
+    {
+        throw std::runtime_error("campaign discount must be in (0, 1]");
+    }
+    mDiscount = discount;
+}
+
+void
+Campaign::setExploration(double exploration)
+{
+    mExploration = exploration;
+}
+
+void
+Campaign::setWorker(uint64_t index, uint64_t count)
+{
+    if (count == 0 || index >= count)
+    {
+        throw std::runtime_error("bad campaign worker index or count");
+    }
+    mWorkerIndex = index;
+    mWorkerCount = count;
+}
+
+size_t
+Campaign::pickArm() const
+{
+    // Discounted UCB: each arm's score is its discounted mean novelty rate,
+    // scaled so the best arm's mean is 1, plus an exploration bonus that
+    // grows as the arm's discounted pull count shrinks. Arms never pulled
+    // are tried first, in registration order.
+    double totalPulls = 0.0;
+    double bestMean = 0.0;
+    for (size_t i = 0; i < mArms.size(); ++i)
+    {
+        Arm const& arm = mArms[i];
+        if (arm.mRetired)
+        {
+            continue;
+        }
+        if (arm.mPulls == 0)
+        {
+            return i;
+        }
+        totalPulls += arm.mDiscountedPulls;
+        bestMean = std::max(bestMean,
+                            arm.mDiscountedReward / arm.mDiscountedPulls);
+    }
+    size_t best = mArms.size();
+    double bestScore = 0.0;
+    double logTotal = std::log(std::max(totalPulls, 1.0));
+    for (size_t i = 0; i < mArms.size(); ++i)
+    {
+        Arm const& arm = mArms[i];
+        if (arm.mRetired)
+        {
+            continue;
+        }
+        double mean = arm.mDiscountedReward / arm.mDiscountedPulls;
+        if (bestMean > 0.0)
+        {
+            mean /= bestMean;
+        }
+        double score = mean + mExploration * std::sqrt(2.0 * logTotal /
+                                                       arm.mDiscountedPulls);
+        if (best == mArms.size() || score > bestScore)
+        {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+std::map<TestName, std::vector<PlanHash>>
+Campaign::run(uint64_t seconds, uint64_t executions)
+{
+    getEnvNum("PHOTESTHESIS_CAMPAIGN_SECONDS", seconds);
+    getEnvNum("PHOTESTHESIS_CAMPAIGN_EXECUTIONS", executions);
+    if (seconds == 0 && executions == 0)
+    {
+        throw std::runtime_error("campaign needs a time or execution budget");
+    }
+    if (mBatchSteps == 0)
+    {
+        throw std::runtime_error("campaign batch size must be nonzero");
+    }
+
+    // With a seed in the environment, each test gets its own stream of it,
+    // chosen by registration index, so that its decisions don't depend on
+    // how the tests are divided between workers.
+    uint64_t seed = 0;
+    bool seeded = getEnvNum("PHOTESTHESIS_RANDOM_SEED", seed);
+
+    std::map<TestName, std::vector<PlanHash>> failures;
+    auto noteFailures = [&](Arm& arm, std::vector<PlanHash> const& fs) {
+        if (!fs.empty())
+        {
+            auto& out = failures[arm.mTest->getTestName()];
+            out.insert(out.end(), fs.begin(), fs.end());
+            arm.mRetired = true;
+        }
+    };
+
+    for (size_t i = 0; i < mArms.size(); ++i)
+    {
+        Arm& arm = mArms[i];
+        arm.mRetired = (i % mWorkerCount) != mWorkerIndex;
+        if (!arm.mRetired)
+        {
+            if (seeded)
+            {
+                arm.mTest->seedWithValue(seed, i);
+            }
+            noteFailures(arm, arm.mTest->prepare(mKPathLength));
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(seconds);
+    uint64_t used = 0;
+    while (true)
+    {
+        if (seconds != 0 && std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+        uint64_t batch = mBatchSteps;
+        if (executions != 0)
+        {
+            if (used >= executions)
+            {
+                break;
+            }
+            batch = std::min(batch, executions - used);
+        }
+        size_t i = pickArm();
+        if (i == mArms.size())
+        {
+            break;
+        }
+        Arm& arm = mArms[i];
+        size_t before = arm.mTest->getTrajectoryCount();
+        noteFailures(arm, arm.mTest->expand(batch, mRandomDepth));
+        size_t novel = arm.mTest->getTrajectoryCount() - before;
+        used += batch;
+
+        for (Arm& other : mArms)
+        {
+            other.mDiscountedPulls *= mDiscount;
+            other.mDiscountedReward *= mDiscount;
+        }
+        arm.mDiscountedPulls += 1.0;
+        arm.mDiscountedReward += static_cast<double>(novel) / batch;
+        arm.mPulls += 1;
+        arm.mSteps += batch;
+        arm.mNovel += novel;
+        if (mVerboseLevel > 1)
+        {
+            std::cout << "campaign: " << arm.mTest->getTestName().getString()
+                      << " found " << novel << " new trajectories in "
+                      << batch << " steps" << std::endl;
+        }
+    }
+
+    for (size_t i = 0; i < mArms.size(); ++i)
+    {
+        Arm& arm = mArms[i];
+        if ((i % mWorkerCount) != mWorkerIndex)
+        {
+            continue;
+        }
+        arm.mTest->finish();
+        if (mVerboseLevel > 0)
+        {
+            std::cout << "campaign: " << arm.mTest->getTestName().getString()
+                      << " ran " << arm.mSteps << " steps in " << arm.mPulls
+                      << " batches, found " << arm.mNovel
+                      << " new trajectories" << std::endl;
+        }
+    }
+    return failures;
+}
+
+} // namespace photesthesis
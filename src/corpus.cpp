@@ -2,12 +2,15 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include <algorithm>
 #include <climits>
+#include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <photesthesis/3rdparty/xxhash64.h>
 #include <photesthesis/corpus.h>
+#include <photesthesis/sidecar.h>
 #include <photesthesis/util.h>
 #include <stdexcept>
 #include <string>
@@ -77,6 +80,12 @@ Plan::getParam(ParamName p) const
     return vecMapGet(mParams, p);
 }
 
+Params const&
+Plan::getParams() const
+{
+    return mParams;
+}
+
 bool
 Plan::hasParam(ParamName p) const
 {
@@ -178,6 +187,50 @@ Transcript::operator==(Transcript const& other) const
     return std::tie(mPlan, mVars) == std::tie(other.mPlan, other.mVars);
 }
 
+bool
+Transcript::matches(Transcript const& other, double tolerance) const
+{
+    return mPlan == other.mPlan && varsMatch(mVars, other.mVars, tolerance);
+}
+
+bool
+Transcript::varMatches(TranscriptVar const& a, TranscriptVar const& b,
+                       double tolerance)
+{
+    if (std::get<2>(a) == VarKind::Measured &&
+        std::get<2>(b) == VarKind::Measured && std::get<0>(a) == std::get<0>(b))
+    {
+        int64_t aMedian, aMad, bMedian, bMad;
+        if (std::get<1>(a).match(aMedian, aMad) &&
+            std::get<1>(b).match(bMedian, bMad))
+        {
+            double diff = std::abs(static_cast<double>(aMedian) -
+                                   static_cast<double>(bMedian));
+            double spread = static_cast<double>(std::max(aMad, bMad));
+            return diff <= tolerance * spread;
+        }
+    }
+    return a == b;
+}
+
+bool
+Transcript::varsMatch(TranscriptVars const& as, TranscriptVars const& bs,
+                      double tolerance)
+{
+    if (as.size() != bs.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < as.size(); ++i)
+    {
+        if (!varMatches(as[i], bs[i], tolerance))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 std::ostream&
 operator<<(std::ostream& os, const Plan& plan)
 {
@@ -244,6 +297,11 @@ Transcript::Transcript(Plan const& plan) : mPlan(plan)
 {
 }
 
+Transcript::Transcript(Plan const& plan, TranscriptVars vars)
+    : mPlan(plan), mVars(std::move(vars))
+{
+}
+
 TestName
 Transcript::getTestName() const
 {
@@ -259,16 +317,24 @@ Transcript::getPlan() const
 void
 Transcript::addTrackedVar(VarName var, Value val)
 {
-    mVars.emplace_back(var, val, true);
+    mVars.emplace_back(var, val, VarKind::Tracked);
 }
 
 void
 Transcript::addCheckedVar(VarName var, Value val)
 {
-    mVars.emplace_back(var, val, false);
+    mVars.emplace_back(var, val, VarKind::Checked);
 }
 
-std::vector<std::tuple<VarName, Value, bool>> const&
+void
+Transcript::addMeasuredVar(VarName var, int64_t median, int64_t mad)
+{
+    mVars.emplace_back(
+        var, Value(std::vector<Value>{Value::Int64(median), Value::Int64(mad)}),
+        VarKind::Measured);
+}
+
+TranscriptVars const&
 Transcript::getVars() const
 {
     return mVars;
@@ -295,16 +361,19 @@ operator<<(std::ostream& os, const Transcript& transcript)
     os << transcript.mPlan;
     for (auto const& triple : transcript.mVars)
     {
-        if (std::get<2>(triple))
-        {
-            os << "track: " << std::get<0>(triple) << " = "
-               << std::get<1>(triple) << std::endl;
-        }
-        else
+        switch (std::get<2>(triple))
         {
-            os << "check: " << std::get<0>(triple) << " = "
-               << std::get<1>(triple) << std::endl;
+        case VarKind::Checked:
+            os << "check: ";
+            break;
+        case VarKind::Tracked:
+            os << "track: ";
+            break;
+        case VarKind::Measured:
+            os << "measure: ";
+            break;
         }
+        os << std::get<0>(triple) << " = " << std::get<1>(triple) << std::endl;
     }
     os << std::endl;
     return os;
@@ -342,7 +411,8 @@ operator>>(std::istream& is, Transcript& transcript)
     transcript = Transcript(plan);
 
     scanWhitespace(is);
-    while (is.good() && (is.peek() == 'c' || is.peek() == 't'))
+    while (is.good() &&
+           (is.peek() == 'c' || is.peek() == 't' || is.peek() == 'm'))
     {
         std::string KW, EQ;
         VarName vname("");
@@ -350,14 +420,35 @@ operator>>(std::istream& is, Transcript& transcript)
         is >> KW >> vname >> EQ >> val;
         expectStr(is, "=", EQ);
         expectNonemptyStr(is, vname.getString());
-        if (KW != "check:" && KW != "track:")
+        VarKind kind;
+        if (KW == "check:")
+        {
+            kind = VarKind::Checked;
+        }
+        else if (KW == "track:")
+        {
+            kind = VarKind::Tracked;
+        }
+        else if (KW == "measure:")
+        {
+            int64_t median, mad;
+            if (!val.match(median, mad))
+            {
+                throw std::runtime_error(
+                    std::string("expecting '(median mad)' measurement at "
+                                "offset ") +
+                    std::to_string(is.tellg()));
+            }
+            kind = VarKind::Measured;
+        }
+        else
         {
             throw std::runtime_error(
-                std::string("expecting either 'check:' or 'track:', got '") +
+                std::string("expecting one of 'check:', 'track:' or "
+                            "'measure:', got '") +
                 KW + "' at offset " + std::to_string(is.tellg()));
         }
-        bool tracked = (KW == "track:");
-        transcript.mVars.emplace_back(vname, val, tracked);
+        transcript.mVars.emplace_back(vname, val, kind);
         scanWhitespace(is);
     }
     return is;
@@ -384,7 +475,7 @@ Corpus::Corpus(std::string const& path, bool saveOnDestroy)
             {
                 Transcript trans;
                 in >> trans;
-                addTranscript(trans);
+                addTranscript(std::move(trans));
                 scanWhitespace(in);
             }
         }
@@ -416,9 +507,31 @@ Corpus::markDirty()
     mDirty = true;
 }
 
+std::string const&
+Corpus::getPath() const
+{
+    return mPath;
+}
+
+Sidecar&
+Corpus::getSidecar(std::string const& suffix)
+{
+    auto& sc = mSidecars[suffix];
+    if (!sc)
+    {
+        sc = std::make_unique<Sidecar>(mPath.empty() ? std::string()
+                                                     : mPath + "." + suffix);
+    }
+    return *sc;
+}
+
 void
 Corpus::save()
 {
+    for (auto& pair : mSidecars)
+    {
+        pair.second->save();
+    }
     if (mDirty)
     {
         std::ofstream out(mPath, std::ios::out | std::ios::trunc);
@@ -438,29 +551,37 @@ Corpus::getTranscripts(TestName tname)
     return mTranscripts[tname];
 }
 
-void
-Corpus::addTranscript(Transcript const& ts)
+std::map<TestName, std::set<Transcript>> const&
+Corpus::getAllTranscripts() const
+{
+    return mTranscripts;
+}
+
+Transcript const&
+Corpus::addTranscript(Transcript ts)
 {
-    bool inserted = getTranscripts(ts.getTestName()).emplace(ts).second;
-    assert(inserted);
+    auto pair = getTranscripts(ts.getTestName()).emplace(std::move(ts));
+    assert(pair.second);
     markDirty();
+    return *pair.first;
 }
 
-void
-Corpus::replaceTranscript(Transcript const& oldTs, Transcript const& newTs)
+Transcript const&
+Corpus::replaceTranscript(Transcript const& oldTs, Transcript newTs)
 {
     assert(oldTs.getTestName() == newTs.getTestName());
     auto& transcripts = getTranscripts(oldTs.getTestName());
     auto i = transcripts.find(oldTs);
     assert(i != transcripts.end());
     transcripts.erase(i);
-    bool inserted = transcripts.emplace(newTs).second;
-    assert(inserted);
+    auto pair = transcripts.emplace(std::move(newTs));
+    assert(pair.second);
     markDirty();
+    return *pair.first;
 }
 
-void
-Corpus::updateTranscript(Transcript const& ts)
+Transcript const&
+Corpus::updateTranscript(Transcript ts)
 {
     auto& tss = getTranscripts(ts.getTestName());
     bool erased = false;
@@ -474,9 +595,105 @@ Corpus::updateTranscript(Transcript const& ts)
         }
     }
     assert(erased);
-    bool inserted = tss.emplace(ts).second;
-    assert(inserted);
+    auto pair = tss.emplace(std::move(ts));
+    assert(pair.second);
     markDirty();
+    return *pair.first;
+}
+
+void
+Corpus::removeTranscript(Transcript const& ts)
+{
+    auto& tss = getTranscripts(ts.getTestName());
+    auto i = tss.find(ts);
+    if (i != tss.end())
+    {
+        tss.erase(i);
+        markDirty();
+    }
+}
+
+void
+Corpus::mergeChanges(Corpus& base, Corpus& changed,
+                     std::vector<std::string> const& sidecars)
+{
+    static const std::set<Transcript> none;
+    auto transcriptsOf = [](Corpus const& corp,
+                            TestName tname) -> std::set<Transcript> const& {
+        auto i = corp.mTranscripts.find(tname);
+        return i == corp.mTranscripts.end() ? none : i->second;
+    };
+    std::set<TestName> tnames;
+    for (auto const& pair : base.mTranscripts)
+    {
+        tnames.emplace(pair.first);
+    }
+    for (auto const& pair : changed.mTranscripts)
+    {
+        tnames.emplace(pair.first);
+    }
+    for (auto const& tname : tnames)
+    {
+        auto const& before = transcriptsOf(base, tname);
+        auto const& after = transcriptsOf(changed, tname);
+        for (auto const& ts : before)
+        {
+            if (after.find(ts) == after.end())
+            {
+                removeTranscript(ts);
+            }
+        }
+        for (auto const& ts : after)
+        {
+            if (before.find(ts) != before.end())
+            {
+                continue;
+            }
+            // An update replaces whatever this corpus has for the same plan.
+            auto& ours = getTranscripts(tname);
+            for (auto i = ours.begin(); i != ours.end();)
+            {
+                if (i->getPlan() == ts.getPlan())
+                {
+                    i = ours.erase(i);
+                    markDirty();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            addTranscript(ts);
+        }
+    }
+
+    for (auto const& suffix : sidecars)
+    {
+        auto const& before = base.getSidecar(suffix).getRecords();
+        auto const& after = changed.getSidecar(suffix).getRecords();
+        auto& ours = getSidecar(suffix);
+        for (auto const& pair : before)
+        {
+            if (after.find(pair.first) == after.end())
+            {
+                ours.erase(pair.first.first, pair.first.second);
+            }
+        }
+        for (auto const& pair : after)
+        {
+            auto b = before.find(pair.first);
+            for (auto const& kv : pair.second)
+            {
+                if (b == before.end() || b->second.find(kv.first) ==
+                                             b->second.end() ||
+                    b->second.at(kv.first) != kv.second)
+                {
+                    ours.set(pair.first.first, pair.first.second, kv.first,
+                             kv.second);
+                }
+            }
+        }
+    }
 }
 
 #pragma endregion // Corpus
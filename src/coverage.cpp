@@ -0,0 +1,483 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <link.h>
+#include <map>
+#include <new>
+#include <photesthesis/3rdparty/xxhash64.h>
+#include <photesthesis/corpus.h>
+#include <photesthesis/coverage.h>
+#include <photesthesis/sidecar.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+uint8_t* gCov8BitStart{nullptr};
+size_t gCov8BitLen{0};
+uintptr_t const* gCovPCsStart{nullptr};
+size_t gCovPCsLen{0};
+
+// pc-table entries are (PC, flags) pairs; this flag bit marks the entry block
+// of a function.
+const uintptr_t PCFlagFunctionEntry = 1;
+
+std::string
+demangle(char const* name)
+{
+    int status = 0;
+    char* d = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status == 0 && d)
+    {
+        std::string s(d);
+        std::free(d);
+        return s;
+    }
+    return std::string(name);
+}
+
+std::string gSharedCoverageName;
+
+void
+unlinkSharedCoverage()
+{
+    shm_unlink(gSharedCoverageName.c_str());
+}
+
+photesthesis::SharedCoverage*
+createSharedCoverage()
+{
+    using photesthesis::SharedCoverage;
+    gSharedCoverageName =
+        "/photesthesis-coverage-" + std::to_string(getpid());
+    char const* name = gSharedCoverageName.c_str();
+    int fd = shm_open(name, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        throw std::runtime_error("unable to create shared coverage segment " +
+                                 gSharedCoverageName + ": " +
+                                 std::strerror(errno));
+    }
+    size_t sz = sizeof(SharedCoverage);
+    void* mem = MAP_FAILED;
+    if (ftruncate(fd, sz) == 0)
+    {
+        mem = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        shm_unlink(name);
+        throw std::runtime_error("unable to map shared coverage segment " +
+                                 gSharedCoverageName + ": " +
+                                 std::strerror(errno));
+    }
+    auto shared = new (mem) SharedCoverage();
+    shared->mMagic = SharedCoverage::Magic;
+    shared->mVersion = SharedCoverage::Version;
+    std::atexit(unlinkSharedCoverage);
+    setenv("PHOTESTHESIS_COVERAGE_SHM", name, 1);
+    return shared;
+}
+} // namespace
+
+#ifdef PHOTESTHESIS_LIBFUZZER
+
+// libFuzzer defines the sanitizer-coverage callbacks below itself, so when
+// linking with it we find the main executable's counters and pc-table from
+// the linker-provided bounds of their sections instead.
+extern "C"
+{
+    extern uint8_t __start___sancov_cntrs[] __attribute__((weak));
+    extern uint8_t __stop___sancov_cntrs[] __attribute__((weak));
+    extern uintptr_t const __start___sancov_pcs[] __attribute__((weak));
+    extern uintptr_t const __stop___sancov_pcs[] __attribute__((weak));
+}
+
+namespace
+{
+struct SectionCoverage
+{
+    SectionCoverage()
+    {
+        if (__start___sancov_cntrs && __stop___sancov_cntrs)
+        {
+            gCov8BitStart = __start___sancov_cntrs;
+            gCov8BitLen = __stop___sancov_cntrs - __start___sancov_cntrs;
+        }
+        if (__start___sancov_pcs && __stop___sancov_pcs)
+        {
+            gCovPCsStart = __start___sancov_pcs;
+            gCovPCsLen = (__stop___sancov_pcs - __start___sancov_pcs) / 2;
+        }
+    }
+} gSectionCoverage;
+} // namespace
+
+#endif
+
+extern "C"
+{
+#ifndef PHOTESTHESIS_LIBFUZZER
+    __attribute__((visibility("default"))) void
+    __sanitizer_cov_8bit_counters_init(uint8_t* Start, uint8_t* Stop)
+    {
+        gCov8BitStart = Start;
+        gCov8BitLen = Stop - Start;
+    }
+
+    __attribute__((visibility("default"))) void
+    __sanitizer_cov_pcs_init(uintptr_t const* Start, uintptr_t const* Stop)
+    {
+        gCovPCsStart = Start;
+        gCovPCsLen = (Stop - Start) / 2;
+    }
+#endif
+
+    // Provided by the sanitizer runtimes (ASan, UBSan, etc.) when linked in.
+    __attribute__((weak)) void
+    __sanitizer_symbolize_pc(void* pc, char const* fmt, char* out_buf,
+                             size_t out_buf_size);
+}
+
+namespace photesthesis
+{
+
+uint8_t*
+getCoverageCounters()
+{
+    return gCov8BitStart;
+}
+
+size_t
+getCoverageCountersSize()
+{
+    return gCov8BitLen;
+}
+
+SharedCoverage&
+getSharedCoverage()
+{
+    static SharedCoverage* sShared = createSharedCoverage();
+    return *sShared;
+}
+
+std::string
+encodeEdges(uint8_t const* counters, size_t len)
+{
+    static const char Hex[] = "0123456789abcdef";
+    std::string out;
+    auto put = [&](uint8_t byte) {
+        out += Hex[byte >> 4];
+        out += Hex[byte & 0xf];
+    };
+    size_t prev = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (counters[i] == 0)
+        {
+            continue;
+        }
+        uint64_t delta = i - prev;
+        prev = i;
+        while (delta >= 0x80)
+        {
+            put(static_cast<uint8_t>(delta | 0x80));
+            delta >>= 7;
+        }
+        put(static_cast<uint8_t>(delta));
+        put(counters[i]);
+    }
+    return out;
+}
+
+std::vector<Edge>
+decodeEdges(std::string const& encoded)
+{
+    auto nibble = [](char c) -> uint8_t {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        throw std::runtime_error("bad hex digit in encoded edges");
+    };
+    std::vector<uint8_t> bytes;
+    if (encoded.size() % 2 != 0)
+    {
+        throw std::runtime_error("odd-length encoded edges");
+    }
+    for (size_t i = 0; i < encoded.size(); i += 2)
+    {
+        bytes.emplace_back((nibble(encoded[i]) << 4) | nibble(encoded[i + 1]));
+    }
+    std::vector<Edge> edges;
+    uint64_t index = 0;
+    size_t i = 0;
+    while (i < bytes.size())
+    {
+        uint64_t delta = 0;
+        unsigned shift = 0;
+        while (i < bytes.size() && (bytes[i] & 0x80))
+        {
+            delta |= static_cast<uint64_t>(bytes[i++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if (i + 1 >= bytes.size())
+        {
+            throw std::runtime_error("truncated encoded edges");
+        }
+        delta |= static_cast<uint64_t>(bytes[i++]) << shift;
+        index += delta;
+        edges.emplace_back(static_cast<uint32_t>(index), bytes[i++]);
+    }
+    return edges;
+}
+
+std::vector<CoverageFunction> const&
+getCoverageFunctions()
+{
+    static std::vector<CoverageFunction> sFunctions;
+    static bool sInitialized{false};
+    if (sInitialized)
+    {
+        return sFunctions;
+    }
+    sInitialized = true;
+    for (size_t i = 0; i < gCovPCsLen; ++i)
+    {
+        uintptr_t pc = gCovPCsStart[2 * i];
+        uintptr_t flags = gCovPCsStart[2 * i + 1];
+        if (sFunctions.empty() || (flags & PCFlagFunctionEntry))
+        {
+            CoverageFunction fn;
+            fn.mFirstEdge = i;
+            fn.mEntryPC = pc;
+            void* vpc = reinterpret_cast<void*>(pc);
+            if (__sanitizer_symbolize_pc)
+            {
+                char buf[1024];
+                __sanitizer_symbolize_pc(vpc, "%f", buf, sizeof(buf));
+                fn.mName = buf;
+                __sanitizer_symbolize_pc(vpc, "%s", buf, sizeof(buf));
+                fn.mFile = buf;
+            }
+            else
+            {
+                Dl_info info;
+                if (dladdr(vpc, &info) != 0)
+                {
+                    if (info.dli_sname)
+                    {
+                        fn.mName = demangle(info.dli_sname);
+                    }
+                    if (info.dli_fname)
+                    {
+                        fn.mFile = info.dli_fname;
+                    }
+                }
+            }
+            if (fn.mName.empty())
+            {
+                std::ostringstream oss;
+                oss << "0x" << std::hex << pc;
+                fn.mName = oss.str();
+            }
+            if (fn.mFile.empty())
+            {
+                fn.mFile = "<unknown>";
+            }
+            sFunctions.emplace_back(fn);
+        }
+        auto& fn = sFunctions.back();
+        fn.mNumEdges += 1;
+        fn.mMaxPC = std::max(fn.mMaxPC, pc);
+    }
+    return sFunctions;
+}
+
+std::set<std::string>
+getCoveredFunctions(std::vector<uint8_t> const& counters)
+{
+    std::set<std::string> names;
+    for (auto const& fn : getCoverageFunctions())
+    {
+        size_t end = std::min(fn.mFirstEdge + fn.mNumEdges, counters.size());
+        for (size_t e = fn.mFirstEdge; e < end; ++e)
+        {
+            if (counters[e] != 0)
+            {
+                names.emplace(fn.mName);
+                break;
+            }
+        }
+    }
+    return names;
+}
+
+std::map<std::string, uint64_t>
+getFunctionFingerprints()
+{
+    static std::map<std::string, uint64_t> sFingerprints;
+    static bool sInitialized{false};
+    if (sInitialized)
+    {
+        return sFingerprints;
+    }
+    sInitialized = true;
+    // Functions with the same name (eg. static functions in different files,
+    // or copies of an inline function) are fingerprinted together, by hashing
+    // their copies' hashes in sorted order: identical copies then don't cancel
+    // out, and the result doesn't depend on the order of the pc-table.
+    std::map<std::string, std::vector<uint64_t>> copies;
+    for (auto const& fn : getCoverageFunctions())
+    {
+        uintptr_t begin = fn.mEntryPC;
+        uintptr_t end = fn.mMaxPC + 1;
+        Dl_info info;
+        void* symInfo = nullptr;
+        if (dladdr1(reinterpret_cast<void*>(fn.mEntryPC), &info, &symInfo,
+                    RTLD_DL_SYMENT) == 0)
+        {
+            symInfo = nullptr;
+        }
+        auto sym = static_cast<ElfW(Sym) const*>(symInfo);
+        if (sym && sym->st_size != 0 &&
+            reinterpret_cast<uintptr_t>(info.dli_saddr) <= fn.mEntryPC)
+        {
+            begin = reinterpret_cast<uintptr_t>(info.dli_saddr);
+            end = begin + sym->st_size;
+        }
+        XXHash64 h{0};
+        h.add(reinterpret_cast<void const*>(begin), end - begin);
+        copies[fn.mName].emplace_back(h.hash());
+    }
+    for (auto& pair : copies)
+    {
+        std::sort(pair.second.begin(), pair.second.end());
+        XXHash64 h{0};
+        h.add(pair.second.data(), pair.second.size() * sizeof(uint64_t));
+        sFingerprints.emplace(pair.first, h.hash());
+    }
+    return sFingerprints;
+}
+
+void
+writeCoverageReport(Sidecar const& coverage, std::ostream& os)
+{
+    static const Symbol EDGES("edges");
+
+    // For each edge, how many transcripts cover it and the first one that
+    // does (in sidecar order).
+    std::vector<uint64_t> hits(gCov8BitLen, 0);
+    std::vector<SidecarKey const*> firstHit(gCov8BitLen, nullptr);
+    size_t nTranscripts = 0;
+    for (auto const& pair : coverage.getRecords())
+    {
+        auto i = pair.second.find(EDGES);
+        std::string encoded;
+        if (i == pair.second.end() || !i->second.match(encoded))
+        {
+            continue;
+        }
+        ++nTranscripts;
+        for (auto const& edge : decodeEdges(encoded))
+        {
+            if (edge.first >= gCov8BitLen)
+            {
+                throw std::runtime_error(
+                    "recorded edge out of range, coverage sidecar is from a "
+                    "different build");
+            }
+            if (hits[edge.first]++ == 0)
+            {
+                firstHit[edge.first] = &pair.first;
+            }
+        }
+    }
+
+    size_t nCovered = 0;
+    for (auto h : hits)
+    {
+        nCovered += (h != 0);
+    }
+    auto pct = [](size_t n, size_t d) {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1)
+            << (d == 0 ? 0.0 : 100.0 * n / d) << '%';
+        return oss.str();
+    };
+    os << "# coverage of " << nTranscripts << " transcripts: " << nCovered
+       << "/" << gCov8BitLen << " edges (" << pct(nCovered, gCov8BitLen)
+       << ")" << std::endl;
+
+    auto const& fns = getCoverageFunctions();
+    if (fns.empty())
+    {
+        os << "# no pc-table available: compile the SUT with "
+              "-fsanitize-coverage=inline-8bit-counters,pc-table for a "
+              "per-function report"
+           << std::endl;
+        return;
+    }
+
+    std::map<std::string, std::pair<size_t, size_t>> files;
+    std::map<std::string, std::vector<std::string>> fnLines;
+    for (auto const& fn : fns)
+    {
+        size_t covered = 0;
+        SidecarKey const* first = nullptr;
+        for (size_t e = fn.mFirstEdge; e < fn.mFirstEdge + fn.mNumEdges; ++e)
+        {
+            if (hits.at(e) != 0)
+            {
+                ++covered;
+                if (!first)
+                {
+                    first = firstHit.at(e);
+                }
+            }
+        }
+        auto& f = files[fn.mFile];
+        f.first += covered;
+        f.second += fn.mNumEdges;
+        std::ostringstream oss;
+        oss << "  " << covered << "/" << fn.mNumEdges << " ("
+            << pct(covered, fn.mNumEdges) << ") " << fn.mName;
+        if (first)
+        {
+            oss << " [first covered by " << first->first << " 0x" << std::hex
+                << first->second << std::dec << "]";
+        }
+        fnLines[fn.mFile].emplace_back(oss.str());
+    }
+    for (auto const& pair : files)
+    {
+        os << std::endl
+           << "file: " << pair.first << " " << pair.second.first << "/"
+           << pair.second.second << " ("
+           << pct(pair.second.first, pair.second.second) << ")" << std::endl;
+        for (auto const& line : fnLines[pair.first])
+        {
+            os << line << std::endl;
+        }
+    }
+}
+
+} // namespace photesthesis
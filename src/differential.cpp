@@ -0,0 +1,100 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <algorithm>
+#include <iostream>
+#include <photesthesis/differential.h>
+
+namespace photesthesis
+{
+
+bool
+DifferentialTest::observationsAgree(Observation const& a,
+                                    Observation const& b) const
+{
+    if (a.mType != Type::Nil && a.mType == b.mType)
+    {
+        return a.mName == b.mName && a.mKind == b.mKind &&
+               a.mScalar == b.mScalar && a.mText == b.mText;
+    }
+    return Transcript::varMatches(a.toVar(), b.toVar(), mMeasureTolerance);
+}
+
+void
+DifferentialTest::run()
+{
+    // Run the reference implementation with online checking suspended, and
+    // set its observations aside.
+    Transcript const* expected = mExpected;
+    mExpected = nullptr;
+    runReference();
+    mergeTaskObservations();
+    mExpected = expected;
+    std::swap(mReference, mObservations);
+    mNumReference = mNumObservations;
+    mNumObservations = 0;
+
+    // Then reset the trajectory so that only the optimized implementation's
+    // coverage and traces count.
+    initTrajectory();
+    runOptimized();
+    mergeTaskObservations();
+
+    if (mReplaying)
+    {
+        return;
+    }
+    size_t n = std::max(mNumReference, mNumObservations);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i < mNumReference && i < mNumObservations &&
+            observationsAgree(mReference[i], mObservations[i]))
+        {
+            continue;
+        }
+        mFailed = true;
+        TranscriptVar ref, opt;
+        if (i < mNumReference)
+        {
+            ref = mReference[i].toVar();
+        }
+        if (i < mNumObservations)
+        {
+            opt = mObservations[i].toVar();
+        }
+        handleDivergence(currentPlan(), i, i < mNumReference ? &ref : nullptr,
+                         i < mNumObservations ? &opt : nullptr);
+    }
+}
+
+void
+DifferentialTest::handleDivergence(Plan const& plan, size_t index,
+                                   TranscriptVar const* reference,
+                                   TranscriptVar const* optimized)
+{
+    if (mVerboseLevel > 0)
+    {
+        auto show = [](TranscriptVar const* var) {
+            if (var)
+            {
+                std::cout << std::get<0>(*var) << " = " << std::get<1>(*var)
+                          << std::endl;
+            }
+            else
+            {
+                std::cout << "(none)" << std::endl;
+            }
+        };
+        std::cout << "divergence at observation " << index << " in test "
+                  << plan.getTestName() << " " << std::hex
+                  << plan.getHashCode() << std::dec << std::endl;
+        std::cout << "  parameters:" << std::endl << plan << std::endl;
+        std::cout << "  reference: ";
+        show(reference);
+        std::cout << "  optimized: ";
+        show(optimized);
+    }
+}
+
+} // namespace photesthesis
@@ -0,0 +1,286 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <array>
+#include <photesthesis/fasthash.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+using photesthesis::FastHash;
+
+constexpr uint64_t Prime32_1 = 0x9E3779B1;
+constexpr uint64_t Prime32_2 = 0x85EBCA77;
+constexpr uint64_t Prime32_3 = 0xC2B2AE3D;
+constexpr uint64_t Prime64_1 = 0x9E3779B185EBCA87;
+constexpr uint64_t Prime64_2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t Prime64_3 = 0x165667B19E3779F9;
+constexpr uint64_t Prime64_4 = 0x85EBCA77C2B2AE63;
+constexpr uint64_t Prime64_5 = 0x27D4EB2F165667C5;
+
+constexpr size_t SecretWords = FastHash::Lanes + FastHash::StripesPerBlock;
+
+// Key material, from splitmix64 so that it has no structure. Stripe `s` of a
+// block uses words `s` to `s + Lanes - 1`, as XXH3 slides along its secret.
+constexpr std::array<uint64_t, SecretWords>
+makeSecret()
+{
+    std::array<uint64_t, SecretWords> secret{};
+    uint64_t x = 0x5048415348534543; // "PHASHSEC"
+    for (auto& word : secret)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        word = z ^ (z >> 31);
+    }
+    return secret;
+}
+
+constexpr std::array<uint64_t, SecretWords> Secret = makeSecret();
+
+inline uint64_t
+read64(uint8_t const* p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Multiply to 128 bits and fold the halves together.
+inline uint64_t
+mum(uint64_t a, uint64_t b)
+{
+    __uint128_t m = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(m) ^ static_cast<uint64_t>(m >> 64);
+}
+
+inline uint64_t
+avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9;
+    h ^= h >> 32;
+    return h;
+}
+
+void
+initAccumulators(uint64_t* acc, uint64_t seed)
+{
+    static const uint64_t Init[FastHash::Lanes] = {
+        Prime32_3, Prime64_1, Prime64_2, Prime64_3,
+        Prime64_4, Prime32_2, Prime64_5, Prime32_1};
+    for (size_t i = 0; i < FastHash::Lanes; ++i)
+    {
+        acc[i] = (i % 2 == 0) ? Init[i] + seed : Init[i] - seed;
+    }
+}
+
+void
+scramble(uint64_t* acc)
+{
+    uint64_t const* key = Secret.data() + FastHash::StripesPerBlock;
+    for (size_t i = 0; i < FastHash::Lanes; ++i)
+    {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= key[i];
+        acc[i] = a * Prime32_1;
+    }
+}
+} // namespace
+
+namespace photesthesis
+{
+
+FastHash::FastHash(uint64_t seed) : mSeed(seed)
+{
+    initAccumulators(mAcc, seed);
+}
+
+void
+FastHash::accumulate(uint64_t* acc, uint8_t const* data, size_t n,
+                     uint64_t& stripes)
+{
+    // Each lane adds the product of the low and high halves of its keyed
+    // input word, and its neighbour adds the unkeyed word. The lanes are
+    // held in registers across the stripes of a call.
+#if defined(__AVX2__)
+    __m256i a[2] = {_mm256_loadu_si256(reinterpret_cast<__m256i*>(acc)),
+                    _mm256_loadu_si256(reinterpret_cast<__m256i*>(acc + 4))};
+#elif defined(__SSE2__)
+    __m128i a[4] = {_mm_loadu_si128(reinterpret_cast<__m128i*>(acc)),
+                    _mm_loadu_si128(reinterpret_cast<__m128i*>(acc + 2)),
+                    _mm_loadu_si128(reinterpret_cast<__m128i*>(acc + 4)),
+                    _mm_loadu_si128(reinterpret_cast<__m128i*>(acc + 6))};
+#endif
+    for (; n != 0; --n, data += StripeSize)
+    {
+        uint64_t const* key = Secret.data() + stripes % StripesPerBlock;
+#if defined(__AVX2__)
+        for (size_t i = 0; i < 2; ++i)
+        {
+            __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<__m256i const*>(data + 32 * i));
+            __m256i k = _mm256_xor_si256(
+                v, _mm256_loadu_si256(
+                       reinterpret_cast<__m256i const*>(key + 4 * i)));
+            __m256i product = _mm256_mul_epu32(k, _mm256_srli_epi64(k, 32));
+            __m256i swapped = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm256_add_epi64(a[i], _mm256_add_epi64(product, swapped));
+        }
+#elif defined(__SSE2__)
+        for (size_t i = 0; i < 4; ++i)
+        {
+            __m128i v = _mm_loadu_si128(
+                reinterpret_cast<__m128i const*>(data + 16 * i));
+            __m128i k = _mm_xor_si128(
+                v, _mm_loadu_si128(
+                       reinterpret_cast<__m128i const*>(key + 2 * i)));
+            __m128i product = _mm_mul_epu32(k, _mm_srli_epi64(k, 32));
+            __m128i swapped = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+        }
+#else
+        for (size_t i = 0; i < Lanes; ++i)
+        {
+            uint64_t v = read64(data + 8 * i);
+            uint64_t k = v ^ key[i];
+            acc[i ^ 1] += v;
+            acc[i] += (k & 0xffffffff) * (k >> 32);
+        }
+#endif
+        if (++stripes % StripesPerBlock == 0)
+        {
+#if defined(__AVX2__)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), a[0]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 4), a[1]);
+            scramble(acc);
+            a[0] = _mm256_loadu_si256(reinterpret_cast<__m256i*>(acc));
+            a[1] = _mm256_loadu_si256(reinterpret_cast<__m256i*>(acc + 4));
+#elif defined(__SSE2__)
+            for (size_t i = 0; i < 4; ++i)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 2 * i),
+                                 a[i]);
+            }
+            scramble(acc);
+            for (size_t i = 0; i < 4; ++i)
+            {
+                a[i] = _mm_loadu_si128(
+                    reinterpret_cast<__m128i*>(acc + 2 * i));
+            }
+#else
+            scramble(acc);
+#endif
+        }
+    }
+#if defined(__AVX2__)
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), a[0]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 4), a[1]);
+#elif defined(__SSE2__)
+    for (size_t i = 0; i < 4; ++i)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 2 * i), a[i]);
+    }
+#endif
+}
+
+uint64_t
+FastHash::finishLong(uint64_t const* acc, uint8_t const* tail, size_t tailLen,
+                     uint64_t stripes, uint64_t total, uint64_t seed)
+{
+    uint64_t a[Lanes];
+    std::memcpy(a, acc, sizeof(a));
+    uint8_t last[StripeSize] = {0};
+    std::memcpy(last, tail, tailLen);
+    accumulate(a, last, 1, stripes);
+    uint64_t h = total * Prime64_1 ^ seed;
+    for (size_t i = 0; i < Lanes; i += 2)
+    {
+        h += mum(a[i] ^ Secret[i + 3], a[i + 1] ^ Secret[i + 4]);
+    }
+    return avalanche(h);
+}
+
+uint64_t
+FastHash::hashShort(uint8_t const* data, size_t len, uint64_t seed)
+{
+    uint64_t h = seed ^ (len * Prime64_1);
+    size_t chunk = 0;
+    do
+    {
+        uint8_t buf[16] = {0};
+        size_t n = len < 16 ? len : 16;
+        std::memcpy(buf, data, n);
+        h = mum(read64(buf) ^ Secret[2 * chunk] ^ h,
+                read64(buf + 8) ^ Secret[2 * chunk + 1]) ^
+            (h * Prime64_2);
+        data += n;
+        len -= n;
+        ++chunk;
+    } while (len != 0);
+    return avalanche(h);
+}
+
+void
+FastHash::addSlow(uint8_t const* data, size_t len)
+{
+    // The buffer is only flushed once more input follows it, so that the
+    // last (possibly full) stripe is always left for `hash`.
+    while (len != 0)
+    {
+        if (mBufLen == StripeSize)
+        {
+            accumulate(mAcc, mBuf, 1, mStripes);
+            mBufLen = 0;
+        }
+        if (mBufLen == 0 && len > StripeSize)
+        {
+            size_t n = (len - 1) / StripeSize;
+            accumulate(mAcc, data, n, mStripes);
+            data += n * StripeSize;
+            len -= n * StripeSize;
+            mTotal += n * StripeSize;
+        }
+        size_t n = StripeSize - mBufLen < len ? StripeSize - mBufLen : len;
+        std::memcpy(mBuf + mBufLen, data, n);
+        mBufLen += n;
+        data += n;
+        len -= n;
+        mTotal += n;
+    }
+}
+
+uint64_t
+FastHash::hash() const
+{
+    if (mStripes == 0)
+    {
+        return hashShort(mBuf, mBufLen, mSeed);
+    }
+    return finishLong(mAcc, mBuf, mBufLen, mStripes, mTotal, mSeed);
+}
+
+uint64_t
+FastHash::hash(void const* data, size_t len, uint64_t seed)
+{
+    auto p = static_cast<uint8_t const*>(data);
+    if (len <= StripeSize)
+    {
+        return hashShort(p, len, seed);
+    }
+    uint64_t acc[Lanes];
+    initAccumulators(acc, seed);
+    uint64_t stripes = 0;
+    size_t n = (len - 1) / StripeSize;
+    accumulate(acc, p, n, stripes);
+    p += n * StripeSize;
+    return finishLong(acc, p, len - n * StripeSize, stripes, len, seed);
+}
+
+} // namespace photesthesis
@@ -2,6 +2,7 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include <algorithm>
 #include <cassert>
 #include <cwctype>
 #include <initializer_list>
@@ -85,7 +86,12 @@ addContext(ParamName ctx, RefPtr ref)
 #pragma region // Production
 
 Production::Production(std::initializer_list<AtomPtr> atoms)
-    : mAtoms(atoms), mHasRefs(false)
+    : Production(std::vector<AtomPtr>(atoms))
+{
+}
+
+Production::Production(std::vector<AtomPtr> atoms)
+    : mAtoms(std::move(atoms)), mHasRefs(false)
 {
     for (auto const& atom : mAtoms)
     {
@@ -142,8 +148,98 @@ Rule::Rule(std::initializer_list<Production> productions)
     : mProductions(productions)
 {
 }
+Rule::Rule(std::vector<Production> productions)
+    : mProductions(std::move(productions))
+{
+}
 #pragma endregion // Rule
 
+#pragma region // Choosers
+
+// The number of bytes a decision among `n` alternatives is encoded in.
+static size_t
+choiceWidth(size_t n)
+{
+    size_t width = 0;
+    for (size_t max = n - 1; max != 0; max >>= 8)
+    {
+        ++width;
+    }
+    return width;
+}
+
+Chooser::~Chooser()
+{
+}
+
+RandomChooser::RandomChooser(RandomEngine& gen,
+                             std::vector<uint8_t>* record)
+    : mGen(gen), mRecord(record)
+{
+}
+
+size_t
+RandomChooser::choose(size_t n)
+{
+    if (n == 0)
+    {
+        throw std::runtime_error("choice among no alternatives");
+    }
+    size_t choice = mGen.below(n);
+    if (mRecord)
+    {
+        for (size_t i = choiceWidth(n); i > 0; --i)
+        {
+            mRecord->emplace_back(static_cast<uint8_t>(choice >> (8 * (i - 1))));
+        }
+    }
+    return choice;
+}
+
+ChoiceSequence::ChoiceSequence(uint8_t const* data, size_t size)
+    : mData(data), mSize(size)
+{
+}
+
+ChoiceSequence::ChoiceSequence(std::vector<uint8_t> const& bytes)
+    : ChoiceSequence(bytes.data(), bytes.size())
+{
+}
+
+size_t
+ChoiceSequence::choose(size_t n)
+{
+    if (n == 0)
+    {
+        throw std::runtime_error("choice among no alternatives");
+    }
+    size_t choice = 0;
+    for (size_t i = choiceWidth(n); i > 0; --i)
+    {
+        choice <<= 8;
+        if (mPos < mSize)
+        {
+            choice |= mData[mPos];
+        }
+        ++mPos;
+    }
+    return choice % n;
+}
+
+size_t
+ChoiceSequence::width(size_t n)
+{
+    return choiceWidth(n);
+}
+
+size_t
+ChoiceSequence::getPosition() const
+{
+    return mPos < mSize ? mPos : mSize;
+}
+
+#pragma endregion // Choosers
+
 #pragma region // Context
 
 Context::Context(ParamSpecs const& params) : mGlobalParamSpecs(params)
@@ -250,13 +346,19 @@ Grammar::Ref(RuleName const& s)
 
 void
 Grammar::addRule(RuleName const& name, std::initializer_list<Production> prods)
+{
+    addRule(name, std::vector<Production>(prods));
+}
+
+void
+Grammar::addRule(RuleName const& name, std::vector<Production> prods)
 {
     if (mRules.find(name) != mRules.end())
     {
         throw std::runtime_error(std::string("duplicate rule addition: ") +
                                  name.getString());
     }
-    mRules.emplace(name, Rule(prods));
+    mRules.emplace(name, Rule(std::move(prods)));
     mRootRefs.emplace(name, Ref(name));
 }
 
@@ -681,7 +783,7 @@ Grammar::kPathCoverings(size_t k, ParamSpecs const& specs) const
 // `rule`. this might be an empty list (i.e. `(rule)` alone) if the rule has no
 // active produtions.
 Value
-Grammar::randomValueFromRule(RuleName rule, std::default_random_engine& gen,
+Grammar::randomValueFromRule(RuleName rule, Chooser& chooser,
                              size_t depth_lim, Context& context) const
 {
     if (depth_lim == 0)
@@ -693,7 +795,7 @@ Grammar::randomValueFromRule(RuleName rule, std::default_random_engine& gen,
     std::vector<Value> vals{Value(rule)};
     if (!prods.empty())
     {
-        auto& prod = pickUniform(gen, prods).get();
+        auto& prod = prods.at(chooser.choose(prods.size())).get();
         for (auto atom : prod.getAtoms())
         {
             if (auto lit = std::dynamic_pointer_cast<const Lit>(atom))
@@ -704,7 +806,7 @@ Grammar::randomValueFromRule(RuleName rule, std::default_random_engine& gen,
                          std::dynamic_pointer_cast<const class Ref>(atom))
             {
                 context.push(ref->getCtxExt());
-                Value val = randomValueFromRule(ref->getRuleName(), gen,
+                Value val = randomValueFromRule(ref->getRuleName(), chooser,
                                                 depth_lim - 1, context);
                 assert(val.isPair());
                 Value rest;
@@ -722,20 +824,38 @@ Grammar::randomValueFromRule(RuleName rule, std::default_random_engine& gen,
 }
 
 Plan
-Grammar::randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
-                              std::default_random_engine& gen,
-                              size_t depth_lim) const
+Grammar::populatePlanFromChoices(TestName tname, ParamSpecs const& params,
+                                 Chooser& chooser, size_t depth_lim) const
 {
     Plan p(tname);
     for (auto const& pair : params)
     {
         Context ctx(params);
-        Value v = randomValueFromRule(pair.second, gen, depth_lim, ctx);
+        Value v = randomValueFromRule(pair.second, chooser, depth_lim, ctx);
         p.addParam(pair.first, v);
     }
     return p;
 }
 
+Plan
+Grammar::randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
+                              RandomEngine& gen,
+                              size_t depth_lim) const
+{
+    RandomChooser chooser(gen);
+    return populatePlanFromChoices(tname, params, chooser, depth_lim);
+}
+
+Plan
+Grammar::randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
+                              RandomEngine& gen,
+                              size_t depth_lim,
+                              std::vector<uint8_t>& choices) const
+{
+    RandomChooser chooser(gen, &choices);
+    return populatePlanFromChoices(tname, params, chooser, depth_lim);
+}
+
 std::set<Plan>
 Grammar::populatePlansFromKPathCoverings(TestName tname,
                                          ParamSpecs const& specs,
@@ -750,6 +870,346 @@ Grammar::populatePlansFromKPathCoverings(TestName tname,
     return res;
 }
 
+// The order reductions must strictly decrease in, so shrinking terminates:
+// fewer leaves first, then Value order (which puts smaller literals first).
+static bool
+simpler(Value const& a, Value const& b)
+{
+    size_t sa = a.getSize(), sb = b.getSize();
+    return sa < sb || (sa == sb && a < b);
+}
+
+static bool
+isDerivationOf(Value const& v, RuleName const& rule)
+{
+    Value rest;
+    return v.isPair() && v.match(rule, rest);
+}
+
+Value
+replaceAtPath(Value const& v, std::vector<size_t> const& path,
+              Value const& replacement)
+{
+    Value res = replacement;
+    // Rebuild the spine from the bottom up.
+    std::vector<std::vector<Value>> spine;
+    Value cur = v;
+    for (size_t i : path)
+    {
+        spine.emplace_back(listElements(cur));
+        if (i >= spine.back().size())
+        {
+            throw std::runtime_error("path out of range in replaceAtPath");
+        }
+        cur = spine.back()[i];
+    }
+    for (size_t i = path.size(); i > 0; --i)
+    {
+        spine[i - 1][path[i - 1]] = res;
+        res = Value(spine[i - 1]);
+    }
+    return res;
+}
+
+Production const*
+Grammar::derivingProduction(RuleName rule, std::vector<Value> const& elts,
+                            Context& context) const
+{
+    for (auto const& prod : getProductions(rule))
+    {
+        auto const& atoms = prod.getAtoms();
+        if (atoms.size() + 1 != elts.size() ||
+            !context.has(prod.getCtxReq()) ||
+            !context.hasNone(prod.getCtxReqNot()))
+        {
+            continue;
+        }
+        bool ok = true;
+        for (size_t i = 0; ok && i < atoms.size(); ++i)
+        {
+            if (auto lit = std::dynamic_pointer_cast<const Lit>(atoms[i]))
+            {
+                ok = lit->getValue() == elts[i + 1];
+            }
+            else if (auto ref =
+                         std::dynamic_pointer_cast<const class Ref>(atoms[i]))
+            {
+                context.push(ref->getCtxExt());
+                ok = derivesInContext(ref->getRuleName(), elts[i + 1],
+                                      context);
+                context.pop(ref->getCtxExt().size());
+            }
+            else
+            {
+                throw std::logic_error("unknown subclass of Atom");
+            }
+        }
+        if (ok)
+        {
+            return &prod;
+        }
+    }
+    return nullptr;
+}
+
+bool
+Grammar::derivesInContext(RuleName rule, Value const& v,
+                          Context& context) const
+{
+    if (!isDerivationOf(v, rule))
+    {
+        return false;
+    }
+    return derivingProduction(rule, listElements(v), context) != nullptr;
+}
+
+bool
+Grammar::derives(RuleName rule, Value const& v, ParamSpecs const& specs) const
+{
+    Context ctx(specs);
+    return derivesInContext(rule, v, ctx);
+}
+
+bool
+Grammar::minimalExpansionInContext(RuleName rule, size_t depthLimit,
+                                   Context& context, Value& out) const
+{
+    if (depthLimit == 0)
+    {
+        return false;
+    }
+    bool found = false;
+    for (auto const& prod : getProductions(rule))
+    {
+        if ((depthLimit == 1 && prod.hasRefs()) ||
+            !context.has(prod.getCtxReq()) ||
+            !context.hasNone(prod.getCtxReqNot()))
+        {
+            continue;
+        }
+        std::vector<Value> vals{Value(rule)};
+        bool ok = true;
+        for (auto const& atom : prod.getAtoms())
+        {
+            if (auto lit = std::dynamic_pointer_cast<const Lit>(atom))
+            {
+                vals.emplace_back(lit->getValue());
+            }
+            else if (auto ref =
+                         std::dynamic_pointer_cast<const class Ref>(atom))
+            {
+                Value sub;
+                context.push(ref->getCtxExt());
+                ok = minimalExpansionInContext(ref->getRuleName(),
+                                               depthLimit - 1, context, sub);
+                context.pop(ref->getCtxExt().size());
+                if (!ok)
+                {
+                    break;
+                }
+                vals.emplace_back(sub);
+            }
+            else
+            {
+                throw std::logic_error("unknown subclass of Atom");
+            }
+        }
+        if (ok)
+        {
+            Value v(vals);
+            if (!found || simpler(v, out))
+            {
+                out = v;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+bool
+Grammar::minimalExpansionInContext(RuleName rule, Context& context,
+                                   Value& out) const
+{
+    // Iterative deepening: the first depth with any expansion gives the
+    // shallowest ones, which are the cheapest to search for.
+    static const size_t MAX_DEPTH = 32;
+    for (size_t depth = 1; depth <= MAX_DEPTH; ++depth)
+    {
+        if (minimalExpansionInContext(rule, depth, context, out))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Value
+Grammar::minimalExpansion(RuleName rule, ParamSpecs const& specs) const
+{
+    Context ctx(specs);
+    Value v;
+    if (!minimalExpansionInContext(rule, ctx, v))
+    {
+        throw std::runtime_error(std::string("no finite expansion of rule ") +
+                                 rule.getString());
+    }
+    return v;
+}
+
+void
+Grammar::nodeReductions(RuleName rule, Value const& v, Context& context,
+                        std::vector<size_t> const& path,
+                        std::vector<Reduction>& out) const
+{
+    std::set<Value> candidates;
+    Value minimal;
+    if (minimalExpansionInContext(rule, context, minimal))
+    {
+        candidates.emplace(minimal);
+    }
+
+    // Hoist any proper descendant derived from the same rule.
+    std::vector<Value> stack{v};
+    while (!stack.empty())
+    {
+        Value cur = stack.back();
+        stack.pop_back();
+        if (!(cur == v) && isDerivationOf(cur, rule))
+        {
+            candidates.emplace(cur);
+        }
+        if (cur.isPair())
+        {
+            auto elts = listElements(cur);
+            stack.insert(stack.end(), elts.begin() + 1, elts.end());
+        }
+    }
+
+    // Re-derive from each production, reusing children in order where the
+    // production's atoms allow and filling in the rest minimally.
+    auto elts = listElements(v);
+    for (auto const& prod : getProductions(rule))
+    {
+        if (!context.has(prod.getCtxReq()) ||
+            !context.hasNone(prod.getCtxReqNot()))
+        {
+            continue;
+        }
+        std::vector<Value> vals{Value(rule)};
+        size_t next = 1;
+        bool ok = true;
+        for (auto const& atom : prod.getAtoms())
+        {
+            if (auto lit = std::dynamic_pointer_cast<const Lit>(atom))
+            {
+                for (size_t j = next; j < elts.size(); ++j)
+                {
+                    if (elts[j] == lit->getValue())
+                    {
+                        next = j + 1;
+                        break;
+                    }
+                }
+                vals.emplace_back(lit->getValue());
+            }
+            else if (auto ref =
+                         std::dynamic_pointer_cast<const class Ref>(atom))
+            {
+                RuleName sub = ref->getRuleName();
+                size_t j = next;
+                while (j < elts.size() && !isDerivationOf(elts[j], sub))
+                {
+                    ++j;
+                }
+                if (j < elts.size())
+                {
+                    vals.emplace_back(elts[j]);
+                    next = j + 1;
+                    continue;
+                }
+                Value fill;
+                context.push(ref->getCtxExt());
+                ok = minimalExpansionInContext(sub, context, fill);
+                context.pop(ref->getCtxExt().size());
+                if (!ok)
+                {
+                    break;
+                }
+                vals.emplace_back(fill);
+            }
+            else
+            {
+                throw std::logic_error("unknown subclass of Atom");
+            }
+        }
+        if (ok)
+        {
+            candidates.emplace(Value(vals));
+        }
+    }
+
+    std::vector<Value> sorted;
+    for (auto const& c : candidates)
+    {
+        if (simpler(c, v))
+        {
+            sorted.emplace_back(c);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), simpler);
+    for (auto const& c : sorted)
+    {
+        out.emplace_back(Reduction{path, c});
+    }
+}
+
+size_t
+Grammar::levelReductions(RuleName rule, Value const& v, Context& context,
+                         size_t level, std::vector<size_t>& path,
+                         std::vector<Reduction>& out) const
+{
+    if (level == 0)
+    {
+        nodeReductions(rule, v, context, path, out);
+        return 1;
+    }
+    if (!isDerivationOf(v, rule))
+    {
+        return 0;
+    }
+    auto elts = listElements(v);
+    Production const* prod = derivingProduction(rule, elts, context);
+    if (!prod)
+    {
+        return 0;
+    }
+    size_t nodes = 0;
+    auto const& atoms = prod->getAtoms();
+    for (size_t i = 0; i < atoms.size(); ++i)
+    {
+        if (auto ref = std::dynamic_pointer_cast<const class Ref>(atoms[i]))
+        {
+            context.push(ref->getCtxExt());
+            path.emplace_back(i + 1);
+            nodes += levelReductions(ref->getRuleName(), elts[i + 1], context,
+                                     level - 1, path, out);
+            path.pop_back();
+            context.pop(ref->getCtxExt().size());
+        }
+    }
+    return nodes;
+}
+
+size_t
+Grammar::reductions(RuleName rule, Value const& v, ParamSpecs const& specs,
+                    size_t level, std::vector<Reduction>& out) const
+{
+    Context ctx(specs);
+    std::vector<size_t> path;
+    return levelReductions(rule, v, ctx, level, path, out);
+}
+
 #pragma endregion // Grammar
 
 } // namespace photesthesis
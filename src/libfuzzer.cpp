@@ -0,0 +1,184 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <photesthesis/grammar.h>
+#include <photesthesis/libfuzzer.h>
+
+// Provided by libFuzzer when linked in.
+extern "C" size_t LLVMFuzzerMutate(uint8_t* data, size_t size, size_t maxSize)
+    __attribute__((weak));
+
+namespace
+{
+uint64_t
+nowSeconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Reads whole decisions from the first `keep` bytes of a choice sequence,
+// then makes the remaining decisions at random, recording them after the
+// bytes it read.
+class PrefixChooser : public photesthesis::Chooser
+{
+    photesthesis::ChoiceSequence mSeq;
+    size_t mKeep;
+    std::vector<uint8_t>& mOut;
+    photesthesis::RandomChooser mRandom;
+    bool mRandomPhase{false};
+
+  public:
+    PrefixChooser(uint8_t const* data, size_t keep,
+                  photesthesis::RandomEngine& gen, std::vector<uint8_t>& out)
+        : mSeq(data, keep), mKeep(keep), mOut(out), mRandom(gen, &out)
+    {
+        mOut.assign(data, data + keep);
+    }
+
+    size_t
+    choose(size_t n) override
+    {
+        if (!mRandomPhase &&
+            mSeq.getPosition() + photesthesis::ChoiceSequence::width(n) <=
+                mKeep)
+        {
+            return mSeq.choose(n);
+        }
+        if (!mRandomPhase)
+        {
+            // Drop any bytes of a decision cut short by the prefix.
+            mOut.resize(mSeq.getPosition());
+            mRandomPhase = true;
+        }
+        return mRandom.choose(n);
+    }
+
+    // Whether any decision was made at random, rather than read.
+    bool
+    regenerated() const
+    {
+        return mRandomPhase;
+    }
+
+    // The number of bytes of the prefix read.
+    size_t
+    getPosition() const
+    {
+        return mSeq.getPosition();
+    }
+};
+} // namespace
+
+namespace photesthesis
+{
+
+FuzzTarget::FuzzTarget(Test& test, ParamSpecs const& specs, uint64_t depth)
+    : mTest(test), mSpecs(specs), mDepth(depth), mLastSave(nowSeconds())
+{
+}
+
+FuzzTarget::~FuzzTarget()
+{
+    saveIfDue(true);
+}
+
+void
+FuzzTarget::setSaveInterval(uint64_t seconds)
+{
+    mSaveInterval = seconds;
+}
+
+void
+FuzzTarget::initialize()
+{
+    if (mPrepared)
+    {
+        return;
+    }
+    mPrepared = true;
+    mTest.prepare();
+    mDirty = true;
+}
+
+void
+FuzzTarget::saveIfDue(bool force)
+{
+    if (!mDirty)
+    {
+        return;
+    }
+    uint64_t now = nowSeconds();
+    if (force || now - mLastSave >= mSaveInterval)
+    {
+        mTest.mCorp.save();
+        mLastSave = now;
+        mDirty = false;
+    }
+}
+
+int
+FuzzTarget::testOneInput(uint8_t const* data, size_t size)
+{
+    initialize();
+    Plan plan(mTest.getTestName());
+    bool failed = false, recorded = false;
+    try
+    {
+        failed = mTest.runChoices(mSpecs, data, size, mDepth, plan, recorded);
+    }
+    catch (RejectPlan&)
+    {
+        // Keep rejected inputs out of libFuzzer's corpus.
+        return -1;
+    }
+    mDirty = mDirty || recorded;
+    if (failed)
+    {
+        std::cerr << "photesthesis: plan " << std::hex << plan.getHashCode()
+                  << std::dec << " failed:" << std::endl
+                  << plan;
+        mDirty = true;
+        saveIfDue(true);
+        std::abort();
+    }
+    saveIfDue(false);
+    return 0;
+}
+
+size_t
+FuzzTarget::mutate(uint8_t* data, size_t size, size_t maxSize, unsigned seed)
+{
+    RandomEngine gen(seed);
+    if (LLVMFuzzerMutate && gen() % 2 == 0)
+    {
+        return LLVMFuzzerMutate(data, size, maxSize);
+    }
+    // Inputs are normally exactly the choices their plan reads, so a cut
+    // anywhere in the input lands within them. Only if it lands in bytes the
+    // plan doesn't read (say, appended by a byte-level mutation) is the plan
+    // generated again, with a cut within the bytes the first pass read.
+    size_t keep = size == 0 ? 0 : gen() % size;
+    PrefixChooser chooser(data, keep, gen, mPrefix);
+    mTest.mGram.populatePlanFromChoices(mTest.mTestName, mSpecs, chooser,
+                                        static_cast<size_t>(mDepth));
+    if (!chooser.regenerated() && chooser.getPosition() != 0)
+    {
+        PrefixChooser again(data, gen() % chooser.getPosition(), gen,
+                            mPrefix);
+        mTest.mGram.populatePlanFromChoices(mTest.mTestName, mSpecs, again,
+                                            static_cast<size_t>(mDepth));
+    }
+    size_t n = std::min(mPrefix.size(), maxSize);
+    std::memcpy(data, mPrefix.data(), n);
+    return n;
+}
+
+} // namespace photesthesis
@@ -0,0 +1,74 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/random.h>
+
+namespace
+{
+uint64_t
+splitmix64(uint64_t& x)
+{
+    uint64_t z = (x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+} // namespace
+
+namespace photesthesis
+{
+
+Xoshiro256::Xoshiro256() : Xoshiro256(0)
+{
+}
+
+Xoshiro256::Xoshiro256(uint64_t seed)
+{
+    this->seed(seed);
+}
+
+void
+Xoshiro256::seed(uint64_t seed)
+{
+    for (auto& word : mState)
+    {
+        word = splitmix64(seed);
+    }
+}
+
+void
+Xoshiro256::jump()
+{
+    static const uint64_t JUMP[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                    0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+    uint64_t s[4] = {0, 0, 0, 0};
+    for (uint64_t word : JUMP)
+    {
+        for (int b = 0; b < 64; ++b)
+        {
+            if (word & (uint64_t(1) << b))
+            {
+                for (int i = 0; i < 4; ++i)
+                {
+                    s[i] ^= mState[i];
+                }
+            }
+            (*this)();
+        }
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        mState[i] = s[i];
+    }
+}
+
+Xoshiro256
+Xoshiro256::split()
+{
+    Xoshiro256 child(*this);
+    jump();
+    return child;
+}
+
+} // namespace photesthesis
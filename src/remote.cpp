@@ -0,0 +1,371 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <photesthesis/env.h>
+#include <photesthesis/remote.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace
+{
+using photesthesis::getEnvNum;
+
+// How long a freshly started SUT has to reach `serveRemote`.
+constexpr int StartupMillis = 10000;
+
+// Read exactly `len` bytes, waiting at most `millis` milliseconds (or forever
+// if negative) for each to arrive. Returns 1 on success, 0 on timeout and -1
+// if the pipe is closed or fails.
+int
+readWithTimeout(int fd, void* buf, size_t len, int millis)
+{
+    auto p = static_cast<uint8_t*>(buf);
+    while (len != 0)
+    {
+        pollfd pfd{fd, POLLIN, 0};
+        int r = poll(&pfd, 1, millis);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r == 0)
+        {
+            return 0;
+        }
+        ssize_t n = r < 0 ? -1 : read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+std::string
+newSegmentName()
+{
+    static std::atomic<uint64_t> sCount{0};
+    return "/photesthesis-remote-" + std::to_string(getpid()) + "-" +
+           std::to_string(sCount++);
+}
+
+const photesthesis::Symbol EXIT("exit");
+} // namespace
+
+namespace photesthesis
+{
+
+RemoteTest::RemoteTest(Grammar const& gram, Corpus& corp, TestName testName,
+                       std::vector<ParamSpecs> const& seedSpecs,
+                       std::vector<std::string> const& argv)
+    : Test(gram, corp, testName, seedSpecs)
+    , mArgv(argv)
+    , mSegmentName(newSegmentName())
+{
+    if (mArgv.empty())
+    {
+        throw std::runtime_error("RemoteTest needs a command line");
+    }
+    getEnvNum("PHOTESTHESIS_REMOTE_TIMEOUT_MS", mTimeoutMillis);
+    int fd = shm_open(mSegmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        throw std::runtime_error("unable to create remote segment " +
+                                 mSegmentName + ": " + std::strerror(errno));
+    }
+    size_t sz = sizeof(RemoteSegment);
+    void* mem = MAP_FAILED;
+    if (ftruncate(fd, sz) == 0)
+    {
+        mem = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        shm_unlink(mSegmentName.c_str());
+        throw std::runtime_error("unable to map remote segment " +
+                                 mSegmentName + ": " + std::strerror(errno));
+    }
+    mSegment = new (mem) RemoteSegment();
+    mSegment->mMagic = RemoteSegment::Magic;
+    mSegment->mVersion = RemoteSegment::Version;
+    setSubprocessCoverage(true);
+}
+
+RemoteTest::~RemoteTest()
+{
+    stopServer();
+    munmap(mSegment, sizeof(RemoteSegment));
+    shm_unlink(mSegmentName.c_str());
+}
+
+void
+RemoteTest::setTimeout(uint64_t millis)
+{
+    mTimeoutMillis = millis;
+}
+
+void
+RemoteTest::startServer()
+{
+    // Build everything the child needs before forking, so that it only
+    // makes async-signal-safe calls before exec.
+    std::vector<char*> argv;
+    for (auto& arg : mArgv)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    std::string segVar = "PHOTESTHESIS_REMOTE=" + mSegmentName;
+    std::vector<char*> envp;
+    for (char** e = environ; *e; ++e)
+    {
+        if (std::strncmp(*e, "PHOTESTHESIS_REMOTE=", 20) != 0)
+        {
+            envp.push_back(*e);
+        }
+    }
+    envp.push_back(const_cast<char*>(segVar.c_str()));
+    envp.push_back(nullptr);
+
+    int ctl[2], st[2];
+    if (pipe(ctl) != 0)
+    {
+        throw std::runtime_error("unable to create remote pipes");
+    }
+    if (pipe(st) != 0)
+    {
+        close(ctl[0]);
+        close(ctl[1]);
+        throw std::runtime_error("unable to create remote pipes");
+    }
+    // Keep our ends of the pipes out of any other process we start.
+    fcntl(ctl[1], F_SETFD, FD_CLOEXEC);
+    fcntl(st[0], F_SETFD, FD_CLOEXEC);
+    // A SUT that dies between runs must not take the harness with it.
+    std::signal(SIGPIPE, SIG_IGN);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (dup2(ctl[0], RemoteControlFd) < 0 ||
+            dup2(st[1], RemoteStatusFd) < 0)
+        {
+            _exit(127);
+        }
+        close(ctl[0]);
+        close(ctl[1]);
+        close(st[0]);
+        close(st[1]);
+        execvpe(argv[0], argv.data(), envp.data());
+        _exit(127);
+    }
+    close(ctl[0]);
+    close(st[1]);
+    mServerPid = pid;
+    mControlFd = ctl[1];
+    mStatusFd = st[0];
+    if (pid < 0)
+    {
+        stopServer();
+        throw std::runtime_error("unable to fork remote SUT");
+    }
+    uint32_t hello = 0;
+    if (readWithTimeout(mStatusFd, &hello, 4, StartupMillis) != 1 ||
+        hello != RemoteHello)
+    {
+        stopServer();
+        throw std::runtime_error("remote SUT " + mArgv[0] +
+                                 " did not start serving plans");
+    }
+    if (mVerboseLevel > 1)
+    {
+        std::cout << "started remote SUT " << mArgv[0] << " as pid "
+                  << mServerPid << std::endl;
+    }
+}
+
+void
+RemoteTest::stopServer()
+{
+    if (mControlFd >= 0)
+    {
+        close(mControlFd);
+        mControlFd = -1;
+    }
+    if (mStatusFd >= 0)
+    {
+        close(mStatusFd);
+        mStatusFd = -1;
+    }
+    if (mServerPid > 0)
+    {
+        kill(mServerPid, SIGKILL);
+        waitpid(mServerPid, nullptr, 0);
+    }
+    mServerPid = -1;
+}
+
+// Ask the forkserver for a child and wait for its status. Returns false if
+// the child was killed for exceeding the timeout.
+bool
+RemoteTest::runChild(int& status)
+{
+    if (mServerPid < 0)
+    {
+        startServer();
+    }
+    uint32_t go = 0;
+    int32_t pid = 0;
+    if (write(mControlFd, &go, 4) != 4 ||
+        readWithTimeout(mStatusFd, &pid, 4, StartupMillis) != 1)
+    {
+        stopServer();
+        throw std::runtime_error("remote SUT " + mArgv[0] + " stopped serving");
+    }
+    int millis = mTimeoutMillis == 0 ? -1 : static_cast<int>(mTimeoutMillis);
+    int r = readWithTimeout(mStatusFd, &status, 4, millis);
+    bool timedOut = false;
+    if (r == 0)
+    {
+        kill(pid, SIGKILL);
+        timedOut = true;
+        r = readWithTimeout(mStatusFd, &status, 4, -1);
+    }
+    if (r != 1)
+    {
+        stopServer();
+        throw std::runtime_error("remote SUT " + mArgv[0] + " stopped serving");
+    }
+    return !timedOut;
+}
+
+void
+RemoteTest::replayObservations()
+{
+    if (mSegment->mOverflow != 0)
+    {
+        throw std::runtime_error(
+            "remote SUT made more observations than fit in its segment");
+    }
+    uint8_t const* p = mSegment->mObservations;
+    uint8_t const* end =
+        p + std::min<uint64_t>(mSegment->mObservationsLen,
+                               RemoteSegment::ObservationsSize);
+    while (p != end)
+    {
+        auto kind = static_cast<RemoteRecord>(*p++);
+        if (kind == RemoteRecord::Reject)
+        {
+            throw RejectPlan();
+        }
+        Value name, seen;
+        Symbol var;
+        decodeValue(p, end, name);
+        decodeValue(p, end, seen);
+        if (!name.match(var))
+        {
+            throw std::runtime_error("malformed remote observation");
+        }
+        switch (kind)
+        {
+        case RemoteRecord::Check:
+            check(var, seen);
+            break;
+        case RemoteRecord::Track:
+            track(var, seen);
+            break;
+        case RemoteRecord::Trace:
+            trace(var, seen);
+            break;
+        case RemoteRecord::Invariant:
+        {
+            Value got;
+            decodeValue(p, end, got);
+            invariant(var, seen, got);
+            break;
+        }
+        default:
+            throw std::runtime_error("unknown remote observation kind");
+        }
+    }
+}
+
+void
+RemoteTest::run()
+{
+    std::vector<Value> params;
+    for (auto const& pair : currentPlan().getParams())
+    {
+        params.emplace_back(std::vector<Value>{Value(pair.first), pair.second});
+    }
+    mBuffer.clear();
+    encodeValue(Value(params), mBuffer);
+    if (mBuffer.size() > RemoteSegment::PlanSize)
+    {
+        throw std::runtime_error("plan is too large to send to remote SUT");
+    }
+    std::memcpy(mSegment->mPlan, mBuffer.data(), mBuffer.size());
+    mSegment->mPlanLen = mBuffer.size();
+    mSegment->mObservationsLen = 0;
+    mSegment->mOverflow = 0;
+
+    int status = 0;
+    std::string how;
+    if (!runChild(status))
+    {
+        how = "timeout";
+    }
+    else if (WIFSIGNALED(status))
+    {
+        how = "signal " + std::to_string(WTERMSIG(status));
+    }
+    else if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    {
+        how = "exit " + std::to_string(WEXITSTATUS(status));
+    }
+    replayObservations();
+    if (!how.empty())
+    {
+        track(EXIT, how);
+        mFailed = true;
+        if (!mShrinking)
+        {
+            handleRemoteFailure(currentPlan(), how);
+        }
+    }
+}
+
+void
+RemoteTest::handleRemoteFailure(Plan const& plan, std::string const& how)
+{
+    if (mVerboseLevel > 0)
+    {
+        std::cout << "remote SUT failed in test " << plan.getTestName() << " "
+                  << std::hex << plan.getHashCode() << std::dec << std::endl;
+        std::cout << "  parameters:" << std::endl << plan << std::endl;
+        std::cout << "  outcome: " << how << std::endl;
+    }
+}
+
+} // namespace photesthesis
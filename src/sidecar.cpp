@@ -0,0 +1,146 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <photesthesis/sidecar.h>
+#include <photesthesis/util.h>
+#include <stdexcept>
+#include <string>
+
+namespace photesthesis
+{
+
+Sidecar::Sidecar(std::string const& path) : mPath(path)
+{
+    if (mPath.empty())
+    {
+        return;
+    }
+    std::ifstream in(mPath);
+    if (!in.good())
+    {
+        return;
+    }
+    in.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    try
+    {
+        scanWhitespace(in);
+        while (in.good())
+        {
+            std::string HASHES, SIDECAR, HASH;
+            TestName tname("");
+            in >> HASHES >> SIDECAR >> tname >> HASH;
+            expectStr(in, "####", HASHES);
+            expectStr(in, "sidecar:", SIDECAR);
+            expectNonemptyStr(in, tname.getString());
+            PlanHash hash = std::strtoull(HASH.c_str(), nullptr, 0);
+            if (hash == ULLONG_MAX)
+            {
+                throw std::runtime_error("unexpected hash value: " + HASH);
+            }
+            auto& record = mRecords[std::make_pair(tname, hash)];
+            scanWhitespace(in);
+            while (in.good() && in.peek() != '#')
+            {
+                Symbol key("");
+                std::string EQ;
+                Value val;
+                in >> key >> EQ >> val;
+                expectNonemptyStr(in, key.getString());
+                expectStr(in, "=", EQ);
+                record[key] = val;
+                scanWhitespace(in);
+            }
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::string msg("error parsing sidecar file '");
+        msg += mPath;
+        msg += "': ";
+        msg += std::string(e.what());
+        throw std::runtime_error(msg);
+    }
+}
+
+void
+Sidecar::save()
+{
+    if (!mDirty || mPath.empty())
+    {
+        return;
+    }
+    std::ofstream out(mPath, std::ios::out | std::ios::trunc);
+    for (auto const& pair : mRecords)
+    {
+        out << "#### sidecar: " << pair.first.first << " 0x" << std::hex
+            << pair.first.second << std::dec << std::endl;
+        for (auto const& kv : pair.second)
+        {
+            out << kv.first << " = " << kv.second << std::endl;
+        }
+        out << std::endl;
+    }
+    mDirty = false;
+}
+
+std::string const&
+Sidecar::getPath() const
+{
+    return mPath;
+}
+
+bool
+Sidecar::has(TestName tname, PlanHash hash, Symbol key) const
+{
+    auto i = mRecords.find(std::make_pair(tname, hash));
+    return i != mRecords.end() && i->second.find(key) != i->second.end();
+}
+
+Value
+Sidecar::get(TestName tname, PlanHash hash, Symbol key) const
+{
+    auto i = mRecords.find(std::make_pair(tname, hash));
+    if (i != mRecords.end())
+    {
+        auto j = i->second.find(key);
+        if (j != i->second.end())
+        {
+            return j->second;
+        }
+    }
+    throw std::runtime_error(std::string("no sidecar value for ") +
+                             key.getString());
+}
+
+void
+Sidecar::set(TestName tname, PlanHash hash, Symbol key, Value val)
+{
+    auto& slot = mRecords[std::make_pair(tname, hash)][key];
+    if (slot != val)
+    {
+        slot = val;
+        mDirty = true;
+    }
+}
+
+void
+Sidecar::erase(TestName tname, PlanHash hash)
+{
+    if (mRecords.erase(std::make_pair(tname, hash)) != 0)
+    {
+        mDirty = true;
+    }
+}
+
+std::map<SidecarKey, SidecarRecord> const&
+Sidecar::getRecords() const
+{
+    return mRecords;
+}
+
+} // namespace photesthesis
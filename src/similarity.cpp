@@ -0,0 +1,161 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <cstring>
+#include <limits>
+#include <photesthesis/similarity.h>
+
+namespace
+{
+constexpr uint32_t Empty = std::numeric_limits<uint32_t>::max();
+
+// The murmur3 finalizer: a cheap bijective mix, so distinct edges never
+// share a hash.
+inline uint64_t
+mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+    return x;
+}
+} // namespace
+
+namespace photesthesis
+{
+
+EdgeSignature::EdgeSignature(uint8_t const* counters, size_t len)
+{
+    mMins.fill(Empty);
+    size_t i = 0;
+    while (i < len)
+    {
+        // Most counters are zero, so skip them a word at a time.
+        if (i + 8 <= len)
+        {
+            uint64_t word;
+            std::memcpy(&word, counters + i, sizeof(word));
+            if (word == 0)
+            {
+                i += 8;
+                continue;
+            }
+        }
+        size_t end = (i + 8 <= len) ? i + 8 : len;
+        for (; i < end; ++i)
+        {
+            if (counters[i] != 0)
+            {
+                uint64_t h = mix((static_cast<uint64_t>(i) << 8) | counters[i]);
+                size_t bin = h >> 58;
+                uint32_t v = static_cast<uint32_t>(h);
+                if (v < mMins[bin])
+                {
+                    mMins[bin] = v;
+                }
+                mEmpty = false;
+            }
+        }
+    }
+    if (mEmpty)
+    {
+        return;
+    }
+    // Fill each empty bin from the next nonempty one, offset by the distance
+    // so that a filled bin only matches a bin filled from the same place.
+    std::array<uint32_t, Bins> filled = mMins;
+    for (size_t b = 0; b < Bins; ++b)
+    {
+        if (mMins[b] != Empty)
+        {
+            continue;
+        }
+        size_t d = 1;
+        while (mMins[(b + d) % Bins] == Empty)
+        {
+            ++d;
+        }
+        filled[b] = mMins[(b + d) % Bins] + static_cast<uint32_t>(d) *
+                                                0x9E3779B1;
+    }
+    mMins = filled;
+}
+
+double
+EdgeSignature::similarity(EdgeSignature const& other) const
+{
+    if (mEmpty || other.mEmpty)
+    {
+        return (mEmpty && other.mEmpty) ? 1.0 : 0.0;
+    }
+    size_t same = 0;
+    for (size_t b = 0; b < Bins; ++b)
+    {
+        same += (mMins[b] == other.mMins[b]);
+    }
+    return static_cast<double>(same) / Bins;
+}
+
+uint64_t
+NearDuplicateIndex::bandKey(EdgeSignature const& sig, Trajectory userTraj,
+                            size_t band)
+{
+    uint64_t key = mix(userTraj ^ band);
+    for (size_t r = 0; r < Rows; ++r)
+    {
+        key = mix(key ^ sig.mMins[band * Rows + r]);
+    }
+    return key;
+}
+
+void
+NearDuplicateIndex::clear()
+{
+    mEntries.clear();
+    mBuckets.clear();
+}
+
+void
+NearDuplicateIndex::insert(EdgeSignature const& sig, Trajectory userTraj)
+{
+    size_t idx = mEntries.size();
+    mEntries.emplace_back(Entry{sig, userTraj});
+    for (size_t band = 0; band < Bands; ++band)
+    {
+        mBuckets[bandKey(sig, userTraj, band)].emplace_back(idx);
+    }
+}
+
+double
+NearDuplicateIndex::findSimilar(EdgeSignature const& sig, Trajectory userTraj,
+                                double threshold) const
+{
+    double best = 0.0;
+    for (size_t band = 0; band < Bands; ++band)
+    {
+        auto i = mBuckets.find(bandKey(sig, userTraj, band));
+        if (i == mBuckets.end())
+        {
+            continue;
+        }
+        for (size_t idx : i->second)
+        {
+            Entry const& e = mEntries[idx];
+            if (e.mUserTrajectory != userTraj)
+            {
+                continue;
+            }
+            double s = sig.similarity(e.mSignature);
+            if (s >= threshold && s > best)
+            {
+                best = s;
+            }
+        }
+    }
+    return best;
+}
+
+} // namespace photesthesis
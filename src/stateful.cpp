@@ -0,0 +1,264 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <cstdlib>
+#include <cstring>
+#include <photesthesis/coverage.h>
+#include <photesthesis/env.h>
+#include <photesthesis/stateful.h>
+#include <photesthesis/util.h>
+
+namespace photesthesis
+{
+
+StatefulTest::StatefulTest(Grammar const& gram, Corpus& corp,
+                           TestName testName, ParamName sequenceParam,
+                           RuleName sequenceRule)
+    : Test(gram, corp, testName, {{{sequenceParam, sequenceRule}}})
+    , mSequenceParam(sequenceParam)
+{
+    getEnvNum("PHOTESTHESIS_STATEFUL_SNAPSHOTS", mMaxSnapshots);
+    getEnvNum("PHOTESTHESIS_STATEFUL_SNAPSHOT_BYTES", mMaxSnapshotBytes);
+}
+
+void
+StatefulTest::reset()
+{
+}
+
+std::any
+StatefulTest::snapshot()
+{
+    return {};
+}
+
+void
+StatefulTest::restore(std::any const& snapshot)
+{
+}
+
+void
+StatefulTest::commands(Value sequence, std::vector<Value>& out) const
+{
+    while (true)
+    {
+        Symbol head = headSymbol(sequence);
+        auto elts = listElements(sequence);
+        Value next;
+        for (size_t i = 1; i < elts.size(); ++i)
+        {
+            Value const& elt = elts[i];
+            if (!elt.isPair())
+            {
+                continue;
+            }
+            if (i + 1 == elts.size() && headSymbol(elt) == head)
+            {
+                next = elt;
+                break;
+            }
+            out.emplace_back(elt);
+        }
+        if (next.isNil())
+        {
+            return;
+        }
+        sequence = next;
+    }
+}
+
+void
+StatefulTest::setMaxSnapshots(uint64_t maxSnapshots)
+{
+    mMaxSnapshots = maxSnapshots;
+}
+
+void
+StatefulTest::setMaxSnapshotBytes(uint64_t maxSnapshotBytes)
+{
+    mMaxSnapshotBytes = maxSnapshotBytes;
+}
+
+uint64_t
+StatefulTest::getStepsApplied() const
+{
+    return mStepsApplied;
+}
+
+uint64_t
+StatefulTest::getStepsReused() const
+{
+    return mStepsReused;
+}
+
+bool
+StatefulTest::saveState(PrefixState& state)
+{
+    // Take the counters first and put them back afterwards, so that any
+    // instrumented code run by the client's `snapshot` does not count.
+    size_t covLen = getCoverageCountersSize();
+    uint8_t* counters = getCoverageCounters();
+    for (size_t i = 0; i < covLen; ++i)
+    {
+        if (counters[i] != mPrefixCounters[i])
+        {
+            state.mCounterDelta.emplace_back(static_cast<uint32_t>(i),
+                                             counters[i]);
+            mPrefixCounters[i] = counters[i];
+        }
+    }
+    state.mSnapshot = snapshot();
+    if (!state.mSnapshot.has_value())
+    {
+        mSnapshotsSupported = false;
+        return false;
+    }
+    if (covLen != 0)
+    {
+        std::memcpy(counters, mPrefixCounters.data(), covLen);
+    }
+    state.mHasher = mUserTrajHasher;
+    state.mObservations.assign(mObservations.begin() + mPrefixObservations,
+                               mObservations.begin() + mNumObservations);
+    mPrefixObservations = mNumObservations;
+    state.mFailed = mFailed;
+    ++mNumSnapshots;
+    mSnapshotBytes +=
+        sizeof(PrefixNode) + sizeof(PrefixState) +
+        state.mCounterDelta.size() * sizeof(state.mCounterDelta[0]) +
+        state.mObservations.size() * sizeof(Observation);
+    return true;
+}
+
+// Restore the state after the first `depth` commands, by restoring the
+// client's snapshot from the deepest state and applying the counter and
+// observation deltas of every state on the way to it.
+void
+StatefulTest::restoreStates(size_t depth)
+{
+    PrefixState const& last = *mPath[depth - 1]->mState;
+    restore(last.mSnapshot);
+    size_t covLen = getCoverageCountersSize();
+    uint8_t* counters = getCoverageCounters();
+    size_t n = 0;
+    for (size_t d = 0; d < depth; ++d)
+    {
+        PrefixState const& state = *mPath[d]->mState;
+        for (auto const& pair : state.mCounterDelta)
+        {
+            if (pair.first < covLen)
+            {
+                counters[pair.first] = pair.second;
+                mPrefixCounters[pair.first] = pair.second;
+            }
+        }
+        n += state.mObservations.size();
+    }
+    mUserTrajHasher = last.mHasher;
+    mFailed = mFailed || last.mFailed;
+    if (mObservations.size() < n)
+    {
+        mObservations.resize(n);
+    }
+    size_t i = 0;
+    for (size_t d = 0; d < depth; ++d)
+    {
+        for (auto const& obs : mPath[d]->mState->mObservations)
+        {
+            mObservations[i] = obs;
+            // Restored observations are checked online like fresh ones.
+            mNumObservations = ++i;
+            checkOnline();
+        }
+    }
+    mNumObservations = n;
+    mPrefixObservations = n;
+}
+
+void
+StatefulTest::run()
+{
+    Plan const& plan = currentPlan();
+    mCommands.clear();
+    commands(plan.getParam(mSequenceParam), mCommands);
+
+    // Prefix sharing needs client snapshots, and plans whose only parameter
+    // is the command sequence. Replays always run every command so that they
+    // time the real work, and so do stability checks, which would otherwise
+    // only compare a restored state with itself.
+    bool sharing = mSnapshotsSupported && mMaxSnapshots != 0 &&
+                   mMaxSnapshotBytes != 0 && !mReplaying && !mStabilizing &&
+                   plan.getParams().size() == 1;
+    if (sharing &&
+        (mNumSnapshots >= mMaxSnapshots || mSnapshotBytes >= mMaxSnapshotBytes))
+    {
+        mRoot.mChildren.clear();
+        mNumSnapshots = 0;
+        mSnapshotBytes = 0;
+    }
+
+    // The counters were cleared when the run's trajectory was initialized.
+    PrefixNode* node = &mRoot;
+    size_t start = 0;
+    if (sharing)
+    {
+        mPrefixCounters.assign(getCoverageCountersSize(), 0);
+        mPrefixObservations = 0;
+        mPath.clear();
+        PrefixNode* cur = &mRoot;
+        for (size_t i = 0; i < mCommands.size(); ++i)
+        {
+            auto child = cur->mChildren.find(mCommands[i]);
+            if (child == cur->mChildren.end() || !child->second->mState)
+            {
+                break;
+            }
+            cur = child->second.get();
+            mPath.emplace_back(cur);
+        }
+        start = mPath.size();
+        if (start != 0)
+        {
+            restoreStates(start);
+            node = mPath.back();
+            mStepsReused += start;
+        }
+    }
+    if (start == 0)
+    {
+        reset();
+    }
+
+    for (size_t i = start; i < mCommands.size(); ++i)
+    {
+        apply(mCommands[i]);
+        ++mStepsApplied;
+        // States are only saved under the memory budget; past it the rest
+        // of this plan runs unshared, and the tree is rebuilt next run.
+        if (sharing && mSnapshotsSupported &&
+            mSnapshotBytes < mMaxSnapshotBytes)
+        {
+            auto& child = node->mChildren[mCommands[i]];
+            if (!child)
+            {
+                child = std::make_unique<PrefixNode>();
+            }
+            node = child.get();
+            if (!node->mState)
+            {
+                node->mState = std::make_unique<PrefixState>();
+                if (!saveState(*node->mState))
+                {
+                    node->mState.reset();
+                }
+            }
+        }
+        else
+        {
+            sharing = false;
+        }
+    }
+}
+
+} // namespace photesthesis
@@ -0,0 +1,291 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <photesthesis/static_grammar.h>
+#include <stdexcept>
+#include <string>
+
+namespace photesthesis
+{
+
+namespace
+{
+std::vector<ParamName>
+internNames(StaticNames const& names)
+{
+    std::vector<ParamName> out;
+    for (size_t i = 0; i < names.mCount; ++i)
+    {
+        out.emplace_back(std::string(names.mNames[i]));
+    }
+    return out;
+}
+
+Value
+literalValue(StaticAtom const& atom)
+{
+    switch (atom.mKind)
+    {
+    case StaticAtom::Kind::Sym:
+        return Value(Symbol(std::string(atom.mText)));
+    case StaticAtom::Kind::Bool:
+        return Value::Bool(atom.mInt64 != 0);
+    case StaticAtom::Kind::Int64:
+        return Value::Int64(atom.mInt64);
+    case StaticAtom::Kind::Str:
+        return Value(std::string(atom.mText));
+    case StaticAtom::Kind::Ref:
+        break;
+    }
+    return Value();
+}
+
+// Productions are immutable, so guards are added by rebuilding.
+Production
+withGuards(Production prod, std::vector<ParamName> const& req,
+           std::vector<ParamName> const& reqNot, size_t i)
+{
+    if (i < req.size())
+    {
+        return withGuards(inContext(req[i], prod), req, reqNot, i + 1);
+    }
+    if (i < req.size() + reqNot.size())
+    {
+        return withGuards(notInContext(reqNot[i - req.size()], prod), req,
+                          reqNot, i + 1);
+    }
+    return prod;
+}
+}
+
+#pragma region // StaticGrammarView
+
+Grammar
+StaticGrammarView::toGrammar() const
+{
+    Grammar g;
+    for (size_t r = 0; r < mNumRules; ++r)
+    {
+        StaticRuleEntry const& rule = mRules[r];
+        std::vector<Production> prods;
+        for (size_t p = 0; p < rule.mNumProductions; ++p)
+        {
+            StaticProductionEntry const& entry =
+                mProductions[rule.mFirstProduction + p];
+            std::vector<AtomPtr> atoms;
+            for (size_t a = 0; a < entry.mNumAtoms; ++a)
+            {
+                StaticAtom const& atom = mAtoms[entry.mFirstAtom + a];
+                if (atom.mKind == StaticAtom::Kind::Ref)
+                {
+                    RefPtr ref = g.Ref(RuleName(std::string(atom.mText)));
+                    for (auto const& ctx : internNames(atom.mCtxExt))
+                    {
+                        ref = addContext(ctx, ref);
+                    }
+                    atoms.emplace_back(ref);
+                }
+                else
+                {
+                    atoms.emplace_back(
+                        std::make_shared<const Lit>(literalValue(atom)));
+                }
+            }
+            prods.emplace_back(withGuards(Production(std::move(atoms)),
+                                          internNames(entry.mCtxReq),
+                                          internNames(entry.mCtxReqNot), 0));
+        }
+        g.addRule(RuleName(std::string(rule.mName)), std::move(prods));
+    }
+    return g;
+}
+
+#pragma endregion // StaticGrammarView
+
+#pragma region // StaticGenerator
+
+StaticGenerator::StaticGenerator(StaticGrammarView grammar) : mGrammar(grammar)
+{
+    for (size_t r = 0; r < mGrammar.mNumRules; ++r)
+    {
+        mRuleNames.emplace_back(std::string(mGrammar.mRules[r].mName));
+        mRuleHeads.emplace_back(mRuleNames.back());
+    }
+    size_t numProds = 0;
+    size_t numAtoms = 0;
+    if (mGrammar.mNumRules != 0)
+    {
+        StaticRuleEntry const& last = mGrammar.mRules[mGrammar.mNumRules - 1];
+        numProds = last.mFirstProduction + last.mNumProductions;
+    }
+    if (numProds != 0)
+    {
+        StaticProductionEntry const& last = mGrammar.mProductions[numProds - 1];
+        numAtoms = last.mFirstAtom + last.mNumAtoms;
+    }
+    for (size_t p = 0; p < numProds; ++p)
+    {
+        mProdCtxReq.emplace_back(internNames(mGrammar.mProductions[p].mCtxReq));
+        mProdCtxReqNot.emplace_back(
+            internNames(mGrammar.mProductions[p].mCtxReqNot));
+    }
+    for (size_t a = 0; a < numAtoms; ++a)
+    {
+        mLiterals.emplace_back(literalValue(mGrammar.mAtoms[a]));
+        mAtomCtxExt.emplace_back(internNames(mGrammar.mAtoms[a].mCtxExt));
+    }
+}
+
+size_t
+StaticGenerator::ruleIndex(RuleName rule) const
+{
+    for (size_t r = 0; r < mRuleNames.size(); ++r)
+    {
+        if (mRuleNames[r] == rule)
+        {
+            return r;
+        }
+    }
+    throw std::runtime_error(std::string("rule not found: ") +
+                             rule.getString());
+}
+
+bool
+StaticGenerator::isActive(size_t prod, Context const& ctx) const
+{
+    for (auto const& p : mProdCtxReq[prod])
+    {
+        if (!ctx.has(p))
+        {
+            return false;
+        }
+    }
+    for (auto const& p : mProdCtxReqNot[prod])
+    {
+        if (ctx.has(p))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Mirrors Grammar::getActiveProductions and Grammar::randomValueFromRule,
+// choosing among the same active productions in the same order.
+Value
+StaticGenerator::randomValueFromRule(size_t rule, Chooser& chooser,
+                                     size_t depthLimit, Context& ctx) const
+{
+    if (depthLimit == 0)
+    {
+        throw std::runtime_error("depth limit reached zero");
+    }
+
+    // Count the active productions, choose one, then find it again; this
+    // keeps the choice the same as Grammar's without collecting them.
+    StaticRuleEntry const& entry = mGrammar.mRules[rule];
+    size_t numActive = 0;
+    bool skippedDueToRefs = false;
+    for (size_t i = 0; i < entry.mNumProductions; ++i)
+    {
+        size_t p = entry.mFirstProduction + i;
+        if (depthLimit == 1 && mGrammar.mProductions[p].mHasRefs)
+        {
+            skippedDueToRefs = true;
+        }
+        else if (isActive(p, ctx))
+        {
+            ++numActive;
+        }
+    }
+    if (numActive == 0)
+    {
+        if (skippedDueToRefs)
+        {
+            throw std::runtime_error(
+                std::string("rule for ") + mRuleNames[rule].getString() +
+                std::string(" needs at least one nonterminal production"));
+        }
+        throw std::runtime_error(std::string("no active productions found for ") +
+                                 mRuleNames[rule].getString());
+    }
+
+    size_t choice = chooser.choose(numActive);
+    size_t chosen = entry.mFirstProduction;
+    for (;; ++chosen)
+    {
+        if ((depthLimit != 1 || !mGrammar.mProductions[chosen].mHasRefs) &&
+            isActive(chosen, ctx))
+        {
+            if (choice == 0)
+            {
+                break;
+            }
+            --choice;
+        }
+    }
+    StaticProductionEntry const& prod = mGrammar.mProductions[chosen];
+    std::vector<Value> vals{mRuleHeads[rule]};
+    vals.reserve(prod.mNumAtoms + 1);
+    for (size_t i = 0; i < prod.mNumAtoms; ++i)
+    {
+        size_t a = prod.mFirstAtom + i;
+        StaticAtom const& atom = mGrammar.mAtoms[a];
+        if (atom.mKind == StaticAtom::Kind::Ref)
+        {
+            for (auto const& p : mAtomCtxExt[a])
+            {
+                ctx.push(p);
+            }
+            vals.emplace_back(randomValueFromRule(
+                static_cast<size_t>(atom.mInt64), chooser, depthLimit - 1,
+                ctx));
+            ctx.pop(mAtomCtxExt[a].size());
+        }
+        else
+        {
+            vals.emplace_back(mLiterals[a]);
+        }
+    }
+    return Value(vals);
+}
+
+Plan
+StaticGenerator::populatePlanFromChoices(TestName tname,
+                                         ParamSpecs const& params,
+                                         Chooser& chooser,
+                                         size_t depthLimit) const
+{
+    Plan p(tname);
+    for (auto const& pair : params)
+    {
+        Context ctx(params);
+        Value v = randomValueFromRule(ruleIndex(pair.second), chooser,
+                                      depthLimit, ctx);
+        p.addParam(pair.first, v);
+    }
+    return p;
+}
+
+Plan
+StaticGenerator::randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
+                                      RandomEngine& gen,
+                                      size_t depthLimit) const
+{
+    RandomChooser chooser(gen);
+    return populatePlanFromChoices(tname, params, chooser, depthLimit);
+}
+
+Plan
+StaticGenerator::randomlyPopulatePlan(TestName tname, ParamSpecs const& params,
+                                      RandomEngine& gen, size_t depthLimit,
+                                      std::vector<uint8_t>& choices) const
+{
+    RandomChooser chooser(gen, &choices);
+    return populatePlanFromChoices(tname, params, chooser, depthLimit);
+}
+
+#pragma endregion // StaticGenerator
+
+} // namespace photesthesis
@@ -0,0 +1,124 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <photesthesis/status.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+photesthesis::StatusPage*
+openStatusPage()
+{
+    char const* name = std::getenv("PHOTESTHESIS_STATUS");
+    if (!name || !*name)
+    {
+        return nullptr;
+    }
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "photesthesis: unable to open status segment " << name
+                  << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    size_t sz = sizeof(photesthesis::StatusPage);
+    void* mem = MAP_FAILED;
+    if (ftruncate(fd, sz) == 0)
+    {
+        mem = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        std::cerr << "photesthesis: unable to map status segment " << name
+                  << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    // Clear any state left by a previous run before publishing the magic
+    // number, so readers never see a valid header on stale counters.
+    std::memset(mem, 0, sz);
+    auto page = new (mem) photesthesis::StatusPage();
+    uint64_t now = photesthesis::statusNow();
+    page->mVersion = photesthesis::StatusPage::Version;
+    page->mPid = static_cast<uint64_t>(getpid());
+    page->mStartTime.store(now, std::memory_order_relaxed);
+    page->mUpdateTime.store(now, std::memory_order_relaxed);
+    page->mRateTime.store(now, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    page->mMagic = photesthesis::StatusPage::Magic;
+    return page;
+}
+} // namespace
+
+namespace photesthesis
+{
+
+StatusPage*
+getStatusPage()
+{
+    static StatusPage* sPage = openStatusPage();
+    return sPage;
+}
+
+StatusPage const*
+mapStatusPage(std::string const& name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 &&
+        static_cast<size_t>(st.st_size) >= sizeof(StatusPage))
+    {
+        mem = mmap(nullptr, sizeof(StatusPage), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    auto page = static_cast<StatusPage const*>(mem);
+    if (page->mMagic != StatusPage::Magic ||
+        page->mVersion < StatusPage::Version)
+    {
+        munmap(mem, sizeof(StatusPage));
+        return nullptr;
+    }
+    return page;
+}
+
+void
+unmapStatusPage(StatusPage const* page)
+{
+    munmap(const_cast<StatusPage*>(page), sizeof(StatusPage));
+}
+
+uint64_t
+statusNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void
+setStatusPhase(StatusPage& page, StatusPhase phase, char const* testName)
+{
+    std::strncpy(page.mTestName, testName, StatusPage::TestNameSize - 1);
+    page.mPhase.store(static_cast<uint64_t>(phase), std::memory_order_relaxed);
+    page.mUpdateTime.store(statusNow(), std::memory_order_relaxed);
+}
+
+} // namespace photesthesis
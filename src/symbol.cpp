@@ -9,12 +9,29 @@ namespace
 {
 struct DerefLess
 {
+    using is_transparent = void;
+    using Interned = photesthesis::Symbol::Interned;
+
     bool
-    operator()(std::shared_ptr<std::string> const& x,
-               std::shared_ptr<std::string> const& y) const
+    operator()(std::shared_ptr<const Interned> const& x,
+               std::shared_ptr<const Interned> const& y) const
     {
         assert(x && y);
-        return *x < *y;
+        return x->mString < y->mString;
+    }
+    bool
+    operator()(std::shared_ptr<const Interned> const& x,
+               std::string const& y) const
+    {
+        assert(x);
+        return x->mString < y;
+    }
+    bool
+    operator()(std::string const& x,
+               std::shared_ptr<const Interned> const& y) const
+    {
+        assert(y);
+        return x < y->mString;
     }
 };
 } // namespace
@@ -22,12 +39,12 @@ struct DerefLess
 namespace photesthesis
 {
 
-std::shared_ptr<std::string>
+std::shared_ptr<const Symbol::Interned>
 Symbol::intern(std::string const& s)
 {
 
     static std::mutex sLock;
-    static std::set<std::shared_ptr<std::string>, DerefLess> sInternTable;
+    static std::set<std::shared_ptr<const Interned>, DerefLess> sInternTable;
 
     for (auto const& c : s)
     {
@@ -37,10 +54,16 @@ Symbol::intern(std::string const& s)
                 "Symbol must be alphanumeric-or-underscores");
         }
     }
-    auto p = std::make_shared<std::string>(s);
     std::lock_guard<std::mutex> guard(sLock);
-    auto pair = sInternTable.emplace(p);
-    return *pair.first;
+    auto i = sInternTable.find(s);
+    if (i != sInternTable.end())
+    {
+        return *i;
+    }
+    auto id = static_cast<uint32_t>(sInternTable.size());
+    auto interned = std::make_shared<const Interned>(Interned{s, id});
+    sInternTable.emplace(interned);
+    return interned;
 }
 
 Symbol::Symbol(std::string const& s) : mInterned(intern(s))
@@ -57,13 +80,13 @@ bool
 Symbol::operator<(Symbol const& other) const
 {
     assert(mInterned && other.mInterned);
-    return *mInterned < *other.mInterned;
+    return mInterned->mString < other.mInterned->mString;
 };
 
 std::ostream&
 operator<<(std::ostream& os, const Symbol& sym)
 {
-    return os << *sym.mInterned;
+    return os << sym.mInterned->mString;
 }
 
 std::istream&
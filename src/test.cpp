@@ -2,88 +2,77 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <photesthesis/3rdparty/xxhash64.h>
 #include <photesthesis/corpus.h>
+#include <photesthesis/coverage.h>
+#include <photesthesis/env.h>
 #include <photesthesis/grammar.h>
+#include <photesthesis/sidecar.h>
 #include <photesthesis/test.h>
 #include <photesthesis/util.h>
 #include <random>
 #include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace
 {
-uint8_t* gCov8BitStart{nullptr};
-size_t gCov8BitLen{0};
-
-bool
-getEnvNum(char const* evar, uint64_t& num)
+// Sets a flag for as long as it lives, clearing it however the scope is left.
+class FlagGuard
 {
-    if (auto* p = std::getenv(evar))
+    bool& mFlag;
+
+  public:
+    FlagGuard(bool& flag) : mFlag(flag)
     {
-        num = std::strtoull(p, nullptr, 0);
-        return true;
+        mFlag = true;
     }
-    return false;
-}
-
-bool
-getEnvExpansionSteps(uint64_t& expansionSteps)
-{
-    return getEnvNum("PHOTESTHESIS_EXPANSION_STEPS", expansionSteps);
-}
-
-bool
-getEnvKPathLength(uint64_t& kPathLen)
-{
-    return getEnvNum("PHOTESTHESIS_KPATH_LENGTH", kPathLen);
-}
-
-bool
-getEnvRandomDepth(uint64_t& randomDepth)
-{
-    return getEnvNum("PHOTESTHESIS_RANDOM_DEPTH", randomDepth);
-}
-
-bool
-getEnvVerbose(uint64_t& verbose)
-{
-    return getEnvNum("PHOTESTHESIS_VERBOSE", verbose);
-}
-
-bool
-getEnvTestHash(uint64_t& testHash)
-{
-    return getEnvNum("PHOTESTHESIS_TEST_HASH", testHash);
-}
-
-bool
-getEnvRandomSeed(uint64_t& seed)
-{
-    return getEnvNum("PHOTESTHESIS_RANDOM_SEED", seed);
-}
+    ~FlagGuard()
+    {
+        mFlag = false;
+    }
+};
 
+// Whether `transcripts` already holds a transcript of `ts`'s plan with the
+// same observations, ignoring the values of measurements, which differ on
+// every run.
 bool
-getStabilityRetries(uint64_t& retries)
-{
-    return getEnvNum("PHOTESTHESIS_STABILITY_RETRIES", retries);
-}
-
-} // namespace
-
-extern "C"
+hasSameTranscript(std::set<photesthesis::Transcript> const& transcripts,
+                  photesthesis::Transcript const& ts)
 {
-    __attribute__((visibility("default"))) void
-    __sanitizer_cov_8bit_counters_init(uint8_t* Start, uint8_t* Stop)
+    using namespace photesthesis;
+    auto same = [](TranscriptVar const& a, TranscriptVar const& b) {
+        if (std::get<2>(a) == VarKind::Measured &&
+            std::get<2>(b) == VarKind::Measured)
+        {
+            return std::get<0>(a) == std::get<0>(b);
+        }
+        return a == b;
+    };
+    TranscriptVars const& vars = ts.getVars();
+    for (auto i = transcripts.lower_bound(Transcript(ts.getPlan()));
+         i != transcripts.end() && i->getPlan() == ts.getPlan(); ++i)
     {
-        gCov8BitStart = Start;
-        gCov8BitLen = Stop - Start;
+        TranscriptVars const& other = i->getVars();
+        if (std::equal(vars.begin(), vars.end(), other.begin(), other.end(),
+                       same))
+        {
+            return true;
+        }
     }
+    return false;
 }
 
+} // namespace
+
 namespace photesthesis
 {
 
@@ -100,25 +89,59 @@ static const uint8_t CounterClasses[256] = {
 #undef ROW8
 };
 
+// Symbols used as keys in the `coverage` and `impact` sidecars.
+static const Symbol EDGES("edges");
+static const Symbol FUNCTIONS("functions");
+static const Symbol FINGERPRINTS("fingerprints");
+static const Symbol INCREMENTAL_CHECKS("incremental_checks");
+static const Symbol RUNTIME("runtime");
+static const Symbol LAST_FAILURE("last_failure");
+static const Symbol CHOICES("choices");
+
 void
 Test::initUserTrajectory()
 {
     mUserTrajectory = 0;
-    mUserTrajHasher = XXHash64(0);
+    mUserTrajHasher = TrajectoryHasher(0);
+    // Drop anything submitted by a run that ended early (by rejecting its
+    // plan, say) without being merged.
+    takeSubmittedTasks();
 }
 
 void
 Test::initPathTrajectory()
 {
     mPathTrajectory = 0;
-    if (gCov8BitLen != 0)
+    size_t localLen = getCoverageCountersSize();
+    size_t covLen = pathCountersSize();
+    if (localLen != 0)
+    {
+        std::memset(getCoverageCounters(), 0, localLen);
+    }
+    if (mSharedCountersSize != 0)
+    {
+        std::memset(mSharedCounters, 0, mSharedCountersSize);
+    }
+    if (covLen != 0 && mPathTrajCounters.size() != covLen)
     {
-        std::memset(gCov8BitStart, 0, gCov8BitLen);
-        mPathTrajCounters.clear();
-        mPathTrajCounters.resize(gCov8BitLen, 0);
+        mPathTrajCounters.assign(covLen, 0);
     }
 }
 
+// The path counters are this process's coverage counters followed by the
+// shared counters other processes add theirs into, if enabled.
+size_t
+Test::pathCountersSize() const
+{
+    return getCoverageCountersSize() + mSharedCountersSize;
+}
+
+EdgeSignature
+Test::edgeSignature() const
+{
+    return EdgeSignature(mPathTrajCounters.data(), mPathTrajCounters.size());
+}
+
 void
 Test::initTrajectory()
 {
@@ -129,31 +152,39 @@ Test::initTrajectory()
 void
 Test::finiPathTrajectory()
 {
-    if (gCov8BitLen != 0)
+    size_t localLen = getCoverageCountersSize();
+    size_t covLen = pathCountersSize();
+    assert(covLen == 0 || covLen == mPathTrajCounters.size());
+    if (localLen != 0)
+    {
+        std::memcpy(mPathTrajCounters.data(), getCoverageCounters(),
+                    localLen);
+    }
+    if (mSharedCountersSize != 0)
     {
-        assert(gCov8BitLen == mPathTrajCounters.size());
-        std::memcpy(mPathTrajCounters.data(), gCov8BitStart, gCov8BitLen);
+        std::memcpy(mPathTrajCounters.data() + localLen, mSharedCounters,
+                    mSharedCountersSize);
     }
     if (mPathTrajStabilityMask.empty())
     {
-        for (size_t i = 0; i < gCov8BitLen; ++i)
+        for (size_t i = 0; i < covLen; ++i)
         {
             mPathTrajCounters[i] = CounterClasses[mPathTrajCounters[i]];
         }
     }
     else
     {
-        assert(mPathTrajStabilityMask.size() == gCov8BitLen);
-        for (size_t i = 0; i < gCov8BitLen; ++i)
+        assert(mPathTrajStabilityMask.size() == covLen);
+        for (size_t i = 0; i < covLen; ++i)
         {
             mPathTrajCounters[i] = CounterClasses[mPathTrajCounters[i]] &
                                    mPathTrajStabilityMask[i];
         }
     }
-    if (gCov8BitLen != 0)
+    if (covLen != 0)
     {
-        mPathTrajectory = XXHash64::hash(mPathTrajCounters.data(),
-                                         mPathTrajCounters.size(), 0);
+        mPathTrajectory = TrajectoryHasher::hash(mPathTrajCounters.data(),
+                                                 mPathTrajCounters.size(), 0);
     }
 }
 
@@ -166,9 +197,10 @@ Test::finiUserTrajectory()
 void
 Test::finiTrajectory()
 {
+    mergeTaskObservations();
     finiPathTrajectory();
     finiUserTrajectory();
-    XXHash64 trajHasher{0};
+    TrajectoryHasher trajHasher{0};
     trajHasher.add(&mPathTrajectory, sizeof(mPathTrajectory));
     trajHasher.add(&mUserTrajectory, sizeof(mUserTrajectory));
     mTrajectory = trajHasher.hash();
@@ -182,20 +214,32 @@ Test::seedFromRandomDevice()
 }
 
 void
-Test::seedWithValue(uint64_t seed)
+Test::seedWithValue(uint64_t seed, uint64_t stream)
 {
     mLastSeed = seed;
     mGen.seed(seed);
+    for (uint64_t i = 0; i < stream; ++i)
+    {
+        mGen.jump();
+    }
 }
 
 void
 Test::runPlan(Plan const& plan)
 {
     mFailed = false;
-    mTranscript = Transcript(plan);
+    mOnlineMismatch = false;
+    mPlan = &plan;
+    mNumObservations = 0;
+    uint64_t start = mStatus ? statusNow() : 0;
     initTrajectory();
     run();
     finiTrajectory();
+    if (mStatus)
+    {
+        uint64_t now = statusNow();
+        noteStatusExecution(*mStatus, now, now - start, mHangNanos);
+    }
     if (mVerboseLevel > 1)
     {
         std::cout << "ran plan:" << std::endl;
@@ -208,6 +252,9 @@ void
 Test::runPlanAndStabilize(Plan const& plan)
 {
     runPlan(plan);
+    // Only the first run is checked online.
+    mExpected = nullptr;
+    FlagGuard stabilizing(mStabilizing);
     Trajectory savedUserTrajectory = mUserTrajectory;
     Trajectory savedPathTrajectory = mPathTrajectory;
     runPlan(plan);
@@ -238,23 +285,25 @@ Test::runPlanAndStabilize(Plan const& plan)
                       << plan.getHashCode() << ", attempting to stabilize"
                       << std::endl;
         }
-        assert(gCov8BitLen != 0);
+        size_t covLen = pathCountersSize();
+        assert(covLen != 0);
         if (mPathTrajStabilityMask.empty())
         {
-            mPathTrajStabilityMask.resize(gCov8BitLen, 0xff);
+            mPathTrajStabilityMask.resize(covLen, 0xff);
         }
         size_t nMasked, nNewMasked;
         uint64_t stabilityAttempts{0}, retries{0};
-        getStabilityRetries(retries);
+        getEnvNum("PHOTESTHESIS_STABILITY_RETRIES", retries);
         while (stabilityAttempts < retries)
         {
             do
             {
-                std::vector<uint8_t> savedPathBuf = mPathTrajCounters;
+                mSavedPathTrajCounters = mPathTrajCounters;
+                auto const& savedPathBuf = mSavedPathTrajCounters;
                 runPlan(plan);
                 nNewMasked = 0;
                 nMasked = 0;
-                for (size_t i = 0; i < gCov8BitLen; ++i)
+                for (size_t i = 0; i < covLen; ++i)
                 {
                     if (mPathTrajStabilityMask[i])
                     {
@@ -285,7 +334,7 @@ Test::runPlanAndStabilize(Plan const& plan)
                     std::cout << "masked " << nNewMasked
                               << " path-edges as unstable";
                     std::cout << ", total unstable edges: " << nMasked << "/"
-                              << gCov8BitLen << std::endl;
+                              << covLen << std::endl;
                 }
             } while (nNewMasked != 0);
 
@@ -305,7 +354,8 @@ Test::runPlanAndStabilize(Plan const& plan)
 }
 
 bool
-Test::runPlanAndMaybeExpandCorpus(Plan const& plan, Trajectories& trajectories)
+Test::runPlanAndMaybeExpandCorpus(Plan const& plan, Trajectories& trajectories,
+                                  bool skipNearDuplicates)
 {
     auto tname = plan.getTestName();
 
@@ -315,48 +365,317 @@ Test::runPlanAndMaybeExpandCorpus(Plan const& plan, Trajectories& trajectories)
     }
     catch (RejectPlan& _e)
     {
+        noteStatusRejection();
         return false;
     }
 
-    auto& transcripts = mCorp.getTranscripts(tname);
     auto tji = trajectories.find(mTrajectory);
     auto tje = trajectories.end();
-    auto tsi = transcripts.find(mTranscript);
-    auto tse = transcripts.end();
 
-    if (tji == tje && tsi == tse)
+    if (tji == tje)
     {
+        // Every new trajectory is indexed, but only random plans are
+        // skipped as near-duplicates: k-path plans must all be kept to
+        // cover the grammar.
+        if (mNearDuplicateJaccard > 0.0 && !mFailed)
+        {
+            EdgeSignature sig = edgeSignature();
+            double similarity =
+                skipNearDuplicates
+                    ? mNearDuplicates.findSimilar(sig, mUserTrajectory,
+                                                  mNearDuplicateJaccard)
+                    : 0.0;
+            if (similarity != 0.0)
+            {
+                if (mVerboseLevel > 1)
+                {
+                    std::cout << "skipping near-duplicate trajectory "
+                              << mTrajectory << " with edge similarity "
+                              << similarity << std::endl;
+                }
+                ++mNearDuplicatesSkipped;
+                return false;
+            }
+            mNearDuplicates.insert(sig, mUserTrajectory);
+        }
+        // Only materialize a Transcript when the trajectory is new.
+        auto& transcripts = mCorp.getTranscripts(tname);
+        Transcript ts = makeTranscript();
+        if (hasSameTranscript(transcripts, ts))
+        {
+            return false;
+        }
         if (mVerboseLevel > 1)
         {
             std::cout << "novel trajectory found: " << std::endl;
-            std::cout << mTranscript;
+            std::cout << ts;
         }
-        trajectories.emplace(mTrajectory, mTranscript);
-        mCorp.addTranscript(mTranscript);
+        trajectories.emplace(mTrajectory, &mCorp.addTranscript(std::move(ts)));
+        recordCoverage(plan);
+        noteStatusNovelty(trajectories.size());
         return true;
     }
-    else if (tji != tje)
+    else
     {
-        if (!tji->second.getPlan().isManual() && mTranscript < tji->second)
+        Transcript const& old = *tji->second;
+        if (!old.getPlan().isManual() &&
+            (plan < old.getPlan() ||
+             (!(old.getPlan() < plan) && observationsLess(old.getVars()))))
         {
             // Preserve only the minimal transcript from
             // each trajectory equivalence class
             // (unless the plan is a manual one).
+            Transcript ts = makeTranscript();
             if (mVerboseLevel > 1)
             {
                 std::cout << "replacing transcript: " << std::endl;
-                std::cout << tji->second;
+                std::cout << old;
                 std::cout << "with trajectory-equivalent but smaller transcript"
                           << std::endl;
-                std::cout << mTranscript;
+                std::cout << ts;
             }
-            mCorp.replaceTranscript(tji->second, mTranscript);
-            tji->second = mTranscript;
+            forgetCoverage(old.getPlan());
+            tji->second = &mCorp.replaceTranscript(old, std::move(ts));
+            recordCoverage(plan);
         }
     }
     return false;
 }
 
+Transcript
+Test::makeTranscript() const
+{
+    TranscriptVars vars;
+    vars.reserve(mNumObservations);
+    for (size_t i = 0; i < mNumObservations; ++i)
+    {
+        vars.emplace_back(mObservations[i].toVar());
+    }
+    return Transcript(currentPlan(), std::move(vars));
+}
+
+Test::Observation&
+Test::nextObservation(VarName vn, VarKind kind)
+{
+    if (mNumObservations == mObservations.size())
+    {
+        mObservations.emplace_back();
+    }
+    Observation& obs = mObservations[mNumObservations++];
+    obs.mName = vn;
+    obs.mKind = kind;
+    obs.mValue = Value();
+    obs.mType = Type::Nil;
+    return obs;
+}
+
+void
+Test::observe(VarName vn, VarKind kind, Value seen)
+{
+    nextObservation(vn, kind).mValue = seen;
+    checkOnline();
+}
+
+void
+Test::observe(VarName vn, VarKind kind, bool seen)
+{
+    Observation& obs = nextObservation(vn, kind);
+    obs.mType = Type::Bool;
+    obs.mScalar = seen ? 1 : 0;
+    checkOnline();
+}
+
+void
+Test::observe(VarName vn, VarKind kind, int64_t seen)
+{
+    Observation& obs = nextObservation(vn, kind);
+    obs.mType = Type::Int64;
+    obs.mScalar = seen;
+    checkOnline();
+}
+
+void
+Test::observe(VarName vn, VarKind kind, std::string_view seen)
+{
+    Observation& obs = nextObservation(vn, kind);
+    obs.mType = Type::String;
+    obs.mText.assign(seen.data(), seen.size());
+    checkOnline();
+}
+
+void
+Test::checkOnline()
+{
+    if (!mExpected || mOnlineMismatch)
+    {
+        return;
+    }
+    size_t i = mNumObservations - 1;
+    auto const& vars = mExpected->getVars();
+    if (i < vars.size() && observationMatches(i, vars[i]))
+    {
+        return;
+    }
+    mOnlineMismatch = true;
+    handleOnlineMismatch(*mExpected, i, mObservations[i].toVar());
+    if (mOnlineCheck == 1)
+    {
+        throw TranscriptMismatch();
+    }
+}
+
+bool
+Test::observationMatches(size_t i, TranscriptVar const& var) const
+{
+    Observation const& obs = mObservations[i];
+    if (obs.mType == Type::Nil)
+    {
+        return Transcript::varMatches(var, obs.toVar(), mMeasureTolerance);
+    }
+    return obs.compare(var) == 0;
+}
+
+bool
+Test::observationsMatch(TranscriptVars const& vars) const
+{
+    if (vars.size() != mNumObservations)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < mNumObservations; ++i)
+    {
+        if (!observationMatches(i, vars[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+Test::observationsLess(TranscriptVars const& vars) const
+{
+    size_t n = std::min(vars.size(), mNumObservations);
+    for (size_t i = 0; i < n; ++i)
+    {
+        int c = mObservations[i].compare(vars[i]);
+        if (c != 0)
+        {
+            return c < 0;
+        }
+    }
+    return mNumObservations < vars.size();
+}
+
+Value
+Test::Observation::box() const
+{
+    switch (mType)
+    {
+    case Type::Bool:
+        return Value::Bool(mScalar != 0);
+    case Type::Int64:
+        return Value::Int64(mScalar);
+    case Type::String:
+        return Value(mText);
+    default:
+        return mValue;
+    }
+}
+
+TranscriptVar
+Test::Observation::toVar() const
+{
+    return TranscriptVar(mName, box(), mKind);
+}
+
+int
+Test::Observation::compare(TranscriptVar const& var) const
+{
+    VarName const& name = std::get<0>(var);
+    if (!(mName == name))
+    {
+        return mName < name ? -1 : 1;
+    }
+    Value const& val = std::get<1>(var);
+    int c = 0;
+    if (mType == Type::Nil)
+    {
+        c = (mValue < val) ? -1 : (val < mValue) ? 1 : 0;
+    }
+    else if (mType != val.getType())
+    {
+        c = static_cast<size_t>(mType) < static_cast<size_t>(val.getType())
+                ? -1
+                : 1;
+    }
+    else if (mType == Type::String)
+    {
+        auto sv = dynamic_cast<StringValue const*>(val.getImpl());
+        assert(sv);
+        c = mText.compare(sv->getValue());
+        c = (c < 0) ? -1 : (c > 0) ? 1 : 0;
+    }
+    else
+    {
+        int64_t other = 0;
+        if (auto bv = dynamic_cast<BoolValue const*>(val.getImpl()))
+        {
+            other = bv->getValue() ? 1 : 0;
+        }
+        else if (auto iv = dynamic_cast<Int64Value const*>(val.getImpl()))
+        {
+            other = iv->getValue();
+        }
+        c = (mScalar < other) ? -1 : (other < mScalar) ? 1 : 0;
+    }
+    if (c != 0)
+    {
+        return c;
+    }
+    VarKind kind = std::get<2>(var);
+    return (mKind < kind) ? -1 : (kind < mKind) ? 1 : 0;
+}
+
+void
+Test::noteStatusPhase(StatusPhase phase)
+{
+    if (mStatus)
+    {
+        setStatusPhase(*mStatus, phase,
+                       mTestName.getString().c_str());
+    }
+}
+
+void
+Test::noteStatusNovelty(size_t nTrajectories)
+{
+    if (mStatus)
+    {
+        mStatus->mTrajectories.store(nTrajectories, std::memory_order_relaxed);
+        mStatus->mLastNoveltyTime.store(statusNow(),
+                                        std::memory_order_relaxed);
+    }
+}
+
+void
+Test::noteStatusRejection()
+{
+    if (mStatus)
+    {
+        bumpStatusCounter(mStatus->mRejections);
+    }
+}
+
+void
+Test::noteStatusFailure()
+{
+    if (mStatus)
+    {
+        bumpStatusCounter(mStatus->mFailures);
+    }
+}
+
 void
 Test::reportFailures(Failures const& failures) const
 {
@@ -384,16 +703,18 @@ Test::reportFailures(Failures const& failures) const
 }
 
 Test::Failures
-Test::initializeCorpusFromKPaths(uint64_t kPathLength)
+Test::initializeCorpusFromKPaths(Trajectories& trajectories,
+                                 uint64_t kPathLength)
 {
-    TestName tname = mTranscript.getTestName();
-    Trajectories trajectories;
+    TestName tname = mTestName;
     Failures failures;
     if (mVerboseLevel > 0)
     {
         std::cout << "generating initial " << kPathLength
                   << "-paths for test: " << tname << std::endl;
     }
+    noteStatusPhase(StatusPhase::Initializing);
+    mNearDuplicates.clear();
     size_t nPlans = 0;
     for (auto const& spec : mSeedSpecs)
     {
@@ -417,7 +738,8 @@ Test::initializeCorpusFromKPaths(uint64_t kPathLength)
                 runPlanAndMaybeExpandCorpus(plan, trajectories);
                 if (mFailed)
                 {
-                    failures.emplace_back(plan.getHashCode());
+                    failures.emplace_back(shrinkFailure(plan, trajectories));
+                    noteStatusFailure();
                 }
             }
         }
@@ -433,9 +755,9 @@ Test::initializeCorpusFromKPaths(uint64_t kPathLength)
 }
 
 Test::Failures
-Test::checkCorpus(std::map<Trajectory, Transcript>& trajectories)
+Test::checkCorpus(Trajectories& trajectories, bool incremental)
 {
-    TestName tname = mTranscript.getTestName();
+    TestName tname = mTestName;
     auto& transcripts = mCorp.getTranscripts(tname);
     if (transcripts.empty())
     {
@@ -448,31 +770,124 @@ Test::checkCorpus(std::map<Trajectory, Transcript>& trajectories)
                   << " transcripts for test " << tname << std::endl;
     }
     uint64_t specificHash = 0;
-    bool limitToHash = getEnvTestHash(specificHash);
+    bool limitToHash = getEnvNum("PHOTESTHESIS_TEST_HASH", specificHash);
+    noteStatusPhase(StatusPhase::Checking);
+    mNearDuplicates.clear();
+    std::set<std::string> changed;
+    bool fullCheck = !incremental || !findChangedFunctions(changed);
+    size_t nSkipped = 0;
+    // Checking may replace transcripts in the corpus, so iterate over a
+    // snapshot rather than the set itself.
+    std::vector<Transcript const*> snapshot;
+    snapshot.reserve(transcripts.size());
     for (auto const& ts : transcripts)
     {
+        snapshot.emplace_back(&ts);
+    }
+    if (mShardCount > 1)
+    {
+        selectShard(snapshot);
+    }
+    if (mSchedule != 0)
+    {
+        scheduleTranscripts(snapshot);
+    }
+    for (Transcript const* tsp : snapshot)
+    {
+        if (mFailFast != 0 && failures.size() >= mFailFast)
+        {
+            if (mVerboseLevel > 0)
+            {
+                std::cout << "stopping check after " << failures.size()
+                          << " failures" << std::endl;
+            }
+            break;
+        }
+        Transcript const& ts = *tsp;
         if (limitToHash && ts.getPlan().getHashCode() != specificHash)
         {
             continue;
         }
 
+        if (!fullCheck)
+        {
+            auto const& impact = mCorp.getSidecar("impact");
+            PlanHash hash = ts.getPlan().getHashCode();
+            if (impact.has(tname, hash, FUNCTIONS))
+            {
+                bool affected = false;
+                for (auto const& fn :
+                     listElements(impact.get(tname, hash, FUNCTIONS)))
+                {
+                    std::string name;
+                    if (!fn.match(name) || changed.find(name) != changed.end())
+                    {
+                        affected = true;
+                        break;
+                    }
+                }
+                if (!affected)
+                {
+                    ++nSkipped;
+                    continue;
+                }
+            }
+        }
+
+        PlanHash hash = ts.getPlan().getHashCode();
+        Transcript const* checked = nullptr;
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed = [&start]() {
+            return static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+        };
         try
         {
-            checkTranscript(ts);
+            checked = &checkTranscript(ts);
         }
         catch (RejectPlan const& _e)
         {
+            noteStatusRejection();
+            continue;
+        }
+        catch (TranscriptMismatch const& _e)
+        {
+            failures.emplace_back(hash);
+            noteStatusFailure();
+            noteScheduleResult(hash, elapsed(), true);
             continue;
         }
+        noteScheduleResult(hash, elapsed(), mFailed);
 
         if (mFailed)
         {
-            failures.emplace_back(ts.getPlan().getHashCode());
+            failures.emplace_back(hash);
+            noteStatusFailure();
         }
-        trajectories.emplace(mTrajectory, mTranscript);
+        recordCoverage(checked->getPlan());
+        if (mNearDuplicateJaccard > 0.0 &&
+            trajectories.find(mTrajectory) == trajectories.end())
+        {
+            mNearDuplicates.insert(edgeSignature(), mUserTrajectory);
+        }
+        trajectories.emplace(mTrajectory, checked);
+    }
+    noteStatusNovelty(trajectories.size());
+    if (mIncrementalCheck != 0 && failures.empty() && !limitToHash &&
+        mShardCount == 1)
+    {
+        saveFunctionFingerprints(fullCheck);
     }
     if (mVerboseLevel > 0)
     {
+        if (!fullCheck)
+        {
+            std::cout << "incremental check of " << changed.size()
+                      << " changed functions skipped " << nSkipped
+                      << " unaffected transcripts" << std::endl;
+        }
         std::cout << "found " << trajectories.size() << " trajectories from "
                   << transcripts.size() << " transcripts for test " << tname
                   << std::endl;
@@ -481,94 +896,1440 @@ Test::checkCorpus(std::map<Trajectory, Transcript>& trajectories)
     return failures;
 }
 
-Test::Failures
-Test::randomlyExpandCorpus(Trajectories& trajectories, uint64_t steps,
-                           uint64_t depth)
+void
+Test::scheduleTranscripts(std::vector<Transcript const*>& tss)
 {
+    // Recently-failing transcripts go first, most recent failure first, then
+    // the rest longest first so that slow transcripts are not left until the
+    // end. Transcripts with no recorded runtime sort as though instantaneous.
+    auto const& schedule = mCorp.getSidecar("schedule");
+    auto lookup = [&](Transcript const* ts, Symbol key) -> int64_t {
+        PlanHash hash = ts->getPlan().getHashCode();
+        int64_t i = 0;
+        if (schedule.has(mTestName, hash, key))
+        {
+            schedule.get(mTestName, hash, key).match(i);
+        }
+        return i;
+    };
+    std::vector<std::pair<std::pair<int64_t, int64_t>, Transcript const*>> keyed;
+    keyed.reserve(tss.size());
+    for (auto ts : tss)
+    {
+        keyed.emplace_back(
+            std::make_pair(lookup(ts, LAST_FAILURE), lookup(ts, RUNTIME)), ts);
+    }
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](auto const& a, auto const& b) {
+                         return a.first > b.first;
+                     });
+    for (size_t i = 0; i < keyed.size(); ++i)
+    {
+        tss[i] = keyed[i].second;
+    }
+}
 
-    if (steps == 0)
+void
+Test::noteScheduleResult(PlanHash hash, uint64_t nanos, bool failed)
+{
+    if (mSchedule == 0)
     {
-        return {};
+        return;
     }
-    size_t newTrajs = 0;
-    auto tname = mTranscript.getTestName();
-    Failures failures;
-    if (mVerboseLevel > 0)
+    auto& schedule = mCorp.getSidecar("schedule");
+    schedule.set(mTestName, hash, RUNTIME,
+                 Value::Int64(static_cast<int64_t>(nanos)));
+    if (failed)
     {
-        std::cout << "expanding corpus for test: " << tname << std::endl
-                  << "exploring " << steps << " random plans" << std::endl;
+        schedule.set(mTestName, hash, LAST_FAILURE,
+                     Value::Int64(static_cast<int64_t>(statusNow())));
     }
-    for (uint64_t i = 0; i < steps; ++i)
+    else if (schedule.has(mTestName, hash, LAST_FAILURE))
     {
-        ParamSpecs spec;
-        if (trajectories.empty())
+        // Passing again ends the failure's priority; a 0 sorts with the
+        // transcripts that never failed.
+        schedule.set(mTestName, hash, LAST_FAILURE, Value::Int64(0));
+    }
+}
+
+void
+Test::selectShard(std::vector<Transcript const*>& tss)
+{
+    size_t total = tss.size();
+    std::vector<Transcript const*> selected;
+    if (mShardBalanced)
+    {
+        // Longest-processing-time-first: hand out transcripts from longest to
+        // shortest, each to the currently least-loaded shard. Every job
+        // computes the same assignment from the same sidecar.
+        auto const& schedule = mCorp.getSidecar("schedule");
+        std::vector<std::pair<int64_t, Transcript const*>> keyed;
+        keyed.reserve(total);
+        for (auto ts : tss)
         {
-            spec = pickUniform(mGen, mSeedSpecs);
+            PlanHash hash = ts->getPlan().getHashCode();
+            int64_t runtime = 0;
+            if (schedule.has(mTestName, hash, RUNTIME))
+            {
+                schedule.get(mTestName, hash, RUNTIME).match(runtime);
+            }
+            keyed.emplace_back(runtime, ts);
         }
-        else
+        std::stable_sort(keyed.begin(), keyed.end(),
+                         [](auto const& a, auto const& b) {
+                             return a.first > b.first;
+                         });
+        // Loads are (runtime, count) so that transcripts with no recorded
+        // runtime are still spread evenly.
+        std::vector<std::pair<int64_t, size_t>> loads(mShardCount);
+        for (auto const& pair : keyed)
         {
-            spec = pickUniform(mGen, trajectories)
-                       .second.getPlan()
-                       .getParamSpecs();
+            size_t shard = static_cast<size_t>(
+                std::min_element(loads.begin(), loads.end()) - loads.begin());
+            loads[shard].first += pair.first;
+            loads[shard].second += 1;
+            if (shard == mShardIndex)
+            {
+                selected.emplace_back(pair.second);
+            }
         }
-        Plan plan = mGram.randomlyPopulatePlan(tname, spec, mGen,
-                                               static_cast<size_t>(depth));
-        if (runPlanAndMaybeExpandCorpus(plan, trajectories))
+    }
+    else
+    {
+        for (auto ts : tss)
+        {
+            if (ts->getPlan().getHashCode() % mShardCount == mShardIndex)
+            {
+                selected.emplace_back(ts);
+            }
+        }
+    }
+    tss = std::move(selected);
+    if (mVerboseLevel > 0)
+    {
+        std::cout << "checking shard " << mShardIndex << "/" << mShardCount
+                  << ": " << tss.size() << " of " << total << " transcripts"
+                  << std::endl;
+    }
+}
+
+Test::RunOutcome
+Test::runShrinkCandidate(Plan const& plan, bool isolate)
+{
+    if (!isolate)
+    {
+        try
+        {
+            runPlan(plan);
+        }
+        catch (RejectPlan&)
+        {
+            return RunOutcome::Passed;
+        }
+        catch (std::exception&)
+        {
+            return RunOutcome::Crashed;
+        }
+        return mFailed ? RunOutcome::Failed : RunOutcome::Passed;
+    }
+
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw std::runtime_error("fork failed while shrinking");
+    }
+    if (pid == 0)
+    {
+        // Leave without running destructors or atexit handlers, which could
+        // save the parent's corpus.
+        int code = 2;
+        try
+        {
+            runPlan(plan);
+            code = mFailed ? 1 : 0;
+        }
+        catch (RejectPlan&)
+        {
+            code = 0;
+        }
+        catch (...)
+        {
+        }
+        std::cout.flush();
+        _exit(code);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            throw std::runtime_error("waitpid failed while shrinking");
+        }
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        return RunOutcome::Passed;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 1)
+    {
+        return RunOutcome::Failed;
+    }
+    return RunOutcome::Crashed;
+}
+
+static size_t
+paramLeaves(Plan const& plan)
+{
+    size_t n = 0;
+    for (auto const& pair : plan.getParams())
+    {
+        n += pair.second.getSize();
+    }
+    return n;
+}
+
+static bool
+shortlexLess(std::vector<uint8_t> const& a, std::vector<uint8_t> const& b)
+{
+    return a.size() < b.size() || (a.size() == b.size() && a < b);
+}
+
+bool
+Test::beginShrink(Plan const& plan, uint64_t maxExecutions)
+{
+    mExpected = nullptr;
+    mShrinkOutcomes.clear();
+    mShrinkExecutions = 0;
+    mShrinkMaxExecutions = maxExecutions;
+    mShrinkIsolate = mShrinkFork > 1;
+    mShrinking = true;
+
+    // Find out how the plan fails: if it crashes, all candidates have to
+    // run in a child too.
+    try
+    {
+        if (mShrinkFork == 1)
+        {
+            mShrinkTarget = runShrinkCandidate(plan, true);
+            mShrinkIsolate = mShrinkTarget == RunOutcome::Crashed;
+            mShrinkOutcomes.emplace(plan.getHashCode(), mShrinkTarget);
+            ++mShrinkExecutions;
+        }
+        else
+        {
+            mShrinkTarget = runShrinkCandidate(plan, mShrinkIsolate);
+            mShrinkOutcomes.emplace(plan.getHashCode(), mShrinkTarget);
+            ++mShrinkExecutions;
+        }
+    }
+    catch (...)
+    {
+        mShrinking = false;
+        throw;
+    }
+    if (mShrinkTarget == RunOutcome::Passed)
+    {
+        mShrinking = false;
+        return false;
+    }
+    if (mVerboseLevel > 0)
+    {
+        std::cout << "shrinking failing plan " << std::hex
+                  << plan.getHashCode() << std::dec
+                  << (mShrinkIsolate ? " in forked children" : "")
+                  << std::endl;
+    }
+    return true;
+}
+
+bool
+Test::stillFails(Plan const& candidate)
+{
+    PlanHash hash = candidate.getHashCode();
+    auto i = mShrinkOutcomes.find(hash);
+    if (i == mShrinkOutcomes.end())
+    {
+        if (mShrinkExecutions >= mShrinkMaxExecutions)
+        {
+            return false;
+        }
+        ++mShrinkExecutions;
+        i = mShrinkOutcomes
+                .emplace(hash, runShrinkCandidate(candidate, mShrinkIsolate))
+                .first;
+    }
+    return i->second == mShrinkTarget;
+}
+
+void
+Test::endShrink(Plan const& from, Plan const& to)
+{
+    mShrinking = false;
+    if (mVerboseLevel > 0)
+    {
+        std::cout << "shrunk plan " << std::hex << from.getHashCode()
+                  << " to " << to.getHashCode() << std::dec << " ("
+                  << paramLeaves(from) << " to " << paramLeaves(to)
+                  << " leaves) in " << mShrinkExecutions << " runs"
+                  << std::endl;
+    }
+}
+
+Plan
+Test::shrinkReductions(Plan best)
+{
+    ParamSpecs specs = best.getParamSpecs();
+
+    // Try replacing the nodes of parameter `p` named by `reds` at once; keep
+    // the result if it is grammar-valid and still fails the same way.
+    auto tryReductions = [&](size_t p,
+                             std::vector<Reduction const*> const& reds) {
+        Params params = best.getParams();
+        Value v = params[p].second;
+        for (auto const* red : reds)
+        {
+            v = replaceAtPath(v, red->mPath, red->mReplacement);
+        }
+        if (!mGram.derives(specs[p].second, v, specs))
+        {
+            return false;
+        }
+        params[p].second = v;
+        Plan candidate(best.getTestName(), params);
+        if (!stillFails(candidate))
+        {
+            return false;
+        }
+        best = candidate;
+        return true;
+    };
+
+    bool progress = true;
+    while (progress && mShrinkExecutions < mShrinkMaxExecutions)
+    {
+        progress = false;
+        for (size_t p = 0; p < specs.size(); ++p)
+        {
+            for (size_t level = 0; mShrinkExecutions < mShrinkMaxExecutions;
+                 ++level)
+            {
+                std::vector<Reduction> reds;
+                size_t nodes =
+                    mGram.reductions(specs[p].second,
+                                     best.getParams()[p].second, specs, level,
+                                     reds);
+                if (nodes == 0)
+                {
+                    break;
+                }
+
+                // Group the reductions by node; the first of each group is
+                // the most aggressive.
+                std::vector<std::vector<Reduction const*>> byNode;
+                for (auto const& red : reds)
+                {
+                    if (byNode.empty() ||
+                        byNode.back().front()->mPath != red.mPath)
+                    {
+                        byNode.emplace_back();
+                    }
+                    byNode.back().emplace_back(&red);
+                }
+
+                // Hierarchical delta debugging: reduce chunks of the nodes on
+                // this level together, halving the chunk size down to single
+                // nodes.
+                std::vector<bool> done(byNode.size(), false);
+                for (size_t chunk = byNode.size(); chunk > 1; chunk /= 2)
+                {
+                    for (size_t i = 0; i < byNode.size(); i += chunk)
+                    {
+                        std::vector<Reduction const*> batch;
+                        std::vector<size_t> members;
+                        for (size_t j = i;
+                             j < std::min(i + chunk, byNode.size()); ++j)
+                        {
+                            if (!done[j])
+                            {
+                                batch.emplace_back(byNode[j].front());
+                                members.emplace_back(j);
+                            }
+                        }
+                        if (batch.size() > 1 && tryReductions(p, batch))
+                        {
+                            progress = true;
+                            for (size_t j : members)
+                            {
+                                done[j] = true;
+                            }
+                        }
+                    }
+                }
+
+                // Then each remaining node on its own, trying all of its
+                // reductions smallest-first.
+                for (size_t j = 0; j < byNode.size(); ++j)
+                {
+                    if (done[j])
+                    {
+                        continue;
+                    }
+                    for (auto const* red : byNode[j])
+                    {
+                        if (tryReductions(p, {red}))
+                        {
+                            progress = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return best;
+}
+
+Plan
+Test::shrinkChoiceBytes(Plan best, ParamSpecs const& specs,
+                        std::vector<uint8_t>& choices, uint64_t depth)
+{
+    auto decode = [&](std::vector<uint8_t> const& bytes, size_t& used) {
+        ChoiceSequence seq(bytes);
+        Plan plan = mGram.populatePlanFromChoices(
+            mTestName, specs, seq, static_cast<size_t>(depth));
+        used = seq.getPosition();
+        return plan;
+    };
+
+    // Keep a candidate sequence if it is smaller in shortlex order and its
+    // plan still fails the same way. Candidates that decode to a plan
+    // already run are free.
+    auto tryBytes = [&](std::vector<uint8_t> candidate) {
+        if (!shortlexLess(candidate, choices))
+        {
+            return false;
+        }
+        size_t used = 0;
+        Plan plan = decode(candidate, used);
+        if (!stillFails(plan))
+        {
+            return false;
+        }
+        candidate.resize(used);
+        choices = candidate;
+        best = plan;
+        return true;
+    };
+
+    size_t used = 0;
+    decode(choices, used);
+    choices.resize(used);
+
+    static const size_t BLOCKS[] = {8, 4, 2, 1};
+    bool progress = true;
+    while (progress && mShrinkExecutions < mShrinkMaxExecutions)
+    {
+        progress = false;
+        // Delete blocks of choices.
+        for (size_t k : BLOCKS)
+        {
+            for (size_t i = 0; i + k <= choices.size();)
+            {
+                std::vector<uint8_t> candidate = choices;
+                candidate.erase(candidate.begin() + i,
+                                candidate.begin() + i + k);
+                if (tryBytes(candidate))
+                {
+                    progress = true;
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+        // Zero blocks of choices.
+        for (size_t k : BLOCKS)
+        {
+            for (size_t i = 0; i + k <= choices.size(); ++i)
+            {
+                std::vector<uint8_t> candidate = choices;
+                std::fill(candidate.begin() + i, candidate.begin() + i + k, 0);
+                progress = tryBytes(candidate) || progress;
+            }
+        }
+        // Lower single choices.
+        for (size_t i = 0; i < choices.size(); ++i)
+        {
+            uint8_t b = choices[i];
+            for (uint8_t lower : {uint8_t(0), uint8_t(b / 2), uint8_t(b - 1)})
+            {
+                if (lower >= b)
+                {
+                    continue;
+                }
+                std::vector<uint8_t> candidate = choices;
+                candidate[i] = lower;
+                if (tryBytes(candidate))
+                {
+                    progress = true;
+                    break;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+Plan
+Test::shrink(Plan const& plan, uint64_t maxExecutions)
+{
+    if (!beginShrink(plan, maxExecutions))
+    {
+        return plan;
+    }
+    Plan best = plan;
+    try
+    {
+        best = shrinkReductions(plan);
+    }
+    catch (...)
+    {
+        mShrinking = false;
+        throw;
+    }
+    endShrink(plan, best);
+    return best;
+}
+
+Plan
+Test::shrinkChoices(ParamSpecs const& specs, std::vector<uint8_t>& choices,
+                    uint64_t depth, uint64_t maxExecutions)
+{
+    Plan plan = planFromChoices(specs, choices.data(), choices.size(), depth);
+    if (!beginShrink(plan, maxExecutions))
+    {
+        return plan;
+    }
+    Plan best = plan;
+    try
+    {
+        best = shrinkChoiceBytes(plan, specs, choices, depth);
+    }
+    catch (...)
+    {
+        mShrinking = false;
+        throw;
+    }
+    endShrink(plan, best);
+    return best;
+}
+
+Plan
+Test::planFromChoices(ParamSpecs const& specs, uint8_t const* data,
+                      size_t size, uint64_t depth) const
+{
+    ChoiceSequence seq(data, size);
+    return mGram.populatePlanFromChoices(mTestName, specs, seq,
+                                         static_cast<size_t>(depth));
+}
+
+bool
+Test::runChoices(ParamSpecs const& specs, uint8_t const* data, size_t size,
+                 uint64_t depth, Plan& plan, bool& recorded)
+{
+    ChoiceSequence seq(data, size);
+    plan = mGram.populatePlanFromChoices(mTestName, specs, seq,
+                                         static_cast<size_t>(depth));
+    recorded = false;
+    runPlan(plan);
+    bool failed = mFailed;
+    if (failed || mTrajectories.find(mTrajectory) == mTrajectories.end())
+    {
+        mChoices.assign(data, data + seq.getPosition());
+        mChoicesDepth = depth;
+        FlagGuard guard(mChoicesValid);
+        recorded = runPlanAndMaybeExpandCorpus(plan, mTrajectories);
+        failed = failed || mFailed;
+    }
+    return failed;
+}
+
+bool
+Test::getChoices(Plan const& plan, std::vector<uint8_t>& choices,
+                 uint64_t& depth)
+{
+    auto& sidecar = mCorp.getSidecar("choices");
+    if (!sidecar.has(plan.getTestName(), plan.getHashCode(), CHOICES))
+    {
+        return false;
+    }
+    int64_t d = 0;
+    Value rec = sidecar.get(plan.getTestName(), plan.getHashCode(), CHOICES);
+    if (!rec.match(d, choices))
+    {
+        return false;
+    }
+    depth = static_cast<uint64_t>(d);
+    return true;
+}
+
+PlanHash
+Test::shrinkFailure(Plan const& plan, Trajectories& trajectories)
+{
+    if (mShrinkLimit == 0 || !beginShrink(plan, mShrinkLimit))
+    {
+        return plan.getHashCode();
+    }
+    // Plans generated from a choice sequence are shrunk at the byte level
+    // first, which keeps the sequence in step with the plan, and then by
+    // grammar reductions, which do not.
+    bool haveChoices = mChoicesValid;
+    std::vector<uint8_t> choices = mChoices;
+    Plan small = plan;
+    try
+    {
+        if (haveChoices)
+        {
+            small = shrinkChoiceBytes(small, plan.getParamSpecs(), choices,
+                                      mChoicesDepth);
+        }
+        Plan reduced = shrinkReductions(small);
+        if (!(reduced == small))
+        {
+            haveChoices = false;
+            small = reduced;
+        }
+    }
+    catch (...)
+    {
+        mShrinking = false;
+        throw;
+    }
+    endShrink(plan, small);
+    if (small == plan)
+    {
+        return plan.getHashCode();
+    }
+    mChoicesValid = haveChoices;
+    mChoices = choices;
+    runPlanAndMaybeExpandCorpus(small, trajectories);
+    if (!mFailed)
+    {
+        // The shrunk plan only failed in a forked child, or is flaky.
+        return plan.getHashCode();
+    }
+    return small.getHashCode();
+}
+
+Test::Failures
+Test::randomlyExpandCorpus(Trajectories& trajectories, uint64_t steps,
+                           uint64_t depth)
+{
+
+    if (steps == 0)
+    {
+        return {};
+    }
+    size_t newTrajs = 0;
+    auto tname = mTestName;
+    Failures failures;
+    if (mVerboseLevel > 0)
+    {
+        std::cout << "expanding corpus for test: " << tname << std::endl
+                  << "exploring " << steps << " random plans" << std::endl;
+    }
+    noteStatusPhase(StatusPhase::Expanding);
+    uint64_t nearDuplicatesBefore = mNearDuplicatesSkipped;
+    for (uint64_t i = 0; i < steps; ++i)
+    {
+        ParamSpecs spec;
+        if (trajectories.empty())
+        {
+            spec = pickUniform(mGen, mSeedSpecs);
+        }
+        else
+        {
+            spec = pickUniform(mGen, trajectories)
+                       .second->getPlan()
+                       .getParamSpecs();
+        }
+        mChoices.clear();
+        Plan plan = mGram.randomlyPopulatePlan(
+            tname, spec, mGen, static_cast<size_t>(depth), mChoices);
+        mChoicesDepth = depth;
+        mChoicesValid = true;
+        if (runPlanAndMaybeExpandCorpus(plan, trajectories, true))
+        {
+            newTrajs++;
+        };
+        if (mFailed)
+        {
+            failures.emplace_back(shrinkFailure(plan, trajectories));
+            noteStatusFailure();
+        }
+        mChoicesValid = false;
+    }
+    if (mVerboseLevel > 0)
+    {
+        std::cout << "explored " << steps << " random plans at depth " << depth
+                  << std::endl
+                  << "expanded corpus by " << newTrajs << " to "
+                  << mCorp.getTranscripts(tname).size()
+                  << " distinct trajectories over " << getCoverageCountersSize()
+                  << " edge counters" << std::endl;
+        if (mNearDuplicateJaccard > 0.0)
+        {
+            std::cout << "skipped "
+                      << mNearDuplicatesSkipped - nearDuplicatesBefore
+                      << " near-duplicate trajectories" << std::endl;
+        }
+        reportFailures(failures);
+    }
+    return failures;
+}
+
+void
+Test::recordCoverage(Plan const& plan)
+{
+    if (mRecordChoices != 0 && mChoicesValid)
+    {
+        mCorp.getSidecar("choices").set(
+            plan.getTestName(), plan.getHashCode(), CHOICES,
+            Value(std::vector<Value>{
+                Value::Int64(static_cast<int64_t>(mChoicesDepth)),
+                Value(mChoices)}));
+    }
+    if (mPathTrajCounters.empty())
+    {
+        return;
+    }
+    if (mCoverageExport != 0)
+    {
+        // Only this process's own counters are edges of the build the report
+        // describes; the shared counters after them fold in other programs'.
+        mCorp.getSidecar("coverage").set(
+            plan.getTestName(), plan.getHashCode(), EDGES,
+            Value(encodeEdges(mPathTrajCounters.data(),
+                              getCoverageCountersSize())));
+    }
+    if (mIncrementalCheck != 0)
+    {
+        std::vector<Value> names;
+        for (auto const& name : getCoveredFunctions(mPathTrajCounters))
+        {
+            names.emplace_back(name);
+        }
+        mCorp.getSidecar("impact").set(plan.getTestName(),
+                                       plan.getHashCode(), FUNCTIONS,
+                                       Value(names));
+    }
+}
+
+void
+Test::forgetCoverage(Plan const& plan)
+{
+    if (mRecordChoices != 0)
+    {
+        mCorp.getSidecar("choices").erase(plan.getTestName(),
+                                          plan.getHashCode());
+    }
+    if (mCoverageExport != 0)
+    {
+        mCorp.getSidecar("coverage").erase(plan.getTestName(),
+                                           plan.getHashCode());
+    }
+    if (mIncrementalCheck != 0)
+    {
+        mCorp.getSidecar("impact").erase(plan.getTestName(),
+                                         plan.getHashCode());
+    }
+}
+
+// The fingerprints each test last passed a check with are kept in the impact
+// sidecar under plan hash 0, which is never a real plan's hash.
+bool
+Test::findChangedFunctions(std::set<std::string>& changed)
+{
+    TestName tname = mTestName;
+    auto const& sidecar = mCorp.getSidecar("impact");
+    auto current = getFunctionFingerprints();
+    if (current.empty() || !sidecar.has(tname, 0, FINGERPRINTS))
+    {
+        return false;
+    }
+    int64_t nChecks = 0;
+    if (sidecar.has(tname, 0, INCREMENTAL_CHECKS) &&
+        sidecar.get(tname, 0, INCREMENTAL_CHECKS).match(nChecks) &&
+        static_cast<uint64_t>(nChecks) >= mIncrementalCheck)
+    {
+        return false;
+    }
+    std::map<std::string, uint64_t> previous;
+    for (auto const& entry :
+         listElements(sidecar.get(tname, 0, FINGERPRINTS)))
+    {
+        std::string name;
+        int64_t fp;
+        if (!entry.match(name, fp))
+        {
+            return false;
+        }
+        previous.emplace(name, static_cast<uint64_t>(fp));
+    }
+    for (auto const& pair : current)
+    {
+        auto i = previous.find(pair.first);
+        if (i == previous.end() || i->second != pair.second)
+        {
+            changed.emplace(pair.first);
+        }
+    }
+    for (auto const& pair : previous)
+    {
+        if (current.find(pair.first) == current.end())
+        {
+            changed.emplace(pair.first);
+        }
+    }
+    return true;
+}
+
+void
+Test::saveFunctionFingerprints(bool fullCheck)
+{
+    TestName tname = mTestName;
+    auto& sidecar = mCorp.getSidecar("impact");
+    auto current = getFunctionFingerprints();
+    if (current.empty())
+    {
+        return;
+    }
+    std::vector<Value> fps;
+    for (auto const& pair : current)
+    {
+        fps.emplace_back(std::vector<Value>{
+            Value(pair.first), Value::Int64(static_cast<int64_t>(pair.second))});
+    }
+    int64_t nChecks = 0;
+    if (!fullCheck && sidecar.has(tname, 0, INCREMENTAL_CHECKS))
+    {
+        sidecar.get(tname, 0, INCREMENTAL_CHECKS).match(nChecks);
+        nChecks += 1;
+    }
+    sidecar.set(tname, 0, FINGERPRINTS, Value(fps));
+    sidecar.set(tname, 0, INCREMENTAL_CHECKS, Value::Int64(nChecks));
+}
+
+void
+Test::exportCoverageReport()
+{
+    if (mCoverageExport == 0)
+    {
+        return;
+    }
+    auto const& sidecar = mCorp.getSidecar("coverage");
+    if (mCorp.getPath().empty())
+    {
+        if (mVerboseLevel > 0)
+        {
+            writeCoverageReport(sidecar, std::cout);
+        }
+        return;
+    }
+    std::string path = mCorp.getPath() + ".coverage-report";
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    writeCoverageReport(sidecar, out);
+    if (mVerboseLevel > 0)
+    {
+        std::cout << "wrote coverage report to " << path << std::endl;
+    }
+}
+
+void
+Test::reportReplayTimings(std::vector<ReplayTiming> const& timings) const
+{
+    for (auto const& t : timings)
+    {
+        std::cout << "replayed " << t.mTestName << " " << std::hex
+                  << t.mPlanHash << std::dec << " x" << t.mIterations
+                  << ": min " << t.mMin << "ns, median " << t.mMedian
+                  << "ns, p99 " << t.mP99 << "ns" << std::endl;
+    }
+}
+
+std::vector<ReplayTiming>
+Test::summarizeReplay(std::vector<Transcript const*> const& selected,
+                      std::vector<std::vector<uint64_t>>& samples) const
+{
+    std::vector<ReplayTiming> timings;
+    for (size_t i = 0; i < selected.size(); ++i)
+    {
+        auto& s = samples[i];
+        if (s.empty())
+        {
+            continue;
+        }
+        std::sort(s.begin(), s.end());
+        ReplayTiming t;
+        t.mTestName = mTestName;
+        t.mPlanHash = selected[i]->getPlan().getHashCode();
+        t.mIterations = s.size();
+        t.mMin = s.front();
+        t.mMedian = sortedMedian(s);
+        // Nearest-rank percentile: the smallest sample at or above 99% of
+        // the distribution.
+        t.mP99 = s.at((s.size() * 99 + 99) / 100 - 1);
+        timings.emplace_back(t);
+    }
+    return timings;
+}
+
+std::vector<ReplayTiming>
+Test::replay(uint64_t iterations, uint64_t loops)
+{
+    TestName tname = mTestName;
+    auto const& transcripts = mCorp.getTranscripts(tname);
+    uint64_t specificHash = 0;
+    bool limitToHash = getEnvNum("PHOTESTHESIS_TEST_HASH", specificHash);
+
+    // Samples are kept per transcript in corpus order, and accumulate
+    // across loops (or, when replaying forever, across one loop at a time).
+    std::vector<Transcript const*> selected;
+    for (auto const& ts : transcripts)
+    {
+        if (!limitToHash || ts.getPlan().getHashCode() == specificHash)
+        {
+            selected.emplace_back(&ts);
+        }
+    }
+    std::vector<std::vector<uint64_t>> samples(selected.size());
+    std::vector<bool> rejected(selected.size(), false);
+    size_t remaining = selected.size();
+
+    FlagGuard replaying(mReplaying);
+    noteStatusPhase(StatusPhase::Replaying);
+    for (uint64_t loop = 0;
+         remaining != 0 && iterations != 0 && (loops == 0 || loop < loops);
+         ++loop)
+    {
+        for (size_t i = 0; i < selected.size(); ++i)
+        {
+            if (rejected[i])
+            {
+                continue;
+            }
+            mPlan = &selected[i]->getPlan();
+            for (uint64_t j = 0; j < iterations; ++j)
+            {
+                auto start = std::chrono::steady_clock::now();
+                try
+                {
+                    run();
+                }
+                catch (RejectPlan const& _e)
+                {
+                    rejected[i] = true;
+                    remaining -= 1;
+                    noteStatusRejection();
+                    break;
+                }
+                auto end = std::chrono::steady_clock::now();
+                samples[i].emplace_back(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        end - start)
+                        .count());
+                if (mStatus)
+                {
+                    noteStatusExecution(*mStatus, statusNow(),
+                                        samples[i].back(), mHangNanos);
+                }
+            }
+        }
+        if (mVerboseLevel > 0)
+        {
+            std::cout << "replayed " << selected.size()
+                      << " transcripts for test " << tname << " (loop "
+                      << (loop + 1) << ")" << std::endl;
+        }
+        if (loops == 0)
+        {
+            // Replaying forever: report each loop's timings and start the
+            // next loop afresh, rather than accumulating without bound.
+            reportReplayTimings(summarizeReplay(selected, samples));
+            for (auto& s : samples)
+            {
+                s.clear();
+            }
+        }
+    }
+    noteStatusPhase(StatusPhase::Done);
+
+    auto timings = summarizeReplay(selected, samples);
+    reportReplayTimings(timings);
+    return timings;
+}
+
+void
+Test::invariant(VarName vn, Value expected, Value got)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    if (!(expected == got))
+    {
+        mFailed = true;
+        if (!mShrinking)
+        {
+            handleInvariantFailure(currentPlan(), vn, expected, got);
+        }
+    }
+}
+
+void
+Test::trace(VarName vn, Value seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    addSymbolToHash(mUserTrajHasher, vn);
+    addStructureToHash(mUserTrajHasher, seen);
+}
+
+void
+Test::trace(VarName vn, bool seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    addSymbolToHash(mUserTrajHasher, vn);
+    addStructureToHash(mUserTrajHasher, seen);
+}
+
+void
+Test::trace(VarName vn, int64_t seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    addSymbolToHash(mUserTrajHasher, vn);
+    addStructureToHash(mUserTrajHasher, seen);
+}
+
+void
+Test::trace(VarName vn, std::string_view seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    addSymbolToHash(mUserTrajHasher, vn);
+    addStructureToHash(mUserTrajHasher, seen);
+}
+
+void
+Test::trace(VarName vn, uint8_t const* data, size_t len)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    addSymbolToHash(mUserTrajHasher, vn);
+    addBytesStructureToHash(mUserTrajHasher, Type::Blob, data, len);
+}
+
+void
+Test::submitTask(std::unique_ptr<TaskObserver::Buffer> buffer)
+{
+    TaskObserver::Buffer* b = buffer.release();
+    b->mNext = mSubmittedTasks.load(std::memory_order_relaxed);
+    while (!mSubmittedTasks.compare_exchange_weak(
+        b->mNext, b, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+}
+
+std::vector<std::unique_ptr<TaskObserver::Buffer>>
+Test::takeSubmittedTasks()
+{
+    std::vector<std::unique_ptr<TaskObserver::Buffer>> tasks;
+    TaskObserver::Buffer* b =
+        mSubmittedTasks.exchange(nullptr, std::memory_order_acquire);
+    while (b)
+    {
+        tasks.emplace_back(b);
+        b = b->mNext;
+    }
+    return tasks;
+}
+
+void
+Test::mergeTaskObservations()
+{
+    if (mSubmittedTasks.load(std::memory_order_relaxed) == nullptr)
+    {
+        return;
+    }
+    auto tasks = takeSubmittedTasks();
+    std::sort(tasks.begin(), tasks.end(), [](auto const& a, auto const& b) {
+        return a->mKey < b->mKey;
+    });
+    for (size_t i = 1; i < tasks.size(); ++i)
+    {
+        if (tasks[i - 1]->mKey == tasks[i]->mKey)
         {
-            newTrajs++;
-        };
-        if (mFailed)
+            throw std::runtime_error("two TaskObservers submitted with key " +
+                                     std::to_string(tasks[i]->mKey));
+        }
+    }
+    using Call = TaskObserver::Call;
+    for (auto const& task : tasks)
+    {
+        for (auto const& r : task->mRecords)
         {
-            failures.emplace_back(plan.getHashCode());
+            if (r.mCall == Call::Invariant)
+            {
+                invariant(r.mName, r.mExpected, r.mValue);
+                continue;
+            }
+            bool traced = r.mCall != Call::Check;
+            bool checked = r.mCall != Call::Trace;
+            VarKind kind =
+                r.mCall == Call::Track ? VarKind::Tracked : VarKind::Checked;
+            switch (r.mType)
+            {
+            case Type::Bool:
+                if (traced)
+                {
+                    trace(r.mName, r.mScalar != 0);
+                }
+                if (checked)
+                {
+                    observe(r.mName, kind, r.mScalar != 0);
+                }
+                break;
+            case Type::Int64:
+                if (traced)
+                {
+                    trace(r.mName, r.mScalar);
+                }
+                if (checked)
+                {
+                    observe(r.mName, kind, r.mScalar);
+                }
+                break;
+            case Type::String:
+                if (traced)
+                {
+                    trace(r.mName, std::string_view(r.mText));
+                }
+                if (checked)
+                {
+                    observe(r.mName, kind, std::string_view(r.mText));
+                }
+                break;
+            case Type::Blob:
+                trace(r.mName,
+                      reinterpret_cast<uint8_t const*>(r.mText.data()),
+                      r.mText.size());
+                break;
+            default:
+                if (traced)
+                {
+                    trace(r.mName, r.mValue);
+                }
+                if (checked)
+                {
+                    observe(r.mName, kind, r.mValue);
+                }
+                break;
+            }
         }
     }
-    if (mVerboseLevel > 0)
+}
+
+TaskObserver::TaskObserver(Test& test, uint64_t key) : mTest(test)
+{
+    if (!mTest.mReplaying)
     {
-        std::cout << "explored " << steps << " random plans at depth " << depth
-                  << std::endl
-                  << "expanded corpus by " << newTrajs << " to "
-                  << mCorp.getTranscripts(tname).size()
-                  << " distinct trajectories over " << gCov8BitLen
-                  << " edge counters" << std::endl;
-        reportFailures(failures);
+        mBuffer = std::make_unique<Buffer>();
+        mBuffer->mKey = key;
     }
-    return failures;
+}
+
+TaskObserver::~TaskObserver()
+{
+    submit();
 }
 
 void
-Test::invariant(VarName vn, Value expected, Value got)
+TaskObserver::submit()
 {
-    if (!(expected == got))
+    if (mBuffer)
     {
-        mFailed = true;
-        handleInvariantFailure(mTranscript.getPlan(), vn, expected, got);
+        mTest.submitTask(std::move(mBuffer));
     }
 }
 
+TaskObserver::Record*
+TaskObserver::append(Call call, VarName vn)
+{
+    if (!mBuffer)
+    {
+        return nullptr;
+    }
+    Record& r = mBuffer->mRecords.emplace_back();
+    r.mCall = call;
+    r.mName = vn;
+    return &r;
+}
+
 void
-Test::trace(VarName vn, Value seen)
+TaskObserver::invariant(VarName vn, Value expected, Value got)
+{
+    if (Record* r = append(Call::Invariant, vn))
+    {
+        r->mExpected = expected;
+        r->mValue = got;
+    }
+}
+
+void
+TaskObserver::trace(VarName vn, uint8_t const* data, size_t len)
+{
+    if (Record* r = append(Call::Trace, vn))
+    {
+        r->mType = Type::Blob;
+        r->mText.assign(reinterpret_cast<char const*>(data), len);
+    }
+}
+
+void
+TaskObserver::record(Call call, VarName vn, Value seen)
+{
+    if (Record* r = append(call, vn))
+    {
+        r->mValue = seen;
+    }
+}
+
+void
+TaskObserver::record(Call call, VarName vn, bool seen)
 {
-    addKeyValueToHash(mUserTrajHasher, vn, seen);
+    if (Record* r = append(call, vn))
+    {
+        r->mType = Type::Bool;
+        r->mScalar = seen ? 1 : 0;
+    }
+}
+
+void
+TaskObserver::record(Call call, VarName vn, int64_t seen)
+{
+    if (Record* r = append(call, vn))
+    {
+        r->mType = Type::Int64;
+        r->mScalar = seen;
+    }
+}
+
+void
+TaskObserver::record(Call call, VarName vn, std::string_view seen)
+{
+    if (Record* r = append(call, vn))
+    {
+        r->mType = Type::String;
+        r->mText.assign(seen.data(), seen.size());
+    }
 }
 
 void
 Test::check(VarName vn, Value seen)
 {
-    mTranscript.addCheckedVar(vn, seen);
+    if (mReplaying)
+    {
+        return;
+    }
+    observe(vn, VarKind::Checked, seen);
+}
+
+void
+Test::check(VarName vn, bool seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    observe(vn, VarKind::Checked, seen);
+}
+
+void
+Test::check(VarName vn, int64_t seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    observe(vn, VarKind::Checked, seen);
+}
+
+void
+Test::check(VarName vn, std::string_view seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    observe(vn, VarKind::Checked, seen);
 }
 
 void
 Test::track(VarName vn, Value seen)
 {
+    if (mReplaying)
+    {
+        return;
+    }
+    trace(vn, seen);
+    observe(vn, VarKind::Tracked, seen);
+}
+
+void
+Test::track(VarName vn, bool seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    trace(vn, seen);
+    observe(vn, VarKind::Tracked, seen);
+}
+
+void
+Test::track(VarName vn, int64_t seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    trace(vn, seen);
+    observe(vn, VarKind::Tracked, seen);
+}
+
+void
+Test::track(VarName vn, std::string_view seen)
+{
+    if (mReplaying)
+    {
+        return;
+    }
     trace(vn, seen);
-    mTranscript.addTrackedVar(vn, seen);
+    observe(vn, VarKind::Tracked, seen);
+}
+
+void
+Test::measure(VarName vn, std::vector<int64_t> samples)
+{
+    if (mReplaying)
+    {
+        return;
+    }
+    if (samples.empty())
+    {
+        throw std::runtime_error("measure called with no samples");
+    }
+    std::sort(samples.begin(), samples.end());
+    int64_t med = sortedMedian(samples);
+    for (auto& x : samples)
+    {
+        x = (x < med) ? med - x : x - med;
+    }
+    std::sort(samples.begin(), samples.end());
+    int64_t mad = sortedMedian(samples);
+    observe(vn, VarKind::Measured,
+            Value(std::vector<Value>{Value::Int64(med), Value::Int64(mad)}));
+}
+
+void
+Test::setMeasureTolerance(double tolerance)
+{
+    mMeasureTolerance = tolerance;
+}
+
+void
+Test::setNearDuplicateJaccard(double jaccard)
+{
+    mNearDuplicateJaccard = jaccard;
+}
+
+void
+Test::setShard(uint64_t index, uint64_t count, bool balanced)
+{
+    if (count == 0 || index >= count)
+    {
+        throw std::runtime_error("shard index " + std::to_string(index) +
+                                 " out of range for " + std::to_string(count) +
+                                 " shards");
+    }
+    mShardIndex = index;
+    mShardCount = count;
+    mShardBalanced = balanced;
+}
+
+void
+Test::setSubprocessCoverage(bool enable)
+{
+    SharedCoverage* shared = enable ? &getSharedCoverage() : nullptr;
+    mSharedCounters = shared ? shared->mCounters : nullptr;
+    mSharedCountersSize = shared ? SharedCoverage::Size : 0;
+    // The stability mask covers the shared counters too.
+    mPathTrajStabilityMask.clear();
 }
 
 Test::Test(Grammar const& gram, Corpus& corp, TestName testName,
            std::vector<ParamSpecs> const& seedSpecs)
-    : mGram(gram), mCorp(corp), mTranscript(testName), mSeedSpecs(seedSpecs)
+    : mGram(gram), mCorp(corp), mTestName(testName), mSeedSpecs(seedSpecs)
+{
+    getEnvNum("PHOTESTHESIS_VERBOSE", mVerboseLevel);
+    getEnvDouble("PHOTESTHESIS_MEASURE_TOLERANCE", mMeasureTolerance);
+    getEnvDouble("PHOTESTHESIS_NEAR_DUPLICATE_JACCARD",
+                 mNearDuplicateJaccard);
+    getEnvNum("PHOTESTHESIS_COVERAGE_EXPORT", mCoverageExport);
+    getEnvNum("PHOTESTHESIS_INCREMENTAL_CHECK", mIncrementalCheck);
+    getEnvNum("PHOTESTHESIS_ONLINE_CHECK", mOnlineCheck);
+    getEnvNum("PHOTESTHESIS_SCHEDULE", mSchedule);
+    getEnvNum("PHOTESTHESIS_FAIL_FAST", mFailFast);
+    getEnvNum("PHOTESTHESIS_SHRINK", mShrinkLimit);
+    getEnvNum("PHOTESTHESIS_SHRINK_FORK", mShrinkFork);
+    getEnvNum("PHOTESTHESIS_RECORD_CHOICES", mRecordChoices);
+    uint64_t subprocessCoverage = 0;
+    if (getEnvNum("PHOTESTHESIS_SUBPROCESS_COVERAGE", subprocessCoverage) &&
+        subprocessCoverage != 0)
+    {
+        setSubprocessCoverage(true);
+    }
+    uint64_t shardIndex = 0, shardCount = 1, shardBalance = 0;
+    if (getEnvIndexOfCount("PHOTESTHESIS_SHARD", shardIndex, shardCount))
+    {
+        getEnvNum("PHOTESTHESIS_SHARD_BALANCE", shardBalance);
+        setShard(shardIndex, shardCount, shardBalance != 0);
+    }
+    if (getEnvNum("PHOTESTHESIS_HANG_MS", mHangNanos))
+    {
+        mHangNanos *= 1000000;
+    }
+    mStatus = getStatusPage();
+}
+
+Test::~Test()
 {
-    getEnvVerbose(mVerboseLevel);
+    takeSubmittedTasks();
 }
 
 Test::Failures
@@ -576,31 +2337,115 @@ Test::administer(uint64_t expansionSteps, uint64_t kPathLength,
                  uint64_t randomDepth)
 {
 
-    getEnvExpansionSteps(expansionSteps);
-    getEnvKPathLength(kPathLength);
-    getEnvRandomDepth(randomDepth);
-    uint64_t randomSeed = 0;
-    if (getEnvRandomSeed(randomSeed))
+    getEnvNum("PHOTESTHESIS_EXPANSION_STEPS", expansionSteps);
+    getEnvNum("PHOTESTHESIS_KPATH_LENGTH", kPathLength);
+    getEnvNum("PHOTESTHESIS_RANDOM_DEPTH", randomDepth);
+    uint64_t randomSeed = 0, randomStream = 0;
+    if (getEnvNum("PHOTESTHESIS_RANDOM_SEED", randomSeed))
     {
-        seedWithValue(randomSeed);
+        getEnvNum("PHOTESTHESIS_RANDOM_STREAM", randomStream);
+        seedWithValue(randomSeed, randomStream);
     }
 
-    TestName tname = mTranscript.getTestName();
+    TestName tname = mTestName;
+
+    uint64_t replayIterations = 0;
+    if (getEnvNum("PHOTESTHESIS_REPLAY_ITERATIONS", replayIterations) &&
+        replayIterations != 0)
+    {
+        uint64_t replayLoops = 1;
+        getEnvNum("PHOTESTHESIS_REPLAY_LOOPS", replayLoops);
+        replay(replayIterations, replayLoops);
+        return {};
+    }
 
+    // A shard knows only its own slice's trajectories: initializing or
+    // expanding would add plans whose trajectories other shards already
+    // have, and every shard would add the same k-path plans.
+    bool sharded = mShardCount > 1;
+    Failures failures;
     if (mCorp.getTranscripts(tname).empty())
     {
-        return initializeCorpusFromKPaths(kPathLength);
+        if (sharded)
+        {
+            if (mVerboseLevel > 0)
+            {
+                std::cout << "not initializing empty corpus for test "
+                          << tname << " in a sharded check" << std::endl;
+            }
+        }
+        else
+        {
+            Trajectories trajectories;
+            failures = initializeCorpusFromKPaths(trajectories, kPathLength);
+        }
     }
     else
     {
         Trajectories trajectories;
-        auto failures = checkCorpus(trajectories);
-        if (!failures.empty())
+        failures = checkCorpus(trajectories,
+                               mIncrementalCheck != 0 && expansionSteps == 0);
+        if (sharded)
+        {
+            if (mVerboseLevel > 0 && expansionSteps != 0)
+            {
+                std::cout << "not expanding corpus for test " << tname
+                          << " in a sharded check" << std::endl;
+            }
+        }
+        else if (failures.empty())
         {
-            return failures;
+            failures = randomlyExpandCorpus(trajectories, expansionSteps,
+                                            randomDepth);
         }
-        return randomlyExpandCorpus(trajectories, expansionSteps, randomDepth);
     }
+    finish();
+    return failures;
+}
+
+std::vector<PlanHash>
+Test::prepare(uint64_t kPathLength)
+{
+    mTrajectories.clear();
+    if (mCorp.getTranscripts(mTestName).empty())
+    {
+        if (mShardCount > 1)
+        {
+            throw std::runtime_error(
+                "cannot initialize a corpus in a sharded check");
+        }
+        return initializeCorpusFromKPaths(mTrajectories, kPathLength);
+    }
+    return checkCorpus(mTrajectories);
+}
+
+std::vector<PlanHash>
+Test::expand(uint64_t steps, uint64_t randomDepth)
+{
+    if (mShardCount > 1 && steps != 0)
+    {
+        throw std::runtime_error("cannot expand a corpus in a sharded check");
+    }
+    return randomlyExpandCorpus(mTrajectories, steps, randomDepth);
+}
+
+void
+Test::finish()
+{
+    exportCoverageReport();
+    noteStatusPhase(StatusPhase::Done);
+}
+
+size_t
+Test::getTrajectoryCount() const
+{
+    return mTrajectories.size();
+}
+
+TestName const&
+Test::getTestName() const
+{
+    return mTestName;
 }
 
 void
@@ -631,14 +2476,60 @@ Test::handleTranscriptMismatch(Transcript const& expected,
 }
 
 void
+Test::handleOnlineMismatch(Transcript const& expected, size_t index,
+                           TranscriptVar const& got)
+{
+    if (mVerboseLevel > 0)
+    {
+        auto const& vars = expected.getVars();
+        std::cout << "transcript diverged at variable " << index
+                  << " of test " << expected.getTestName() << " " << std::hex
+                  << expected.getPlan().getHashCode() << std::dec << std::endl;
+        std::cout << "  expected: ";
+        if (index < vars.size())
+        {
+            std::cout << std::get<0>(vars[index]) << " = "
+                      << std::get<1>(vars[index]) << std::endl;
+        }
+        else
+        {
+            std::cout << "end of transcript" << std::endl;
+        }
+        std::cout << "  got: " << std::get<0>(got) << " = " << std::get<1>(got)
+                  << std::endl;
+    }
+}
+
+Transcript const&
 Test::checkTranscript(Transcript const& ts)
 {
-    runPlanAndStabilize(ts.getPlan());
-    if (!(ts == mTranscript))
+    if (mOnlineCheck != 0)
     {
-        handleTranscriptMismatch(ts, mTranscript);
-        mCorp.updateTranscript(mTranscript);
-    };
+        mExpected = &ts;
+    }
+    try
+    {
+        runPlanAndStabilize(ts.getPlan());
+    }
+    catch (...)
+    {
+        mExpected = nullptr;
+        throw;
+    }
+    if (!observationsMatch(ts.getVars()))
+    {
+        Transcript got = makeTranscript();
+        handleTranscriptMismatch(ts, got);
+        return mCorp.updateTranscript(std::move(got));
+    }
+    return ts;
+}
+
+Trajectory
+Test::runOnce(Plan const& plan)
+{
+    runPlan(plan);
+    return mTrajectory;
 }
 
 } // namespace photesthesis
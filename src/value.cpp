@@ -382,7 +382,8 @@ operator<<(std::ostream& os, const Value& val)
         bool first = true;
         for (auto byte : vi->getValue())
         {
-            os << (first ? "" : " ") << "0x" << std::hex << byte;
+            os << (first ? "" : " ") << "0x" << std::hex
+               << static_cast<unsigned>(byte) << std::dec;
             first = false;
         }
         os << ']';
@@ -458,10 +459,15 @@ operator>>(std::istream& is, Value& val)
         char c;
         is.get(c);
         std::vector<uint8_t> bytes;
-        while (is.good() && is.peek() != ']')
+        while (is.good() && (is >> std::ws).peek() != ']')
         {
-            bytes.emplace_back();
-            is >> std::hex >> bytes.back();
+            unsigned byte = 0;
+            is >> std::hex >> byte >> std::dec;
+            if (byte > 0xff)
+            {
+                throw std::runtime_error("blob byte out of range");
+            }
+            bytes.emplace_back(static_cast<uint8_t>(byte));
         }
         if (is.good() && is.peek() == ']')
         {
@@ -556,6 +562,165 @@ operator>>(std::istream& is, Value& val)
     return is;
 }
 
+namespace
+{
+void
+encodeVarint(uint64_t n, std::vector<uint8_t>& out)
+{
+    while (n >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(n) | 0x80);
+        n >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(n));
+}
+
+uint64_t
+decodeVarint(uint8_t const*& p, uint8_t const* end)
+{
+    uint64_t n = 0;
+    for (size_t shift = 0; shift < 64; shift += 7)
+    {
+        if (p == end)
+        {
+            break;
+        }
+        uint8_t b = *p++;
+        n |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+        {
+            return n;
+        }
+    }
+    throw std::runtime_error("malformed varint in encoded value");
+}
+
+void
+encodeBytes(uint8_t const* data, size_t len, std::vector<uint8_t>& out)
+{
+    encodeVarint(len, out);
+    out.insert(out.end(), data, data + len);
+}
+
+uint8_t const*
+decodeBytes(uint8_t const*& p, uint8_t const* end, size_t& len)
+{
+    len = decodeVarint(p, end);
+    if (len > static_cast<size_t>(end - p))
+    {
+        throw std::runtime_error("truncated encoded value");
+    }
+    uint8_t const* data = p;
+    p += len;
+    return data;
+}
+} // namespace
+
+void
+encodeValue(Value const& val, std::vector<uint8_t>& out)
+{
+    ValueImpl const* vi = val.getImpl();
+    out.push_back(static_cast<uint8_t>(val.getType()));
+    if (auto v = dynamic_cast<StringValue const*>(vi))
+    {
+        auto const& str = v->getValue();
+        encodeBytes(reinterpret_cast<uint8_t const*>(str.data()), str.size(),
+                    out);
+    }
+    else if (auto v = dynamic_cast<BlobValue const*>(vi))
+    {
+        encodeBytes(v->getValue().data(), v->getValue().size(), out);
+    }
+    else if (auto v = dynamic_cast<BoolValue const*>(vi))
+    {
+        out.push_back(v->getValue() ? 1 : 0);
+    }
+    else if (auto v = dynamic_cast<Int64Value const*>(vi))
+    {
+        uint64_t u = static_cast<uint64_t>(v->getValue());
+        encodeVarint((u << 1) ^ (v->getValue() < 0 ? ~uint64_t(0) : 0), out);
+    }
+    else if (auto v = dynamic_cast<SymValue const*>(vi))
+    {
+        auto const& str = v->getValue().getString();
+        encodeBytes(reinterpret_cast<uint8_t const*>(str.data()), str.size(),
+                    out);
+    }
+    else if (auto v = dynamic_cast<PairValue const*>(vi))
+    {
+        encodeVarint(v->mLength, out);
+        for (PairValue const* p = v; p; p = p->getValue().second.get())
+        {
+            encodeValue(p->getValue().first, out);
+        }
+    }
+}
+
+void
+decodeValue(uint8_t const*& p, uint8_t const* end, Value& val)
+{
+    if (p == end)
+    {
+        throw std::runtime_error("truncated encoded value");
+    }
+    size_t len = 0;
+    switch (static_cast<Type>(*p++))
+    {
+    case Type::Nil:
+        val = Value();
+        break;
+    case Type::Sym:
+    {
+        auto data = reinterpret_cast<char const*>(decodeBytes(p, end, len));
+        val = Value(Symbol(std::string(data, len)));
+        break;
+    }
+    case Type::Bool:
+        if (p == end || *p > 1)
+        {
+            throw std::runtime_error("malformed bool in encoded value");
+        }
+        val = Value::Bool(*p++ != 0);
+        break;
+    case Type::Int64:
+    {
+        uint64_t u = decodeVarint(p, end);
+        val = Value::Int64(static_cast<int64_t>((u >> 1) ^ (~(u & 1) + 1)));
+        break;
+    }
+    case Type::Blob:
+    {
+        auto data = decodeBytes(p, end, len);
+        val = Value(std::vector<uint8_t>(data, data + len));
+        break;
+    }
+    case Type::String:
+    {
+        auto data = reinterpret_cast<char const*>(decodeBytes(p, end, len));
+        val = Value(std::string(data, len));
+        break;
+    }
+    case Type::Pair:
+    {
+        // Every element takes at least one byte, which bounds the count.
+        uint64_t n = decodeVarint(p, end);
+        if (n == 0 || n > static_cast<uint64_t>(end - p))
+        {
+            throw std::runtime_error("malformed list in encoded value");
+        }
+        std::vector<Value> elts(n);
+        for (auto& elt : elts)
+        {
+            decodeValue(p, end, elt);
+        }
+        val = Value(elts);
+        break;
+    }
+    default:
+        throw std::runtime_error("unknown type in encoded value");
+    }
+}
+
 Type
 PairValue::getType() const
 {
@@ -0,0 +1,46 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+// The out-of-process SUT that test_units drives through a RemoteTest. It
+// checks its plan's number as `out` and then, depending on the number,
+// returns normally (1), exits with status 3 (2), aborts (3), hangs (4) or
+// rejects the plan (5).
+
+#include <cstdlib>
+#include <photesthesis/runtime.h>
+#include <unistd.h>
+
+namespace ph = photesthesis;
+
+int
+main()
+{
+    return ph::serveRemote([](ph::RemoteRun& run) {
+        auto [head, n] =
+            run.getParam<std::tuple<ph::Symbol, int64_t>>(ph::Symbol("n"));
+        if (!(head == ph::Symbol("num")))
+        {
+            run.reject();
+        }
+        if (n == 5)
+        {
+            run.reject();
+        }
+        run.check(ph::Symbol("out"), ph::Value::Int64(n));
+        switch (n)
+        {
+        case 2:
+            std::exit(3);
+        case 3:
+            std::abort();
+        case 4:
+            while (true)
+            {
+                pause();
+            }
+        default:
+            break;
+        }
+    });
+}
@@ -0,0 +1,3132 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+// Unit tests for the parts of photesthesis that test_photesthesis, which
+// exercises the engine end to end on a small calculator, does not reach.
+// Each test is a function called from main; a failed EXPECT is reported and
+// counted, and the program exits nonzero if any failed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <photesthesis/campaign.h>
+#include <photesthesis/corpus.h>
+#include <photesthesis/coverage.h>
+#include <photesthesis/decode.h>
+#include <photesthesis/differential.h>
+#include <photesthesis/fasthash.h>
+#include <photesthesis/grammar.h>
+#include <photesthesis/libfuzzer.h>
+#include <photesthesis/match.h>
+#include <photesthesis/random.h>
+#include <photesthesis/remote.h>
+#include <photesthesis/sidecar.h>
+#include <photesthesis/similarity.h>
+#include <photesthesis/stateful.h>
+#include <photesthesis/static_grammar.h>
+#include <photesthesis/status.h>
+#include <photesthesis/test.h>
+#include <photesthesis/util.h>
+#include <photesthesis/value.h>
+
+namespace ph = photesthesis;
+
+// Stands in for the sanitizer runtime's symbolizer, which photesthesis uses
+// when it is linked in, to name the functions of the fake pc-table below.
+extern "C" void __sanitizer_symbolize_pc(void* pc, char const* fmt,
+                                         char* out_buf, size_t out_buf_size);
+
+// Defined by photesthesis in place of the sanitizer runtime's.
+extern "C" void __sanitizer_cov_8bit_counters_init(uint8_t* start,
+                                                   uint8_t* stop);
+extern "C" void __sanitizer_cov_pcs_init(uintptr_t const* start,
+                                         uintptr_t const* stop);
+
+namespace
+{
+size_t gFailures = 0;
+
+void
+expect(bool cond, char const* what, char const* file, int line)
+{
+    if (!cond)
+    {
+        std::cerr << file << ":" << line << ": expected " << what
+                  << std::endl;
+        ++gFailures;
+    }
+}
+
+#define EXPECT(cond) expect((cond), #cond, __FILE__, __LINE__)
+
+const ph::RuleName NUM{"num"};
+const ph::ParamName N{"n"};
+
+// A grammar of small numbers, for tests that need some plan to run.
+ph::Grammar
+numGrammar()
+{
+    ph::Grammar gram;
+    gram.addRule(NUM, {{gram.Int64(1)}, {gram.Int64(2)}, {gram.Int64(3)}});
+    return gram;
+}
+
+// This program is not built with coverage instrumentation, so tests that
+// need coverage counters bump these by hand instead. main registers them as
+// the instrumentation's counters before running any test.
+uint8_t gFakeCounters[64];
+
+// main likewise registers a pc-table dividing the counters among these
+// functions. Each edge's PC is 4 bytes into gFakeCode past the last, and the
+// bytes a function spans stand in for its machine code: copies of a function
+// with the same name have the same bytes.
+struct FakeFunction
+{
+    char const* mName;
+    char const* mFile;
+    size_t mFirstEdge;
+    size_t mNumEdges;
+};
+
+const FakeFunction gFakeFunctions[] = {
+    {"zero", "a.cpp", 0, 1},  {"one", "a.cpp", 1, 1},
+    {"two", "a.cpp", 2, 1},   {"three", "b.cpp", 3, 1},
+    {"rest", "b.cpp", 4, 56}, {"twin", "c.cpp", 60, 2},
+    {"twin", "c.cpp", 62, 2},
+};
+
+uint8_t gFakeCode[4 * sizeof(gFakeCounters)];
+uintptr_t gFakePCs[2 * sizeof(gFakeCounters)];
+
+void
+initFakePCs()
+{
+    for (auto const& fn : gFakeFunctions)
+    {
+        for (size_t i = 0; i < fn.mNumEdges; ++i)
+        {
+            size_t e = fn.mFirstEdge + i;
+            gFakePCs[2 * e] = reinterpret_cast<uintptr_t>(&gFakeCode[4 * e]);
+            gFakePCs[2 * e + 1] = (i == 0) ? 1 : 0;
+            for (size_t j = 0; j < 4; ++j)
+            {
+                uint8_t b = static_cast<uint8_t>(4 * i + j);
+                for (char const* c = fn.mName; *c; ++c)
+                {
+                    b = static_cast<uint8_t>(b * 31 + *c);
+                }
+                gFakeCode[4 * e + j] = b;
+            }
+        }
+    }
+}
+
+FakeFunction const*
+fakeFunctionAt(uintptr_t pc)
+{
+    for (auto const& fn : gFakeFunctions)
+    {
+        auto begin = reinterpret_cast<uintptr_t>(&gFakeCode[4 * fn.mFirstEdge]);
+        if (pc >= begin && pc < begin + 4 * fn.mNumEdges)
+        {
+            return &fn;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+extern "C" void
+__sanitizer_symbolize_pc(void* pc, char const* fmt, char* out_buf,
+                         size_t out_buf_size)
+{
+    FakeFunction const* fn = fakeFunctionAt(reinterpret_cast<uintptr_t>(pc));
+    std::string out;
+    if (fn)
+    {
+        out = std::string(fmt) == "%f" ? fn->mName : fn->mFile;
+    }
+    std::snprintf(out_buf, out_buf_size, "%s", out.c_str());
+}
+
+namespace
+{
+// A plan whose parameter is `(num n)`, as the grammar would generate it.
+ph::Plan
+numPlan(ph::TestName tname, int64_t n)
+{
+    ph::Plan plan(tname);
+    plan.addParam(N, ph::Value(std::vector<ph::Value>{ph::Value(NUM),
+                                                      ph::Value::Int64(n)}));
+    return plan;
+}
+} // namespace
+
+#pragma region // Replay
+
+namespace
+{
+class RejectingTest : public ph::Test
+{
+  public:
+    size_t mRuns{0};
+
+    RejectingTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("RejectingTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        ++mRuns;
+        throw ph::RejectPlan();
+    }
+};
+
+class ThrowingTest : public ph::Test
+{
+  public:
+    bool mThrow{true};
+    size_t mMismatches{0};
+
+    ThrowingTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("ThrowingTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        if (mThrow)
+        {
+            throw std::runtime_error("boom");
+        }
+        check(ph::VarName("n"), getParam(N));
+    }
+
+    void
+    handleTranscriptMismatch(ph::Transcript const& expected,
+                             ph::Transcript const& got) override
+    {
+        ++mMismatches;
+    }
+};
+} // namespace
+
+void
+testReplayForeverStopsWhenAllRejected()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    RejectingTest test(gram, corp);
+    const ph::TestName tname("RejectingTest");
+    corp.addTranscript(ph::Transcript(numPlan(tname, 1)));
+    corp.addTranscript(ph::Transcript(numPlan(tname, 2)));
+    auto timings = test.replay(10, 0);
+    EXPECT(timings.empty());
+    EXPECT(test.mRuns == 2);
+}
+
+void
+testReplayClearsFlagOnException()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    ThrowingTest test(gram, corp);
+    test.mThrow = false;
+    test.administer();
+
+    test.mThrow = true;
+    bool threw = false;
+    try
+    {
+        test.replay(1, 1);
+    }
+    catch (std::runtime_error const&)
+    {
+        threw = true;
+    }
+    EXPECT(threw);
+
+    // Observations are ignored while replaying, so if replay had left that
+    // state behind, every transcript's checks would now be missing.
+    test.mThrow = false;
+    test.administer();
+    EXPECT(test.mMismatches == 0);
+}
+
+void
+testReplayMedianIsMidpoint()
+{
+    // Replay timings and `measure` share this median.
+    using U = std::vector<uint64_t>;
+    EXPECT(ph::sortedMedian(U{5}) == 5);
+    EXPECT(ph::sortedMedian(U{10, 20}) == 15);
+    EXPECT(ph::sortedMedian(U{1, 2, 3, 4}) == 2);
+    EXPECT(ph::sortedMedian(U{UINT64_MAX - 2, UINT64_MAX}) == UINT64_MAX - 1);
+}
+
+#pragma endregion // Replay
+
+#pragma region // Measure
+
+namespace
+{
+// Runs a plan through `administer` against a transcript with no
+// observations, and keeps the transcript it produced instead.
+class MeasureTest : public ph::Test
+{
+  public:
+    std::vector<int64_t> mSamples;
+    ph::Transcript mGot;
+
+    MeasureTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("MeasureTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        measure(ph::VarName("t"), mSamples);
+    }
+
+    void
+    handleTranscriptMismatch(ph::Transcript const& expected,
+                             ph::Transcript const& got) override
+    {
+        mGot = got;
+    }
+};
+
+// Return the (median, mad) that `measure` records for `samples`.
+std::pair<int64_t, int64_t>
+measured(std::vector<int64_t> const& samples)
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    MeasureTest test(gram, corp);
+    test.mSamples = samples;
+    corp.addTranscript(ph::Transcript(numPlan(ph::TestName("MeasureTest"), 1)));
+    test.administer();
+    int64_t median = -1;
+    int64_t mad = -1;
+    auto const& vars = test.mGot.getVars();
+    if (vars.size() == 1)
+    {
+        std::get<1>(vars.at(0)).match(median, mad);
+    }
+    return {median, mad};
+}
+} // namespace
+
+void
+testMeasureMedianAndMad()
+{
+    using P = std::pair<int64_t, int64_t>;
+    EXPECT(measured({7}) == P(7, 0));
+    EXPECT(measured({1, 1}) == P(1, 0));
+    EXPECT(measured({3, 5}) == P(4, 1));
+    EXPECT(measured({5, 3, 1}) == P(3, 2));
+    EXPECT(measured({1, 2, 3, 4}) == P(2, 1));
+    EXPECT(measured({10, 20, 30, 40, 1000}) == P(30, 10));
+    EXPECT(measured({-3, -5}) == P(-4, 1));
+    EXPECT(measured({INT64_MAX - 2, INT64_MAX}) == P(INT64_MAX - 1, 1));
+}
+
+namespace
+{
+// Traces its number and measures how many runs there have been. Each run of
+// a plan is repeated once to check that it is stable, so the first six runs
+// are of three plans; after them, every plan traces a new trajectory.
+class ShiftingMeasureTest : public ph::Test
+{
+  public:
+    int64_t mRuns{0};
+
+    ShiftingMeasureTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("ShiftingMeasureTest"),
+               {{{N, NUM}}, {{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        ++mRuns;
+        trace(ph::VarName("n"), getParam(N));
+        trace(ph::VarName("shifted"), ph::Value::Bool(mRuns > 6));
+        measure(ph::VarName("t"), {mRuns * 1000});
+    }
+};
+} // namespace
+
+void
+testMeasuredTranscriptsDeduplicated()
+{
+    // Both (identical) specs generate the same three plans. The second time,
+    // each has a new trajectory, but its plan is already in the corpus and
+    // its transcript differs only in its measurement.
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    ShiftingMeasureTest test(gram, corp);
+    test.administer();
+    EXPECT(test.mRuns == 12);
+    EXPECT(corp.getTranscripts(ph::TestName("ShiftingMeasureTest")).size() ==
+           3);
+}
+
+#pragma endregion // Measure
+
+#pragma region // CoverageExport
+
+namespace
+{
+// Plan n covers edge n once, in function "one", "two" or "three", and edge
+// 4+n of "rest" n+2 times.
+class ExportTest : public ph::Test
+{
+  public:
+    ExportTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("ExportTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        gFakeCounters[n] = 1;
+        gFakeCounters[4 + n] = static_cast<uint8_t>(n + 2);
+    }
+};
+
+bool
+contains(std::string const& haystack, std::string const& needle)
+{
+    return haystack.find(needle) != std::string::npos;
+}
+} // namespace
+
+void
+testCoverageExportMatchesCounters()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    setenv("PHOTESTHESIS_COVERAGE_EXPORT", "1", 1);
+    ExportTest test(gram, corp);
+    unsetenv("PHOTESTHESIS_COVERAGE_EXPORT");
+    test.administer();
+
+    // Each transcript's edges are its counters, bucketed: 3 runs count as 4
+    // and 4 or 5 as 8.
+    static const ph::Symbol EDGES("edges");
+    const ph::TestName tname("ExportTest");
+    auto const& sidecar = corp.getSidecar("coverage");
+    std::map<int64_t, std::vector<ph::Edge>> expected{
+        {1, {{1, 1}, {5, 4}}}, {2, {{2, 1}, {6, 8}}}, {3, {{3, 1}, {7, 8}}}};
+    for (auto const& pair : expected)
+    {
+        ph::PlanHash hash = numPlan(tname, pair.first).getHashCode();
+        std::string encoded;
+        EXPECT(sidecar.has(tname, hash, EDGES) &&
+               sidecar.get(tname, hash, EDGES).match(encoded));
+        EXPECT(ph::decodeEdges(encoded) == pair.second);
+    }
+
+    std::ostringstream oss;
+    ph::writeCoverageReport(sidecar, oss);
+    std::string report = oss.str();
+    EXPECT(contains(report, "# coverage of 3 transcripts: 6/64 edges (9.4%)"));
+    EXPECT(contains(report, "file: a.cpp 2/3 (66.7%)"));
+    EXPECT(contains(report, "file: b.cpp 4/57 (7.0%)"));
+    EXPECT(contains(report, "file: c.cpp 0/4 (0.0%)"));
+    EXPECT(contains(report, "  0/1 (0.0%) zero\n"));
+    EXPECT(contains(report, "  1/1 (100.0%) one [first covered by"));
+    EXPECT(contains(report, "  3/56 (5.4%) rest [first covered by"));
+}
+
+#pragma endregion // CoverageExport
+
+#pragma region // IncrementalCheck
+
+namespace
+{
+// Plan n covers edge n, in function "one", "two" or "three", and counts its
+// runs in `mRuns`.
+class ImpactTest : public ph::Test
+{
+  public:
+    std::map<int64_t, size_t> mRuns;
+
+    ImpactTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("ImpactTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        gFakeCounters[n] = 1;
+        ++mRuns[n];
+    }
+};
+} // namespace
+
+void
+testFunctionFingerprintsCombineCopies()
+{
+    auto fps = ph::getFunctionFingerprints();
+    EXPECT(fps.size() == 6);
+    // The two identical copies of "twin" must not cancel each other out.
+    EXPECT(fps.at("twin") != 0);
+    EXPECT(fps.at("one") != fps.at("two"));
+}
+
+void
+testIncrementalCheckSkipsUnchanged()
+{
+    static const ph::Symbol FINGERPRINTS("fingerprints");
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    setenv("PHOTESTHESIS_INCREMENTAL_CHECK", "10", 1);
+    ImpactTest test(gram, corp);
+    unsetenv("PHOTESTHESIS_INCREMENTAL_CHECK");
+    ph::TestName tname = ph::TestName("ImpactTest");
+
+    // Initializing records each transcript's functions, and the first check
+    // is a full one, recording the fingerprints it passed with.
+    test.administer(0);
+    test.administer(0);
+    EXPECT(corp.getSidecar("impact").has(tname, 0, FINGERPRINTS));
+
+    // Nothing has changed since, so nothing is checked.
+    test.mRuns.clear();
+    test.administer(0);
+    EXPECT(test.mRuns.empty());
+
+    // Pretend "two" was different when the last check passed: only the
+    // transcript covering it is checked again.
+    std::vector<ph::Value> fps;
+    for (auto const& entry : ph::listElements(
+             corp.getSidecar("impact").get(tname, 0, FINGERPRINTS)))
+    {
+        std::string name;
+        int64_t fp = 0;
+        entry.match(name, fp);
+        if (name == "two")
+        {
+            fp += 1;
+        }
+        fps.emplace_back(std::vector<ph::Value>{ph::Value(name),
+                                                ph::Value::Int64(fp)});
+    }
+    corp.getSidecar("impact").set(tname, 0, FINGERPRINTS, ph::Value(fps));
+    test.mRuns.clear();
+    test.administer(0);
+    EXPECT(test.mRuns.size() == 1 && test.mRuns.count(2) == 1);
+
+    // That check passed and saved the current fingerprints again.
+    test.mRuns.clear();
+    test.administer(0);
+    EXPECT(test.mRuns.empty());
+}
+
+#pragma endregion // IncrementalCheck
+
+#pragma region // Status
+
+namespace
+{
+// Plan 2 is rejected and plan 3 fails an invariant. `mRuns` counts the runs
+// that complete.
+class StatusTest : public ph::Test
+{
+  public:
+    uint64_t mRuns{0};
+
+    StatusTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("StatusTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        if (n == 2)
+        {
+            throw ph::RejectPlan();
+        }
+        gFakeCounters[n] = 1;
+        invariant(ph::VarName("ok"), ph::Value::Bool(true),
+                  ph::Value::Bool(n != 3));
+        ++mRuns;
+    }
+};
+} // namespace
+
+void
+testStatusPageReadBack()
+{
+    // main names the page before any Test opens it.
+    std::string name = std::getenv("PHOTESTHESIS_STATUS");
+    ph::StatusPage const* page = ph::mapStatusPage(name);
+    EXPECT(page != nullptr);
+    if (!page)
+    {
+        return;
+    }
+    auto relaxed = std::memory_order_relaxed;
+    EXPECT(page->mPid == static_cast<uint64_t>(getpid()));
+    uint64_t execs = page->mExecutions.load(relaxed);
+    uint64_t rejections = page->mRejections.load(relaxed);
+    uint64_t failures = page->mFailures.load(relaxed);
+
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    StatusTest test(gram, corp);
+    test.administer(0);
+    EXPECT(page->mExecutions.load(relaxed) - execs == test.mRuns);
+    EXPECT(page->mRejections.load(relaxed) - rejections == 1);
+    EXPECT(page->mFailures.load(relaxed) - failures == 1);
+    EXPECT(page->mTrajectories.load(relaxed) == 2);
+    EXPECT(page->mPhase.load(relaxed) ==
+           static_cast<uint64_t>(ph::StatusPhase::Done));
+    EXPECT(std::string(page->mTestName) == "StatusTest");
+    EXPECT(page->mStartTime.load(relaxed) <= page->mUpdateTime.load(relaxed));
+    ph::unmapStatusPage(page);
+
+    // A segment without the magic number is not a status page.
+    std::string other = name + "-other";
+    int fd = shm_open(other.c_str(), O_CREAT | O_RDWR, 0600);
+    EXPECT(fd >= 0 && ftruncate(fd, sizeof(ph::StatusPage)) == 0);
+    close(fd);
+    EXPECT(ph::mapStatusPage(other) == nullptr);
+    shm_unlink(other.c_str());
+    EXPECT(ph::mapStatusPage(other) == nullptr);
+}
+
+#pragma endregion // Status
+
+#pragma region // TypedObservations
+
+namespace
+{
+template <typename T>
+uint64_t
+structureHash(T const& x)
+{
+    ph::FastHash h(0);
+    ph::addStructureToHash(h, x);
+    return h.hash();
+}
+
+// Every plan traces, checks and tracks the same values, boxed in Values if
+// its number is in `mBoxed` and in their typed forms otherwise. Typed and
+// boxed runs must reach the same trajectory and transcript.
+class TypedObservationTest : public ph::Test
+{
+  public:
+    std::set<int64_t> mBoxed;
+    size_t mMismatches{0};
+
+    TypedObservationTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("TypedObservationTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        ph::VarName const I("i"), S("s"), L("l"), B("b"), P("p"), T("t");
+        std::string str("str");
+        std::vector<int64_t> ints{1, -2, 3};
+        std::vector<std::string> strs{"x", "y"};
+        std::vector<uint8_t> bytes{0, 1, 0xff};
+        if (mBoxed.count(n) != 0)
+        {
+            trace(I, ph::Value::Int64(-7));
+            trace(S, ph::Value(str));
+            trace(L, ph::Value(std::vector<ph::Value>{ph::Value::Int64(1),
+                                                      ph::Value::Int64(-2),
+                                                      ph::Value::Int64(3)}));
+            trace(L, ph::Value(std::vector<ph::Value>{
+                         ph::Value(std::string("x")),
+                         ph::Value(std::string("y"))}));
+            trace(B, ph::Value(bytes));
+            trace(P, ph::Value(bytes));
+            trace(T, ph::Value::Bool(true));
+            check(I, ph::Value::Int64(-7));
+            check(S, ph::Value(str));
+            check(T, ph::Value::Bool(false));
+            track(I, ph::Value::Int64(42));
+            track(S, ph::Value(std::string("tracked")));
+            track(T, ph::Value::Bool(true));
+        }
+        else
+        {
+            trace(I, -7);
+            trace(S, str);
+            trace(L, ints);
+            trace(L, strs);
+            trace(B, bytes);
+            trace(P, bytes.data(), bytes.size());
+            trace(T, true);
+            check(I, int8_t(-7));
+            check(S, "str");
+            check(T, false);
+            track(I, uint32_t(42));
+            track(S, std::string("tracked"));
+            track(T, true);
+        }
+    }
+
+    void
+    handleTranscriptMismatch(ph::Transcript const&,
+                             ph::Transcript const&) override
+    {
+        ++mMismatches;
+    }
+};
+} // namespace
+
+void
+testTypedStructureHashesMatchValues()
+{
+    std::vector<uint8_t> bytes{0, 1, 0xff};
+    std::vector<ph::Value> byteList{ph::Value::Int64(0), ph::Value::Int64(1),
+                                    ph::Value::Int64(0xff)};
+    // A byte vector is a Blob, not a list of its bytes.
+    EXPECT(structureHash(bytes) == structureHash(ph::Value(bytes)));
+    EXPECT(structureHash(bytes) != structureHash(ph::Value(byteList)));
+    EXPECT(structureHash(std::vector<int>{0, 1, 255}) ==
+           structureHash(ph::Value(byteList)));
+    EXPECT(structureHash(int64_t(-7)) ==
+           structureHash(ph::Value::Int64(-7)));
+    EXPECT(structureHash(uint16_t(7)) == structureHash(ph::Value::Int64(7)));
+    EXPECT(structureHash(true) == structureHash(ph::Value::Bool(true)));
+    EXPECT(structureHash(std::string("s")) ==
+           structureHash(ph::Value(std::string("s"))));
+    EXPECT(structureHash(std::string("s")) !=
+           structureHash(ph::Value(ph::Symbol("s"))));
+    EXPECT(structureHash(std::vector<std::vector<int64_t>>{{1}, {}}) ==
+           structureHash(ph::Value(std::vector<ph::Value>{
+               ph::Value(std::vector<ph::Value>{ph::Value::Int64(1)}),
+               ph::Value()})));
+}
+
+void
+testTypedObservationsMatchValues()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    TypedObservationTest test(gram, corp);
+
+    // Plans 2 and 3 are boxed and plan 1 typed, but they all trace the same
+    // trajectory, so initializing the corpus records only one of them.
+    test.mBoxed = {2, 3};
+    test.administer(0);
+    EXPECT(corp.getTranscripts(ph::TestName("TypedObservationTest")).size() ==
+           1);
+
+    // Whichever form recorded the corpus' transcript, the other checks it.
+    test.mBoxed = {};
+    test.administer(0);
+    test.mBoxed = {1, 2, 3};
+    test.administer(0);
+    EXPECT(test.mMismatches == 0);
+}
+
+#pragma endregion // TypedObservations
+
+#pragma region // OnlineCheck
+
+namespace
+{
+// Each plan checks a, b and c in turn. Once `mDiverge` is set, plan 2's b
+// differs from what it was. `mReachedC` counts the runs of plan 2 that got as
+// far as checking c.
+class OnlineTest : public ph::Test
+{
+  public:
+    bool mDiverge{false};
+    size_t mReachedC{0};
+    std::vector<std::pair<size_t, ph::TranscriptVar>> mOnline;
+    std::vector<std::pair<size_t, ph::TranscriptVar>> mPostHoc;
+
+    OnlineTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("OnlineTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        gFakeCounters[n] = 1;
+        check(ph::VarName("a"), n);
+        check(ph::VarName("b"), mDiverge && n == 2 ? 20 : 2);
+        mReachedC += (n == 2);
+        check(ph::VarName("c"), 3);
+    }
+
+    void
+    handleOnlineMismatch(ph::Transcript const&, size_t index,
+                         ph::TranscriptVar const& got) override
+    {
+        mOnline.emplace_back(index, got);
+    }
+
+    // Records the first difference between the transcripts, as found after
+    // the run.
+    void
+    handleTranscriptMismatch(ph::Transcript const& expected,
+                             ph::Transcript const& got) override
+    {
+        auto const& e = expected.getVars();
+        auto const& g = got.getVars();
+        size_t i = 0;
+        while (i < e.size() && i < g.size() && e[i] == g[i])
+        {
+            ++i;
+        }
+        mPostHoc.emplace_back(i, g.at(i));
+    }
+};
+
+// Record a corpus for OnlineTest, then check it with plan 2 diverging and
+// `PHOTESTHESIS_ONLINE_CHECK` set to `mode`.
+std::unique_ptr<OnlineTest>
+checkOnline(ph::Grammar const& gram, ph::Corpus& corp, char const* mode,
+            std::vector<ph::PlanHash>& failures)
+{
+    OnlineTest(gram, corp).administer(0);
+    setenv("PHOTESTHESIS_ONLINE_CHECK", mode, 1);
+    auto test = std::make_unique<OnlineTest>(gram, corp);
+    unsetenv("PHOTESTHESIS_ONLINE_CHECK");
+    test->mDiverge = true;
+    failures = test->administer(0);
+    return test;
+}
+} // namespace
+
+void
+testOnlineCheckMatchesPostHocDiff()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp0, corp1, corp2;
+    std::vector<ph::PlanHash> failures0, failures1, failures2;
+    auto postHoc = checkOnline(gram, corp0, "0", failures0);
+    auto aborting = checkOnline(gram, corp1, "1", failures1);
+    auto reporting = checkOnline(gram, corp2, "2", failures2);
+
+    // Without online checking, the run finishes and the diff finds b.
+    EXPECT(postHoc->mOnline.empty());
+    EXPECT(postHoc->mPostHoc.size() == 1);
+    EXPECT(postHoc->mReachedC > 0);
+    EXPECT(failures0.empty());
+    auto const& diff = postHoc->mPostHoc.at(0);
+    EXPECT(diff.first == 1);
+
+    // Mode 1 reports the same divergence and aborts the run there, failing
+    // the transcript rather than recording a new one.
+    EXPECT(aborting->mOnline.size() == 1);
+    EXPECT(aborting->mOnline.at(0) == diff);
+    EXPECT(aborting->mReachedC == 0);
+    EXPECT(aborting->mPostHoc.empty());
+    ph::PlanHash hash2 = numPlan(ph::TestName("OnlineTest"), 2).getHashCode();
+    EXPECT(failures1 == std::vector<ph::PlanHash>{hash2});
+
+    // Mode 2 reports it in every run, but lets the runs finish and records
+    // the same new transcript as the post-hoc check.
+    EXPECT(!reporting->mOnline.empty());
+    for (auto const& online : reporting->mOnline)
+    {
+        EXPECT(online == diff);
+    }
+    EXPECT(reporting->mReachedC > 0);
+    EXPECT(reporting->mPostHoc == postHoc->mPostHoc);
+    EXPECT(failures2.empty());
+    EXPECT(corp2.getTranscripts(ph::TestName("OnlineTest")) ==
+           corp0.getTranscripts(ph::TestName("OnlineTest")));
+}
+
+#pragma endregion // OnlineCheck
+
+#pragma region // Scheduling
+
+namespace
+{
+// Plans take longer the larger their number, and fail an invariant if their
+// number is in `mFailing`. `mOrder` records the order they are checked in.
+class ScheduledTest : public ph::Test
+{
+  public:
+    std::set<int64_t> mFailing;
+    std::vector<int64_t> mOrder;
+
+    ScheduledTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("ScheduledTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        // Each plan is run again to check its stability; record it once.
+        if (mOrder.empty() || mOrder.back() != n)
+        {
+            mOrder.emplace_back(n);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20 * n));
+        invariant(ph::VarName("ok"), ph::Value::Bool(true),
+                  ph::Value::Bool(mFailing.count(n) == 0));
+    }
+};
+} // namespace
+
+void
+testScheduleRecentFailuresFirst()
+{
+    setenv("PHOTESTHESIS_SCHEDULE", "1", 1);
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    ScheduledTest test(gram, corp);
+    unsetenv("PHOTESTHESIS_SCHEDULE");
+    const ph::TestName tname("ScheduledTest");
+    for (int64_t n = 1; n <= 3; ++n)
+    {
+        corp.addTranscript(ph::Transcript(numPlan(tname, n)));
+    }
+    auto round = [&](std::set<int64_t> failing) {
+        test.mFailing = failing;
+        test.mOrder.clear();
+        test.administer();
+        return test.mOrder;
+    };
+    using V = std::vector<int64_t>;
+
+    // Once runtimes are known, transcripts are checked longest first.
+    round({1});
+    EXPECT(round({}) == V({1, 3, 2}));
+    // 1 failed in the first round but passed in the second, so it no longer
+    // goes first.
+    EXPECT(round({}) == V({3, 2, 1}));
+    // The most recent failure goes first.
+    round({1, 2});
+    round({2});
+    EXPECT(round({}) == V({2, 3, 1}));
+}
+
+#pragma endregion // Scheduling
+
+#pragma region // Sharding
+
+namespace
+{
+const ph::TestName SHAPE_TEST{"ShapeTest"};
+
+// Each plan traces a list as long as its number, so that every plan has a
+// trajectory of its own, and checks the number.
+class ShapeTest : public ph::Test
+{
+  public:
+    ShapeTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, SHAPE_TEST, {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        trace(ph::VarName("shape"),
+              ph::Value(std::vector<ph::Value>(n, ph::Value::Int64(0))));
+        check(ph::VarName("n"), getParam(N));
+    }
+};
+
+// Stale transcripts of plans 1 and 2, which checking will update.
+void
+seedShapeCorpus(ph::Corpus& corp)
+{
+    corp.addTranscript(ph::Transcript(numPlan(SHAPE_TEST, 1)));
+    corp.addTranscript(ph::Transcript(numPlan(SHAPE_TEST, 2)));
+}
+
+void
+administerShape(ph::Corpus& corp, uint64_t index, uint64_t count,
+                uint64_t expansionSteps)
+{
+    ph::Grammar gram = numGrammar();
+    ShapeTest test(gram, corp);
+    test.seedWithValue(1);
+    if (count > 1)
+    {
+        test.setShard(index, count);
+    }
+    test.administer(expansionSteps);
+}
+} // namespace
+
+void
+testShardMergeMatchesUnsharded()
+{
+    ph::Corpus whole, base, shard0, shard1, merged;
+    for (auto corp : {&whole, &base, &shard0, &shard1, &merged})
+    {
+        seedShapeCorpus(*corp);
+    }
+    administerShape(whole, 0, 1, 0);
+    // Shards are asked to expand, but must only check: plan 3 has a new
+    // trajectory, which neither shard can tell is new.
+    administerShape(shard0, 0, 2, 50);
+    administerShape(shard1, 1, 2, 50);
+    merged.mergeChanges(base, shard0);
+    merged.mergeChanges(base, shard1);
+    EXPECT(whole.getTranscripts(SHAPE_TEST).size() == 2);
+    EXPECT(merged.getTranscripts(SHAPE_TEST) ==
+           whole.getTranscripts(SHAPE_TEST));
+
+    // Shards do not initialize an empty corpus either.
+    ph::Corpus empty;
+    administerShape(empty, 0, 2, 50);
+    EXPECT(empty.getTranscripts(SHAPE_TEST).empty());
+}
+
+#pragma endregion // Sharding
+
+#pragma region // Differential
+
+namespace
+{
+// The reference and optimized implementations both square the plan's number.
+// Only the reference covers an edge and traces a value of its own for each
+// plan. With `mDiverge` the optimized one gets 3 wrong, and with `mExtra` it
+// makes an extra observation for 2.
+class SquareTest : public ph::DifferentialTest
+{
+  public:
+    struct Divergence
+    {
+        int64_t mN;
+        size_t mIndex;
+        std::optional<ph::TranscriptVar> mReference;
+        std::optional<ph::TranscriptVar> mOptimized;
+    };
+
+    bool mDiverge{false};
+    bool mExtra{false};
+    std::vector<Divergence> mDivergences;
+
+    SquareTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : DifferentialTest(gram, corp, ph::TestName("SquareTest"),
+                           {{{N, NUM}}})
+    {
+    }
+
+    int64_t
+    number()
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        return n;
+    }
+
+    void
+    runReference() override
+    {
+        int64_t n = number();
+        gFakeCounters[10 + n] = 1;
+        trace(ph::VarName("ref"), n);
+        check(ph::VarName("sq"), n * n);
+        check(ph::VarName("op"), "square");
+    }
+
+    void
+    runOptimized() override
+    {
+        int64_t n = number();
+        check(ph::VarName("sq"), mDiverge && n == 3 ? 8 : n * n);
+        check(ph::VarName("op"), "square");
+        if (mExtra && n == 2)
+        {
+            check(ph::VarName("extra"), true);
+        }
+    }
+
+    void
+    handleDivergence(ph::Plan const&, size_t index,
+                     ph::TranscriptVar const* reference,
+                     ph::TranscriptVar const* optimized) override
+    {
+        Divergence d{number(), index, std::nullopt, std::nullopt};
+        if (reference)
+        {
+            d.mReference = *reference;
+        }
+        if (optimized)
+        {
+            d.mOptimized = *optimized;
+        }
+        mDivergences.emplace_back(d);
+    }
+};
+} // namespace
+
+void
+testDifferentialAgreeing()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    SquareTest test(gram, corp);
+    // The reference run's coverage and traces are discarded, so every plan
+    // has the optimized run's one trajectory, and initializing the corpus
+    // records only one of them.
+    EXPECT(test.administer(0).empty());
+    EXPECT(corp.getTranscripts(ph::TestName("SquareTest")).size() == 1);
+    EXPECT(test.mDivergences.empty());
+}
+
+void
+testDifferentialDiverging()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    SquareTest test(gram, corp);
+    test.mDiverge = true;
+    test.mExtra = true;
+    auto failures = test.administer(0);
+    std::set<ph::PlanHash> failed(failures.begin(), failures.end());
+    const ph::TestName tname("SquareTest");
+    EXPECT(failed ==
+           std::set<ph::PlanHash>({numPlan(tname, 2).getHashCode(),
+                                   numPlan(tname, 3).getHashCode()}));
+
+    bool sawWrong = false, sawExtra = false;
+    for (auto const& d : test.mDivergences)
+    {
+        if (d.mN == 3)
+        {
+            EXPECT(d.mIndex == 0 && d.mReference && d.mOptimized);
+            EXPECT(std::get<1>(*d.mReference) == ph::Value::Int64(9));
+            EXPECT(std::get<1>(*d.mOptimized) == ph::Value::Int64(8));
+            sawWrong = true;
+        }
+        else
+        {
+            EXPECT(d.mN == 2 && d.mIndex == 2);
+            EXPECT(!d.mReference && d.mOptimized);
+            sawExtra = true;
+        }
+    }
+    EXPECT(sawWrong && sawExtra);
+}
+
+#pragma endregion // Differential
+
+#pragma region // Stateful
+
+namespace
+{
+const ph::RuleName SEQ{"seq"};
+const ph::RuleName CMD{"cmd"};
+const ph::Symbol INC{"inc"};
+const ph::Symbol DBL{"dbl"};
+const ph::ParamName CMDS{"cmds"};
+
+ph::Grammar
+seqGrammar()
+{
+    ph::Grammar gram;
+    gram.addRule(SEQ, {{gram.Int64(0)}, {gram.Ref(CMD), gram.Ref(SEQ)}});
+    gram.addRule(CMD,
+                 {{gram.Sym(INC), gram.Int64(1)},
+                  {gram.Sym(INC), gram.Int64(2)},
+                  {gram.Sym(DBL)}});
+    return gram;
+}
+
+ph::Value
+incCmd(int64_t n)
+{
+    return ph::Value(
+        std::vector<ph::Value>{ph::Value(CMD), ph::Value(INC),
+                               ph::Value::Int64(n)});
+}
+
+ph::Value
+dblCmd()
+{
+    return ph::Value(std::vector<ph::Value>{ph::Value(CMD), ph::Value(DBL)});
+}
+
+// A plan running `cmds` in order, as the right-recursive SEQ rule derives
+// them.
+ph::Plan
+seqPlan(ph::TestName tname, std::vector<ph::Value> const& cmds)
+{
+    ph::Value seq(std::vector<ph::Value>{ph::Value(SEQ), ph::Value::Int64(0)});
+    for (auto i = cmds.rbegin(); i != cmds.rend(); ++i)
+    {
+        seq = ph::Value(std::vector<ph::Value>{ph::Value(SEQ), *i, seq});
+    }
+    ph::Plan plan(tname);
+    plan.addParam(CMDS, seq);
+    return plan;
+}
+
+// A counter SUT. Each command bumps a coverage counter of its own, and
+// checks and traces the counter's value.
+class CounterTest : public ph::StatefulTest
+{
+    int64_t mValue{0};
+
+  public:
+    ph::Transcript mGot;
+
+    CounterTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : StatefulTest(gram, corp, ph::TestName("CounterTest"), CMDS, SEQ)
+    {
+    }
+
+    void
+    reset() override
+    {
+        mValue = 0;
+    }
+
+    void
+    apply(ph::Value command) override
+    {
+        int64_t n = 0;
+        if (command.match(CMD, INC, n))
+        {
+            mValue += n;
+            gFakeCounters[n] += 1;
+        }
+        else
+        {
+            mValue *= 2;
+            gFakeCounters[10] += 1;
+        }
+        trace(ph::VarName("shape"),
+              ph::Value(std::vector<ph::Value>(mValue % 4, ph::Value())));
+        check(ph::VarName("value"), mValue);
+    }
+
+    std::any
+    snapshot() override
+    {
+        return mValue;
+    }
+
+    void
+    restore(std::any const& snapshot) override
+    {
+        mValue = std::any_cast<int64_t>(snapshot);
+    }
+
+    void
+    handleTranscriptMismatch(ph::Transcript const& expected,
+                             ph::Transcript const& got) override
+    {
+        mGot = got;
+    }
+};
+
+struct StatefulOutcome
+{
+    ph::Trajectory mTrajectory{0};
+    ph::Transcript mTranscript;
+    uint64_t mReused{0};
+    uint64_t mStabilityStepsApplied{0};
+};
+
+// Run `warm` and then `plan`, and check `plan` against a transcript with no
+// observations, returning what it observed.
+StatefulOutcome
+runCounter(std::vector<ph::Plan> const& warm, ph::Plan const& plan,
+           uint64_t maxSnapshots)
+{
+    ph::Grammar gram = seqGrammar();
+    ph::Corpus corp;
+    CounterTest test(gram, corp);
+    test.setMaxSnapshots(maxSnapshots);
+    for (auto const& w : warm)
+    {
+        test.runOnce(w);
+    }
+    StatefulOutcome out;
+    out.mTrajectory = test.runOnce(plan);
+    corp.addTranscript(ph::Transcript(plan));
+    uint64_t applied = test.getStepsApplied();
+    test.administer();
+    out.mStabilityStepsApplied = test.getStepsApplied() - applied;
+    out.mTranscript = test.mGot;
+    out.mReused = test.getStepsReused();
+    return out;
+}
+} // namespace
+
+void
+testStatefulPrefixReuseMatchesColdRun()
+{
+    ph::TestName tname("CounterTest");
+    std::vector<ph::Plan> warm{
+        seqPlan(tname, {incCmd(1), incCmd(2), dblCmd()}),
+        seqPlan(tname, {incCmd(1), dblCmd(), incCmd(2)})};
+    ph::Plan plan =
+        seqPlan(tname, {incCmd(1), incCmd(2), incCmd(1), dblCmd(), incCmd(2)});
+
+    StatefulOutcome shared = runCounter(warm, plan, 1024);
+    StatefulOutcome cold = runCounter(warm, plan, 0);
+    EXPECT(shared.mReused != 0);
+    EXPECT(cold.mReused == 0);
+    EXPECT(shared.mTrajectory == cold.mTrajectory);
+    EXPECT(shared.mTranscript == cold.mTranscript);
+    EXPECT(shared.mTranscript.getVars().size() == 5);
+
+    // Checking restores the whole plan from its cached state, but the
+    // stability re-run applies every command again.
+    EXPECT(shared.mStabilityStepsApplied == 5);
+}
+
+#pragma endregion // Stateful
+
+#pragma region // Campaign
+
+namespace
+{
+const ph::RuleName DIGIT{"digit"};
+const ph::RuleName DIGITS{"digits"};
+
+// A grammar of three-digit numbers, with plenty of plans to expand into.
+ph::Grammar
+digitsGrammar()
+{
+    ph::Grammar gram;
+    gram.addRule(DIGIT, {{gram.Int64(0)},
+                         {gram.Int64(1)},
+                         {gram.Int64(2)},
+                         {gram.Int64(3)},
+                         {gram.Int64(4)},
+                         {gram.Int64(5)},
+                         {gram.Int64(6)},
+                         {gram.Int64(7)},
+                         {gram.Int64(8)},
+                         {gram.Int64(9)}});
+    gram.addRule(DIGITS,
+                 {{gram.Ref(DIGIT), gram.Ref(DIGIT), gram.Ref(DIGIT)}});
+    return gram;
+}
+
+// Records every number it runs. If `mNovel`, it traces the number, so that
+// every new plan finds a new trajectory; otherwise it has only the one.
+class DigitsTest : public ph::Test
+{
+  public:
+    bool mNovel;
+    std::vector<ph::Value> mRuns;
+
+    DigitsTest(ph::Grammar const& gram, ph::Corpus& corp, std::string name,
+               bool novel = true)
+        : Test(gram, corp, ph::TestName(name), {{{N, DIGITS}}})
+        , mNovel(novel)
+    {
+    }
+
+    void
+    run() override
+    {
+        mRuns.emplace_back(getParam(N));
+        if (mNovel)
+        {
+            trace(ph::VarName("n"), getParam(N));
+        }
+    }
+};
+
+bool
+isPrefix(std::vector<ph::Value> const& a, std::vector<ph::Value> const& b)
+{
+    return a.size() <= b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+} // namespace
+
+void
+testCampaignFavoursNovelArm()
+{
+    ph::Grammar gram = digitsGrammar();
+    ph::Corpus corp;
+    DigitsTest barren(gram, corp, "Barren", false);
+    DigitsTest novel(gram, corp, "Novel", true);
+    ph::Campaign campaign;
+    campaign.add(barren);
+    campaign.add(novel);
+    campaign.setBatchSteps(5);
+    setenv("PHOTESTHESIS_RANDOM_SEED", "1", 1);
+    EXPECT(campaign.run(0, 200).empty());
+    unsetenv("PHOTESTHESIS_RANDOM_SEED");
+    EXPECT(novel.mRuns.size() > 3 * barren.mRuns.size());
+}
+
+void
+testCampaignWorkersDrawDisjointStreams()
+{
+    ph::Grammar gram = digitsGrammar();
+    setenv("PHOTESTHESIS_RANDOM_SEED", "1", 1);
+    auto runTests = [&](uint64_t index, uint64_t count) {
+        ph::Corpus corp;
+        std::vector<std::unique_ptr<DigitsTest>> tests;
+        ph::Campaign campaign;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            tests.emplace_back(std::make_unique<DigitsTest>(
+                gram, corp, "Digits" + std::to_string(i)));
+            campaign.add(*tests.back());
+        }
+        campaign.setBatchSteps(5);
+        campaign.setWorker(index, count);
+        campaign.run(0, 100);
+        std::vector<std::vector<ph::Value>> runs;
+        for (auto const& test : tests)
+        {
+            runs.emplace_back(test->mRuns);
+        }
+        return runs;
+    };
+    auto whole = runTests(0, 1);
+    auto worker0 = runTests(0, 2);
+    auto worker1 = runTests(1, 2);
+    unsetenv("PHOTESTHESIS_RANDOM_SEED");
+
+    // Each worker runs only its own tests, and each test draws the same
+    // stream whichever worker runs it: they differ only in how far each
+    // test gets with its share of the budget.
+    for (size_t i = 0; i < 4; ++i)
+    {
+        auto const& mine = (i % 2 == 0) ? worker0[i] : worker1[i];
+        auto const& other = (i % 2 == 0) ? worker1[i] : worker0[i];
+        EXPECT(!mine.empty());
+        EXPECT(other.empty());
+        EXPECT(isPrefix(mine, whole[i]) || isPrefix(whole[i], mine));
+    }
+    // And no two tests draw the same stream.
+    for (size_t i = 0; i < 4; ++i)
+    {
+        for (size_t j = i + 1; j < 4; ++j)
+        {
+            EXPECT(whole[i] != whole[j]);
+        }
+    }
+}
+
+#pragma endregion // Campaign
+
+#pragma region // Shrink
+
+const ph::RuleName ADD{"add"};
+const ph::RuleName LET{"let"};
+const ph::RuleName VAR{"var"};
+const ph::RuleName EXPR{"expr"};
+const ph::ParamName X{"x"};
+const ph::ParamName Y{"y"};
+
+// The example grammar from static_grammar.h: recursive, and with a
+// production guarded by context.
+ph::Grammar
+exprGrammar()
+{
+    ph::Grammar gram;
+    gram.addRule(ADD, {{gram.Int64(0)}, {gram.Ref(EXPR), gram.Ref(EXPR)}});
+    gram.addRule(
+        LET, {{gram.Int64(0)},
+              {gram.Sym(X), gram.Ref(EXPR), addContext(X, gram.Ref(EXPR))}});
+    gram.addRule(VAR, {{gram.Sym(X)}});
+    gram.addRule(EXPR, {{gram.Int64(1)},
+                        {gram.Ref(ADD)},
+                        {gram.Ref(LET)},
+                        inContext(X, {gram.Ref(VAR)})});
+    return gram;
+}
+
+namespace
+{
+// Evaluate an expression from exprGrammar, in which a `let` binds the value
+// of its first expression to `x` in its second, with a Value::match chain.
+int64_t
+evalByMatch(ph::Value val, std::vector<int64_t>& xs)
+{
+    ph::Value a, b, c;
+    int64_t i = 0;
+    if (val.match(EXPR, a))
+    {
+        if (a.match(ADD, b, c))
+        {
+            return evalByMatch(b, xs) + evalByMatch(c, xs);
+        }
+        if (a.match(LET, X, b, c))
+        {
+            xs.emplace_back(evalByMatch(b, xs));
+            i = evalByMatch(c, xs);
+            xs.pop_back();
+            return i;
+        }
+        if (a.match(VAR, X))
+        {
+            return xs.back();
+        }
+        if (a.match(i))
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Fails an invariant if its expression evaluates to 3 or more, or with
+// `mCrash`, aborts; with `mThrow`, throws instead.
+class ShrinkTest : public ph::Test
+{
+  public:
+    bool mCrash{false};
+    bool mThrow{false};
+
+    ShrinkTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("ShrinkTest"), {{{N, EXPR}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        std::vector<int64_t> xs;
+        int64_t v = evalByMatch(getParam(N), xs);
+        if (v >= 3 && mCrash)
+        {
+            std::abort();
+        }
+        if (v >= 3 && mThrow)
+        {
+            throw std::runtime_error("too big");
+        }
+        invariant(ph::VarName("small"), ph::Value::Bool(true),
+                  ph::Value::Bool(v < 3));
+    }
+};
+
+ph::Value
+parseValue(std::string const& text)
+{
+    std::istringstream iss(text);
+    ph::Value v;
+    iss >> v;
+    return v;
+}
+
+ph::Plan
+exprPlan(ph::TestName tname, std::string const& text)
+{
+    ph::Plan plan(tname);
+    plan.addParam(N, parseValue(text));
+    return plan;
+}
+
+// `let x = 1 + 1 in x + (x + 1)`, which is 5.
+const char* const BIG_EXPR =
+    "(expr (let x (expr (add (expr 1) (expr 1)))"
+    " (expr (add (expr (var x)) (expr (add (expr (var x)) (expr 1)))))))";
+// The smallest expression that is 3: there are no smaller literals, and a let
+// only adds to the size of an addition.
+const char* const SMALLEST_3 =
+    "(expr (add (expr 1) (expr (add (expr 1) (expr 1)))))";
+
+bool
+simpler(ph::Value const& a, ph::Value const& b)
+{
+    size_t sa = a.getSize(), sb = b.getSize();
+    return sa < sb || (sa == sb && a < b);
+}
+} // namespace
+
+void
+testShrinkFindsMinimalPlan()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::Corpus corp;
+    ShrinkTest test(gram, corp);
+    ph::ParamSpecs specs{{N, EXPR}};
+    std::vector<int64_t> xs;
+    EXPECT(gram.derives(EXPR, parseValue(BIG_EXPR), specs));
+    EXPECT(gram.derives(EXPR, parseValue(SMALLEST_3), specs));
+    EXPECT(evalByMatch(parseValue(BIG_EXPR), xs) == 5);
+    EXPECT(evalByMatch(parseValue(SMALLEST_3), xs) == 3);
+
+    ph::Plan big = exprPlan(test.getTestName(), BIG_EXPR);
+    ph::Plan small = test.shrink(big);
+    EXPECT(small == exprPlan(test.getTestName(), SMALLEST_3));
+
+    // A passing plan is returned unchanged.
+    ph::Plan passing = exprPlan(test.getTestName(), "(expr 1)");
+    EXPECT(test.shrink(passing) == passing);
+}
+
+void
+testReductionsAreSimplerDerivations()
+{
+    ph::ParamSpecs specs{{N, EXPR}};
+    ph::Grammar gram = exprGrammar();
+    // A context-free grammar of the same shape, without let.
+    ph::Grammar cf;
+    cf.addRule(ADD, {{cf.Int64(0)}, {cf.Ref(EXPR), cf.Ref(EXPR)}});
+    cf.addRule(EXPR, {{cf.Int64(1)}, {cf.Int64(2)}, {cf.Ref(ADD)}});
+
+    size_t nReductions = 0, nValid = 0;
+    for (auto* g : {&gram, &cf})
+    {
+        for (uint64_t seed = 0; seed < 50; ++seed)
+        {
+            ph::RandomEngine gen(seed);
+            ph::Value v =
+                g->randomlyPopulatePlan(ph::TestName("T"), specs, gen, 5)
+                    .getParams()
+                    .at(0)
+                    .second;
+            for (size_t level = 0;; ++level)
+            {
+                std::vector<ph::Reduction> out;
+                if (g->reductions(EXPR, v, specs, level, out) == 0)
+                {
+                    break;
+                }
+                for (auto const& r : out)
+                {
+                    ph::Value reduced = ph::replaceAtPath(v, r.mPath,
+                                                          r.mReplacement);
+                    EXPECT(simpler(reduced, v));
+                    bool valid = g->derives(EXPR, reduced, specs);
+                    // Only a context-sensitive grammar can have reductions
+                    // that aren't derivations, such as a var moved out of
+                    // its let.
+                    EXPECT(valid || g == &gram);
+                    ++nReductions;
+                    nValid += valid;
+                }
+            }
+        }
+    }
+    EXPECT(nReductions > 0 && nValid > 0);
+}
+
+void
+testReplaceAtPathChecksRange()
+{
+    ph::Value v = parseValue("(expr (add (expr 1) (expr 1)))");
+    ph::Value one = parseValue("(expr 1)");
+    EXPECT(ph::replaceAtPath(v, {1, 2}, one) == v);
+    EXPECT(ph::replaceAtPath(v, {}, one) == one);
+    for (auto const& path : std::vector<std::vector<size_t>>{
+             {2}, {1, 3}, {1, 1, 1, 1}})
+    {
+        bool threw = false;
+        try
+        {
+            ph::replaceAtPath(v, path, one);
+        }
+        catch (std::runtime_error const&)
+        {
+            threw = true;
+        }
+        EXPECT(threw);
+    }
+}
+
+void
+testShrinkCrashingPlan()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::Corpus corp;
+    ShrinkTest test(gram, corp);
+    ph::Plan big = exprPlan(test.getTestName(), BIG_EXPR);
+    ph::Plan smallest = exprPlan(test.getTestName(), SMALLEST_3);
+
+    // The plan aborts, so it and every candidate is run in a forked child,
+    // and the candidates that crash count as failing like it.
+    test.mCrash = true;
+    EXPECT(test.shrink(big) == smallest);
+
+    // With forking disabled, a plan that throws is shrunk in process, and
+    // doesn't shrink to a plan that fails an invariant instead.
+    setenv("PHOTESTHESIS_SHRINK_FORK", "0", 1);
+    ShrinkTest inProcess(gram, corp);
+    unsetenv("PHOTESTHESIS_SHRINK_FORK");
+    inProcess.mThrow = true;
+    EXPECT(inProcess.shrink(big) == smallest);
+}
+
+#pragma endregion // Shrink
+
+#pragma region // Grammar
+
+void
+testChoicesDecodeToSamePlan()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::TestName tname("ChoiceTest");
+    ph::ParamSpecs specs{{Y, EXPR}, {N, EXPR}};
+    for (uint64_t seed = 0; seed < 200; ++seed)
+    {
+        ph::RandomEngine gen(seed);
+        std::vector<uint8_t> choices;
+        ph::Plan plan = gram.randomlyPopulatePlan(tname, specs, gen, 6, choices);
+
+        ph::ChoiceSequence seq(choices);
+        EXPECT(gram.populatePlanFromChoices(tname, specs, seq, 6) == plan);
+        EXPECT(seq.getPosition() == choices.size());
+
+        // Recording draws exactly as generating without recording does.
+        ph::RandomEngine again(seed);
+        EXPECT(gram.randomlyPopulatePlan(tname, specs, again, 6) == plan);
+
+        // Any prefix of the choices still decodes to some plan.
+        ph::ChoiceSequence prefix(choices.data(), choices.size() / 2);
+        gram.populatePlanFromChoices(tname, specs, prefix, 6);
+    }
+}
+
+#pragma endregion // Grammar
+
+#pragma region // LibFuzzer
+
+namespace
+{
+// Traces the value of its expression, so that each value is a trajectory;
+// rejects plans whose value is `mReject` and fails those whose value is
+// `mFail`.
+class FuzzedTest : public ph::Test
+{
+  public:
+    int64_t mReject{-1};
+    int64_t mFail{-1};
+
+    FuzzedTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("FuzzedTest"), {{{N, EXPR}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        std::vector<int64_t> xs;
+        int64_t v = evalByMatch(getParam(N), xs);
+        if (v == mReject)
+        {
+            throw ph::RejectPlan();
+        }
+        trace(ph::VarName("v"), v);
+        invariant(ph::VarName("ok"), ph::Value::Bool(true),
+                  ph::Value::Bool(v != mFail));
+    }
+};
+} // namespace
+
+void
+testFuzzTargetRecordsNewTrajectories()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::Corpus corp;
+    ph::ParamSpecs specs{{N, EXPR}};
+    setenv("PHOTESTHESIS_RECORD_CHOICES", "1", 1);
+    FuzzedTest test(gram, corp);
+    unsetenv("PHOTESTHESIS_RECORD_CHOICES");
+    test.mReject = 2;
+    ph::FuzzTarget target(test, specs, 5);
+    target.initialize();
+    // Initializing the corpus records k-path plans, which have no choices.
+    std::set<ph::Transcript> initial = corp.getTranscripts(test.getTestName());
+
+    std::set<int64_t> seen;
+    size_t rejected = 0;
+    for (uint64_t seed = 0; seed < 100; ++seed)
+    {
+        ph::RandomEngine gen(seed);
+        std::vector<uint8_t> choices;
+        ph::Plan plan = gram.randomlyPopulatePlan(test.getTestName(), specs,
+                                                  gen, 5, choices);
+        std::vector<int64_t> xs;
+        int64_t v = evalByMatch(plan.getParams().at(0).second, xs);
+        // Trailing bytes the plan doesn't read are ignored.
+        choices.push_back(0xff);
+        int rc = target.testOneInput(choices.data(), choices.size());
+        EXPECT(rc == (v == 2 ? -1 : 0));
+        if (v == 2)
+        {
+            ++rejected;
+        }
+        else
+        {
+            seen.insert(v);
+        }
+    }
+    EXPECT(rejected > 0 && seen.size() > 2);
+
+    // One transcript per value, and those the fuzzer added have recorded
+    // choices that are exactly those their plan read.
+    auto const& transcripts = corp.getTranscripts(test.getTestName());
+    EXPECT(test.getTrajectoryCount() == transcripts.size());
+    std::set<int64_t> values;
+    size_t added = 0;
+    for (auto const& t : transcripts)
+    {
+        std::vector<int64_t> xs;
+        values.insert(evalByMatch(t.getPlan().getParams().at(0).second, xs));
+        if (initial.count(t) != 0)
+        {
+            continue;
+        }
+        ++added;
+        std::vector<uint8_t> choices;
+        uint64_t depth = 0;
+        EXPECT(test.getChoices(t.getPlan(), choices, depth));
+        EXPECT(depth == 5);
+        EXPECT(test.planFromChoices(specs, choices.data(), choices.size(),
+                                    5) == t.getPlan());
+    }
+    EXPECT(values.size() == transcripts.size());
+    EXPECT(added > 0);
+    EXPECT(std::includes(values.begin(), values.end(), seen.begin(),
+                         seen.end()));
+}
+
+void
+testFuzzTargetMutatesWholeDecisions()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::Corpus corp;
+    ph::ParamSpecs specs{{N, EXPR}};
+    FuzzedTest test(gram, corp);
+    ph::FuzzTarget target(test, specs, 5);
+
+    size_t changed = 0;
+    for (uint64_t seed = 0; seed < 100; ++seed)
+    {
+        ph::RandomEngine gen(seed);
+        std::vector<uint8_t> choices;
+        gram.randomlyPopulatePlan(test.getTestName(), specs, gen, 5, choices);
+        // Every few inputs have bytes appended that the plan doesn't read.
+        for (size_t i = 0; i < seed % 3; ++i)
+        {
+            choices.push_back(static_cast<uint8_t>(seed));
+        }
+
+        std::vector<uint8_t> a(choices), b(choices);
+        a.resize(4096);
+        b.resize(4096);
+        size_t na = target.mutate(a.data(), choices.size(), a.size(),
+                                  static_cast<unsigned>(seed));
+        size_t nb = target.mutate(b.data(), choices.size(), b.size(),
+                                  static_cast<unsigned>(seed));
+        a.resize(na);
+        b.resize(nb);
+        EXPECT(a == b);
+
+        // The output is exactly the choices of the plan it decodes to.
+        ph::ChoiceSequence seq(a);
+        ph::Plan plan =
+            gram.populatePlanFromChoices(test.getTestName(), specs, seq, 5);
+        EXPECT(seq.getPosition() == a.size());
+        EXPECT(gram.derives(EXPR, plan.getParams().at(0).second, specs));
+        changed += a != choices;
+
+        // Output is truncated to fit.
+        std::vector<uint8_t> c(choices);
+        EXPECT(target.mutate(c.data(), c.size(), 1,
+                             static_cast<unsigned>(seed)) <= 1);
+    }
+    EXPECT(changed > 0);
+}
+
+void
+testFuzzTargetAbortsOnFailure()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::Corpus corp;
+    ph::ParamSpecs specs{{N, EXPR}};
+    FuzzedTest test(gram, corp);
+    test.mFail = 1;
+    ph::FuzzTarget target(test, specs, 5);
+    target.initialize();
+
+    // The first choice picks `(expr 1)`.
+    std::vector<uint8_t> choices{0};
+    EXPECT(test.planFromChoices(specs, choices.data(), choices.size(), 5) ==
+           exprPlan(test.getTestName(), "(expr 1)"));
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::freopen("/dev/null", "w", stderr);
+        target.testOneInput(choices.data(), choices.size());
+        _exit(0);
+    }
+    int status = 0;
+    EXPECT(waitpid(pid, &status, 0) == pid);
+    EXPECT(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+
+#pragma endregion // LibFuzzer
+
+#pragma region // Value
+
+ph::Value
+reread(ph::Value const& v)
+{
+    std::stringstream ss;
+    ss << v;
+    ph::Value out;
+    ss >> out;
+    return out;
+}
+
+void
+testBlobPrintsAndParses()
+{
+    // Bytes that are whitespace or delimiters as characters, followed by a
+    // number that must still print in decimal.
+    ph::Value blob(std::vector<uint8_t>{0x00, 0x0a, 0x20, 0x5d, 0x29, 0xff});
+    ph::Value list(std::vector<ph::Value>{blob, ph::Value::Int64(10),
+                                          ph::Value(std::vector<uint8_t>{})});
+    EXPECT(reread(blob) == blob);
+    EXPECT(reread(list) == list);
+
+    std::stringstream printed;
+    printed << ph::Value::Int64(10);
+    std::stringstream after;
+    after << blob << ' ' << ph::Value::Int64(10);
+    EXPECT(after.str().substr(after.str().size() - 2) == printed.str());
+
+    bool threw = false;
+    try
+    {
+        std::stringstream ss("[0x100]");
+        ph::Value v;
+        ss >> v;
+    }
+    catch (std::runtime_error const&)
+    {
+        threw = true;
+    }
+    EXPECT(threw);
+}
+
+namespace
+{
+// Decode one value from `bytes`, which must hold exactly its encoding.
+ph::Value
+decodeAll(std::vector<uint8_t> const& bytes)
+{
+    uint8_t const* p = bytes.data();
+    uint8_t const* end = p + bytes.size();
+    ph::Value v;
+    ph::decodeValue(p, end, v);
+    if (p != end)
+    {
+        throw std::runtime_error("trailing bytes after encoded value");
+    }
+    return v;
+}
+
+bool
+decodeThrows(std::vector<uint8_t> const& bytes)
+{
+    try
+    {
+        decodeAll(bytes);
+    }
+    catch (std::runtime_error const&)
+    {
+        return true;
+    }
+    return false;
+}
+} // namespace
+
+void
+testEncodedValuesRoundTrip()
+{
+    std::vector<ph::Value> vals{
+        ph::Value(),
+        ph::Value(ph::Symbol("sym")),
+        ph::Value::Bool(false),
+        ph::Value::Bool(true),
+        ph::Value::Int64(0),
+        ph::Value::Int64(-1),
+        ph::Value::Int64(63),
+        ph::Value::Int64(-64),
+        ph::Value::Int64(INT64_MAX),
+        ph::Value::Int64(INT64_MIN),
+        ph::Value(std::vector<uint8_t>{}),
+        ph::Value(std::vector<uint8_t>(300, 0xab)),
+        ph::Value(std::string()),
+        ph::Value(std::string("a\0b", 3)),
+    };
+    vals.emplace_back(std::vector<ph::Value>{vals.at(1), vals.at(9)});
+    vals.emplace_back(std::vector<ph::Value>{vals.back(), ph::Value(), vals});
+
+    std::set<ph::Type> types;
+    std::vector<uint8_t> all;
+    for (auto const& v : vals)
+    {
+        types.insert(v.getType());
+        std::vector<uint8_t> bytes;
+        ph::encodeValue(v, bytes);
+        EXPECT(decodeAll(bytes) == v);
+        EXPECT(decodeAll(bytes).getType() == v.getType());
+
+        // Every proper prefix of an encoding is truncated.
+        bool prefixesThrow = true;
+        for (size_t n = 0; n < bytes.size(); ++n)
+        {
+            prefixesThrow = prefixesThrow &&
+                            decodeThrows(std::vector<uint8_t>(
+                                bytes.begin(), bytes.begin() + n));
+        }
+        EXPECT(prefixesThrow);
+        all.insert(all.end(), bytes.begin(), bytes.end());
+    }
+    EXPECT(types.size() == 7);
+
+    // Values encoded back to back decode one after another.
+    uint8_t const* p = all.data();
+    uint8_t const* end = p + all.size();
+    bool same = true;
+    for (auto const& v : vals)
+    {
+        ph::Value got;
+        ph::decodeValue(p, end, got);
+        same = same && got == v;
+    }
+    EXPECT(same);
+    EXPECT(p == end);
+}
+
+void
+testMalformedEncodingsRejected()
+{
+    auto pair = static_cast<uint8_t>(ph::Type::Pair);
+    auto boolean = static_cast<uint8_t>(ph::Type::Bool);
+    auto int64 = static_cast<uint8_t>(ph::Type::Int64);
+    auto str = static_cast<uint8_t>(ph::Type::String);
+    auto nil = static_cast<uint8_t>(ph::Type::Nil);
+
+    // An unknown type.
+    EXPECT(decodeThrows({7}));
+    EXPECT(decodeThrows({0xff}));
+    // A bool that is neither 0 nor 1.
+    EXPECT(decodeThrows({boolean, 2}));
+    // A varint longer than 64 bits.
+    EXPECT(decodeThrows({int64, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                         0xff, 0xff, 0xff, 0x01}));
+    // A string longer than the bytes left.
+    EXPECT(decodeThrows({str, 3, 'a', 'b'}));
+    // An empty list (which is encoded as Nil), and a list with more
+    // elements than the bytes left.
+    EXPECT(decodeThrows({pair, 0}));
+    EXPECT(decodeThrows({pair, 3, nil, nil}));
+    EXPECT(!decodeThrows({pair, 2, nil, nil}));
+}
+
+#pragma endregion // Value
+
+#pragma region // Remote
+
+namespace
+{
+const ph::VarName OUT{"out"};
+const ph::VarName EXIT{"exit"};
+
+ph::Grammar
+remoteGrammar()
+{
+    ph::Grammar gram;
+    gram.addRule(NUM, {{gram.Int64(1)},
+                       {gram.Int64(2)},
+                       {gram.Int64(3)},
+                       {gram.Int64(4)},
+                       {gram.Int64(5)}});
+    return gram;
+}
+
+int64_t
+planNum(ph::Plan const& plan)
+{
+    int64_t n = 0;
+    for (auto const& pair : plan.getParams())
+    {
+        if (pair.first == N)
+        {
+            pair.second.match(NUM, n);
+        }
+    }
+    return n;
+}
+
+// Runs plans in test_remote_sut (see there for what each number does), and
+// keeps the transcripts and failures they produce.
+class RemoteNumTest : public ph::RemoteTest
+{
+  public:
+    std::map<int64_t, ph::Transcript> mGot;
+    std::map<int64_t, std::string> mFailures;
+    size_t mNumFailures{0};
+
+    RemoteNumTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : RemoteTest(gram, corp, ph::TestName("RemoteNumTest"), {{{N, NUM}}},
+                     {"./test_remote_sut"})
+    {
+        setTimeout(200);
+    }
+
+    void
+    handleRemoteFailure(ph::Plan const& plan, std::string const& how) override
+    {
+        mFailures[planNum(plan)] = how;
+        ++mNumFailures;
+    }
+
+    void
+    handleTranscriptMismatch(ph::Transcript const& expected,
+                             ph::Transcript const& got) override
+    {
+        mGot[planNum(got.getPlan())] = got;
+    }
+};
+
+ph::TranscriptVars
+remoteVars(int64_t n, char const* exit)
+{
+    ph::TranscriptVars vars{
+        {OUT, ph::Value::Int64(n), ph::VarKind::Checked}};
+    if (exit)
+    {
+        vars.emplace_back(EXIT, ph::Value(std::string(exit)),
+                          ph::VarKind::Tracked);
+    }
+    return vars;
+}
+} // namespace
+
+void
+testRemoteOutcomes()
+{
+    ph::Grammar gram = remoteGrammar();
+    ph::Corpus corp;
+    RemoteNumTest test(gram, corp);
+    for (int64_t n = 1; n <= 5; ++n)
+    {
+        corp.addTranscript(ph::Transcript(numPlan(test.getTestName(), n)));
+    }
+    test.administer();
+
+    // Observations made before the child ended are replayed, followed by
+    // how it ended.
+    EXPECT(test.mGot[1].getVars() == remoteVars(1, nullptr));
+    EXPECT(test.mGot[2].getVars() == remoteVars(2, "exit 3"));
+    EXPECT(test.mGot[3].getVars() ==
+           remoteVars(3, ("signal " + std::to_string(SIGABRT)).c_str()));
+    EXPECT(test.mGot[4].getVars() == remoteVars(4, "timeout"));
+    EXPECT(test.mGot.count(5) == 0);
+    EXPECT(test.mFailures.size() == 3);
+    EXPECT(test.mFailures[2] == "exit 3");
+    EXPECT(test.mFailures[4] == "timeout");
+
+    // Failures are still reported while replaying, once per run.
+    size_t before = test.mNumFailures;
+    test.replay(1, 1);
+    EXPECT(test.mNumFailures == before + 3);
+}
+
+#pragma endregion // Remote
+
+#pragma region // Coverage
+
+namespace
+{
+// Each plan covers an edge of its own in this process and another in the
+// shared map that subprocesses add their counters into.
+class SubprocessCoverageTest : public ph::Test
+{
+  public:
+    SubprocessCoverageTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("SubprocessCoverageTest"),
+               {{{N, NUM}}})
+    {
+        setSubprocessCoverage(true);
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        gFakeCounters[n] = 1;
+        ph::getSharedCoverage().mCounters[n] = 1;
+    }
+};
+} // namespace
+
+void
+testCoverageExportWithSubprocessCoverage()
+{
+    ph::Grammar gram = numGrammar();
+    ph::Corpus corp;
+    setenv("PHOTESTHESIS_COVERAGE_EXPORT", "1", 1);
+    SubprocessCoverageTest test(gram, corp);
+    unsetenv("PHOTESTHESIS_COVERAGE_EXPORT");
+    test.administer();
+
+    // Only the local edges are exported, so the report can place them all.
+    std::set<uint32_t> edges;
+    for (auto const& pair : corp.getSidecar("coverage").getRecords())
+    {
+        for (auto const& field : pair.second)
+        {
+            std::string encoded;
+            field.second.match(encoded);
+            for (auto const& edge : ph::decodeEdges(encoded))
+            {
+                edges.insert(edge.first);
+            }
+        }
+    }
+    EXPECT(edges == std::set<uint32_t>({1, 2, 3}));
+
+    bool threw = false;
+    std::ostringstream report;
+    try
+    {
+        ph::writeCoverageReport(corp.getSidecar("coverage"), report);
+    }
+    catch (std::runtime_error const&)
+    {
+        threw = true;
+    }
+    EXPECT(!threw);
+}
+
+#pragma endregion // Coverage
+
+#pragma region // Random
+
+void
+testXoshiroVectors()
+{
+    // Seeding expands the seed with splitmix64, whose first outputs from 0
+    // are 0xe220a8397b1dcdaf, 0x6e789e6aa1b965f4, 0x06c45d188009454f and
+    // 0xf88bb8a8724c81ec; from that state the reference xoshiro256** (which
+    // from the state {1, 2, 3, 4} gives 11520, 0, 1509978240, ...) continues
+    // as below.
+    std::vector<std::pair<uint64_t, std::vector<uint64_t>>> vectors{
+        {0,
+         {0x99ec5f36cb75f2b4ULL, 0xbf6e1f784956452aULL, 0x1a5f849d4933e6e0ULL,
+          0x6aa594f1262d2d2cULL}},
+        {42,
+         {0x15780b2e0c2ec716ULL, 0x6104d9866d113a7eULL, 0xae17533239e499a1ULL,
+          0xecb8ad4703b360a1ULL}},
+    };
+    for (auto const& v : vectors)
+    {
+        ph::Xoshiro256 gen(v.first);
+        for (uint64_t expected : v.second)
+        {
+            EXPECT(gen() == expected);
+        }
+        // Reseeding restarts the stream.
+        gen.seed(v.first);
+        EXPECT(gen() == v.second.at(0));
+    }
+    ph::Xoshiro256 unseeded;
+    EXPECT(unseeded() == 0x99ec5f36cb75f2b4ULL);
+
+    ph::Xoshiro256 jumped(42);
+    jumped.jump();
+    for (uint64_t expected : {0x50086ef83cbf4f4aULL, 0xba285ec21347d703ULL,
+                              0x5ea1247b4dc6452aULL, 0x03a5c66424702131ULL})
+    {
+        EXPECT(jumped() == expected);
+    }
+
+    ph::Xoshiro256 dice(42);
+    for (uint64_t expected : {0, 2, 4, 5, 5, 4, 4, 5})
+    {
+        EXPECT(dice.below(6) == expected);
+    }
+}
+
+void
+testXoshiroBelowInRange()
+{
+    ph::Xoshiro256 gen(7);
+    // 2^63 + 1 rejects nearly half of all draws, and 2^64 - 3 very few.
+    for (uint64_t n : {uint64_t(1), uint64_t(6), uint64_t(1000003),
+                       (uint64_t(1) << 63) + 1, ~uint64_t(0) - 2})
+    {
+        bool sawHighHalf = false;
+        for (int i = 0; i < 2000; ++i)
+        {
+            uint64_t x = gen.below(n);
+            EXPECT(x < n);
+            sawHighHalf = sawHighHalf || x >= n / 2;
+        }
+        EXPECT(sawHighHalf || n == 1);
+    }
+    std::set<uint64_t> faces;
+    for (int i = 0; i < 600; ++i)
+    {
+        faces.insert(gen.below(6));
+    }
+    EXPECT(faces.size() == 6);
+}
+
+void
+testXoshiroStreamsDisjoint()
+{
+    ph::Xoshiro256 parent(42);
+    ph::Xoshiro256 plain(42);
+    std::vector<ph::Xoshiro256> streams;
+    for (int i = 0; i < 4; ++i)
+    {
+        streams.emplace_back(parent.split());
+    }
+    streams.emplace_back(parent);
+
+    // The first split stream is the unsplit one, and each split jumps the
+    // parent once.
+    ph::Xoshiro256 first = streams.at(0);
+    ph::Xoshiro256 jumped(42);
+    jumped.jump();
+    ph::Xoshiro256 second = streams.at(1);
+    for (int i = 0; i < 16; ++i)
+    {
+        EXPECT(first() == plain());
+        EXPECT(second() == jumped());
+    }
+
+    std::set<uint64_t> seen;
+    for (auto& stream : streams)
+    {
+        for (int i = 0; i < 10000; ++i)
+        {
+            EXPECT(seen.insert(stream()).second);
+        }
+    }
+}
+
+#pragma endregion // Random
+
+#pragma region // FastHash
+
+namespace
+{
+std::vector<uint8_t>
+hashInput(size_t len)
+{
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; ++i)
+    {
+        data[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+    return data;
+}
+} // namespace
+
+void
+testFastHashVectors()
+{
+    // Lengths either side of the short-input path, a stripe and a block.
+    std::vector<std::pair<size_t, uint64_t>> unseeded{
+        {0, 0xece43e4f7fe55617ULL},
+        {1, 0xac67423cff8139afULL},
+        {3, 0x992e5f992f517b16ULL},
+        {4, 0x11c4dbf91eae6310ULL},
+        {8, 0x44a601623cf7a865ULL},
+        {9, 0x9d02536c1769114dULL},
+        {16, 0xebe15faad0036f24ULL},
+        {17, 0xc9b83aa3448879a5ULL},
+        {32, 0x7b04a447ec2997b6ULL},
+        {33, 0x7b3b1f244e49912cULL},
+        {63, 0x42854a4c87adf114ULL},
+        {64, 0xd965963ac8c12062ULL},
+        {65, 0x674b87676f7c55f0ULL},
+        {128, 0x6c439ce531b21a1eULL},
+        {129, 0x44e1b8ed15b02282ULL},
+        {1023, 0x575e684db5bbabe3ULL},
+        {1024, 0x1bfd4ddac7b43912ULL},
+        {1025, 0x40da5762e5577c73ULL},
+        {2049, 0x756ab8bb19e12acfULL},
+        {5000, 0x6428aa00b2f62bdfULL},
+    };
+    std::vector<std::pair<size_t, uint64_t>> seeded{
+        {0, 0x7adc916f3c8bb29fULL},
+        {1, 0xb146674f3124904bULL},
+        {3, 0x30c3c41454a0c48eULL},
+        {4, 0x68b4a765b7a9fab8ULL},
+        {8, 0x80eb2bb6b17266deULL},
+        {9, 0x688f78556bb40027ULL},
+        {16, 0x32ac53e49e0537eaULL},
+        {17, 0x25baf53249822a7bULL},
+        {32, 0xdac9a4fe634c16b3ULL},
+        {33, 0xb8aa727b3b441a4cULL},
+        {63, 0xfd37a43e9964e92fULL},
+        {64, 0x49ffc53168ea9c53ULL},
+        {65, 0x414ea5a757ff542bULL},
+        {128, 0xf02a2fc4b96a2277ULL},
+        {129, 0x3de96c68f161d020ULL},
+        {1023, 0xedaab873fe83ebf9ULL},
+        {1024, 0xb84f62314bd4bc51ULL},
+        {1025, 0x75e44442aa25fbe9ULL},
+        {2049, 0x270fad251a227e1bULL},
+        {5000, 0x607255a90deb7186ULL},
+    };
+    std::vector<uint8_t> data = hashInput(5000);
+    for (auto const& v : unseeded)
+    {
+        EXPECT(ph::FastHash::hash(data.data(), v.first) == v.second);
+    }
+    for (auto const& v : seeded)
+    {
+        EXPECT(ph::FastHash::hash(data.data(), v.first, 0x9e3779b97f4a7c15) ==
+               v.second);
+    }
+}
+
+void
+testFastHashStreamingMatchesOneShot()
+{
+    size_t const stripe = ph::FastHash::StripeSize;
+    size_t const block = stripe * ph::FastHash::StripesPerBlock;
+    std::vector<size_t> lens{
+        0,         1,     stripe - 1, stripe,         stripe + 1,    2 * stripe,
+        block - 1, block, block + 1,  block + stripe, 2 * block + 1, 5000};
+    std::vector<size_t> chunks{1, 7, stripe - 1, stripe, stripe + 1, 1000};
+    std::vector<uint8_t> data = hashInput(5000);
+    for (uint64_t seed : {uint64_t(0), uint64_t(42)})
+    {
+        for (size_t len : lens)
+        {
+            for (size_t chunk : chunks)
+            {
+                // `hash` may be called partway through, and must then
+                // agree with a one-shot hash of the bytes added so far.
+                ph::FastHash h(seed);
+                bool same = true;
+                for (size_t pos = 0; pos < len; pos += chunk)
+                {
+                    size_t n = std::min(chunk, len - pos);
+                    h.add(data.data() + pos, n);
+                    same = same && h.hash() == ph::FastHash::hash(
+                                                   data.data(), pos + n, seed);
+                }
+                EXPECT(same);
+                EXPECT(h.hash() == ph::FastHash::hash(data.data(), len, seed));
+            }
+        }
+    }
+}
+
+#pragma endregion // FastHash
+
+#pragma region // Near-duplicates
+
+namespace
+{
+// The bucketed counters of an edge set holding `first` to `last` inclusive.
+std::vector<uint8_t>
+edgeRange(size_t first, size_t last)
+{
+    std::vector<uint8_t> counters(256, 0);
+    for (size_t i = first; i <= last; ++i)
+    {
+        counters[i] = 1;
+    }
+    return counters;
+}
+
+ph::EdgeSignature
+signature(std::vector<uint8_t> const& counters)
+{
+    return ph::EdgeSignature(counters.data(), counters.size());
+}
+
+// Every plan covers the same 40 edges plus one of its own, so all plans are
+// near-duplicates of each other with the same user trajectory.
+class NearDuplicateTest : public ph::Test
+{
+  public:
+    NearDuplicateTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("NearDuplicateTest"), {{{N, NUM}}})
+    {
+        setNearDuplicateJaccard(0.5);
+    }
+
+    void
+    run() override
+    {
+        int64_t n = 0;
+        getParam(N).match(NUM, n);
+        for (size_t i = 0; i < 40; ++i)
+        {
+            gFakeCounters[i] = 1;
+        }
+        gFakeCounters[40 + n] = 1;
+    }
+};
+} // namespace
+
+void
+testEdgeSignatureSimilarity()
+{
+    auto a = signature(edgeRange(0, 99));
+    auto b = signature(edgeRange(0, 100));
+    auto c = signature(edgeRange(150, 249));
+    auto empty = signature(std::vector<uint8_t>(256, 0));
+    EXPECT(a.similarity(a) == 1.0);
+    EXPECT(a.similarity(b) >= 0.8);
+    EXPECT(a.similarity(b) == b.similarity(a));
+    EXPECT(a.similarity(c) <= 0.2);
+    EXPECT(empty.similarity(empty) == 1.0);
+    EXPECT(empty.similarity(a) == 0.0);
+
+    // A different bucket for the same counter is a different edge.
+    auto bucketed = edgeRange(0, 0);
+    auto one = signature(bucketed);
+    bucketed[0] = 2;
+    EXPECT(one.similarity(signature(bucketed)) == 0.0);
+}
+
+void
+testNearDuplicateIndexFindsSimilar()
+{
+    auto a = signature(edgeRange(0, 99));
+    auto b = signature(edgeRange(0, 100));
+    auto c = signature(edgeRange(150, 249));
+    ph::NearDuplicateIndex index;
+    EXPECT(index.findSimilar(a, 1, 0.5) == 0.0);
+    index.insert(a, 1);
+    EXPECT(index.findSimilar(a, 1, 0.8) == 1.0);
+    EXPECT(index.findSimilar(b, 1, 0.8) >= 0.8);
+    // Only runs with the same user trajectory are compared.
+    EXPECT(index.findSimilar(b, 2, 0.8) == 0.0);
+    EXPECT(index.findSimilar(c, 1, 0.8) == 0.0);
+    index.insert(c, 1);
+    EXPECT(index.findSimilar(c, 1, 0.8) == 1.0);
+    index.clear();
+    EXPECT(index.findSimilar(a, 1, 0.5) == 0.0);
+}
+
+void
+testNearDuplicatesOnlySkippedInExpansion()
+{
+    ph::Grammar gram = numGrammar();
+
+    // An empty corpus keeps every k-path plan.
+    ph::Corpus initialized;
+    NearDuplicateTest first(gram, initialized);
+    first.administer();
+    EXPECT(initialized.getTranscripts(first.getTestName()).size() == 3);
+
+    // Random expansion from one of them finds only near-duplicates.
+    ph::Corpus expanded;
+    NearDuplicateTest second(gram, expanded);
+    expanded.addTranscript(ph::Transcript(numPlan(second.getTestName(), 1)));
+    second.administer(50);
+    EXPECT(expanded.getTranscripts(second.getTestName()).size() == 1);
+}
+
+#pragma endregion // Near-duplicates
+
+#pragma region // TaskObserver
+
+namespace
+{
+// Runs four tasks on threads of their own, each with a TaskObserver keyed
+// by its task, which are submitted in the order of `mOrder`. With
+// `mSequential` it makes the tasks' calls itself in key order instead, and
+// with `mDuplicate` it gives every observer the same key.
+class TaskTest : public ph::Test
+{
+  public:
+    std::vector<uint64_t> mOrder{0, 1, 2, 3};
+    bool mSequential{false};
+    bool mDuplicate{false};
+
+    TaskTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("TaskTest"), {{{N, DIGITS}}})
+    {
+    }
+
+    // The same calls for each task, made either on a TaskObserver or
+    // directly on the test.
+    template <typename O>
+    static void
+    observeTask(O& obs, uint64_t task, ph::Value const& param)
+    {
+        obs.trace(ph::VarName("task"), task);
+        obs.track(ph::VarName("param"), param);
+        obs.track(ph::VarName("name"), "task-" + std::to_string(task));
+        obs.check(ph::VarName("odd"), task % 2 == 1);
+        obs.check(ph::VarName("label"), "x");
+        uint8_t bytes[2] = {static_cast<uint8_t>(task), 7};
+        obs.trace(ph::VarName("bytes"), bytes, sizeof(bytes));
+        obs.invariant(ph::VarName("small"), ph::Value::Bool(true),
+                      ph::Value::Bool(task < 4));
+    }
+
+    void
+    run() override
+    {
+        ph::Value param = getParam(N);
+        if (mSequential)
+        {
+            for (uint64_t task = 0; task < mOrder.size(); ++task)
+            {
+                observeTask(*this, task, param);
+            }
+            return;
+        }
+        std::atomic<size_t> turn{0};
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < mOrder.size(); ++i)
+        {
+            threads.emplace_back([this, i, &turn, param]() {
+                uint64_t task = mOrder[i];
+                ph::TaskObserver obs(*this, mDuplicate ? 0 : task);
+                observeTask(obs, task, param);
+                while (turn.load() != i)
+                {
+                    std::this_thread::yield();
+                }
+                obs.submit();
+                turn.store(i + 1);
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+};
+} // namespace
+
+void
+testTaskObservationsMergeInKeyOrder()
+{
+    ph::Grammar gram = digitsGrammar();
+    ph::Corpus corp;
+    TaskTest sequential(gram, corp);
+    sequential.mSequential = true;
+    EXPECT(sequential.prepare().empty());
+    size_t count = sequential.getTrajectoryCount();
+    EXPECT(count > 1);
+    ph::Plan plan =
+        corp.getTranscripts(sequential.getTestName()).begin()->getPlan();
+    ph::Trajectory expected = sequential.runOnce(plan);
+
+    // Checking the sequential run's corpus compares each transcript exactly.
+    for (auto const& order : std::vector<std::vector<uint64_t>>{
+             {0, 1, 2, 3}, {3, 2, 1, 0}, {2, 0, 3, 1}})
+    {
+        TaskTest tasks(gram, corp);
+        tasks.mOrder = order;
+        EXPECT(tasks.prepare().empty());
+        EXPECT(tasks.getTrajectoryCount() == count);
+        EXPECT(tasks.runOnce(plan) == expected);
+    }
+}
+
+void
+testTaskObserverDuplicateKeysThrow()
+{
+    ph::Grammar gram = digitsGrammar();
+    ph::Corpus corp;
+    TaskTest tasks(gram, corp);
+    tasks.mDuplicate = true;
+    ph::Plan plan(tasks.getTestName());
+    plan.addParam(N, parseValue("(digits (digit 1) (digit 2) (digit 3))"));
+    bool threw = false;
+    try
+    {
+        tasks.runOnce(plan);
+    }
+    catch (std::runtime_error const& e)
+    {
+        threw = std::string(e.what()).find("key 0") != std::string::npos;
+    }
+    EXPECT(threw);
+
+    // The test is usable again afterwards.
+    tasks.mDuplicate = false;
+    TaskTest sequential(gram, corp);
+    sequential.mSequential = true;
+    EXPECT(tasks.runOnce(plan) == sequential.runOnce(plan));
+}
+
+#pragma endregion // TaskObserver
+
+#pragma region // MatchTable
+
+namespace
+{
+// evalByMatch's evaluator, dispatching through a MatchTable.
+class TableEvaluator
+{
+    ph::MatchTable<int64_t> mTable;
+    std::vector<int64_t> mXs;
+
+  public:
+    TableEvaluator()
+    {
+        mTable
+            .on(ADD,
+                [this](ph::Value b, ph::Value c) {
+                    return eval(b) + eval(c);
+                })
+            .on(LET,
+                [this](ph::Symbol x, ph::Value b, ph::Value c) {
+                    mXs.emplace_back(eval(b));
+                    int64_t i = x == X ? eval(c) : -1;
+                    mXs.pop_back();
+                    return i;
+                })
+            .on(VAR, [this](ph::Symbol x) { return mXs.back(); })
+            .otherwise([](ph::Value a) {
+                int64_t i = 0;
+                a.match(i);
+                return i;
+            });
+    }
+
+    int64_t
+    eval(ph::Value val)
+    {
+        ph::Value a;
+        if (val.match(EXPR, a))
+        {
+            return mTable.dispatch(a);
+        }
+        return 0;
+    }
+};
+
+ph::Value
+list(std::vector<ph::Value> const& vals)
+{
+    return ph::Value(vals);
+}
+} // namespace
+
+void
+testMatchTableAgreesWithMatch()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::TestName tname("MatchTest");
+    ph::ParamSpecs specs{{N, EXPR}};
+    TableEvaluator table;
+    for (uint64_t seed = 0; seed < 200; ++seed)
+    {
+        ph::RandomEngine gen(seed);
+        ph::Value v = gram.randomlyPopulatePlan(tname, specs, gen, 8)
+                          .getParams()
+                          .at(0)
+                          .second;
+        std::vector<int64_t> xs;
+        EXPECT(table.eval(v) == evalByMatch(v, xs));
+    }
+}
+
+void
+testMatchTableDispatch()
+{
+    const ph::Symbol NEG("neg");
+    const ph::Symbol OTHER("other");
+    auto i64 = ph::Value::Int64;
+
+    ph::MatchTable<int64_t> table;
+    table.on(ADD, [](int64_t a, int64_t b) { return a + b; })
+        .on(NEG, [](int64_t a) { return a; })
+        .on(NEG, [](int64_t a) { return -a; })
+        .otherwise([](ph::Value) { return int64_t(-100); });
+
+    EXPECT(table.dispatch(list({ph::Value(ADD), i64(1), i64(2)})) == 3);
+    // Elements past the handler's parameters are ignored.
+    EXPECT(table(list({ph::Value(ADD), i64(1), i64(2), i64(3)})) == 3);
+    // A later handler for a head replaces the earlier one.
+    EXPECT(table.dispatch(list({ph::Value(NEG), i64(4)})) == -4);
+
+    // Anything else goes to `otherwise`: too few elements, elements of the
+    // wrong type, an unregistered head, a head that is not a symbol, and
+    // values that are not lists.
+    EXPECT(table.dispatch(list({ph::Value(ADD), i64(1)})) == -100);
+    EXPECT(table.dispatch(list({ph::Value(ADD), i64(1), ph::Value(X)})) ==
+           -100);
+    EXPECT(table.dispatch(list({ph::Value(OTHER), i64(1)})) == -100);
+    EXPECT(table.dispatch(list({i64(1), i64(2)})) == -100);
+    EXPECT(table.dispatch(i64(5)) == -100);
+    EXPECT(table.dispatch(ph::Value()) == -100);
+
+    // Without `otherwise`, dispatch throws.
+    ph::MatchTable<int64_t> strict;
+    strict.on(ADD, [](int64_t a, int64_t b) { return a + b; });
+    bool threw = false;
+    try
+    {
+        strict.dispatch(list({ph::Value(OTHER)}));
+    }
+    catch (std::runtime_error const&)
+    {
+        threw = true;
+    }
+    EXPECT(threw);
+
+    // Handlers may return nothing.
+    int64_t total = 0;
+    ph::MatchTable<void> effects;
+    effects.on(ADD, [&](int64_t a) { total += a; }).otherwise([&](ph::Value) {
+        total = -1;
+    });
+    effects.dispatch(list({ph::Value(ADD), i64(2)}));
+    effects.dispatch(list({ph::Value(ADD), i64(3)}));
+    EXPECT(total == 5);
+    effects.dispatch(i64(1));
+    EXPECT(total == -1);
+}
+
+#pragma endregion // MatchTable
+
+#pragma region // Decode
+
+namespace
+{
+struct Point
+{
+    ph::Symbol mTag{""};
+    int64_t mX{0};
+    int64_t mY{0};
+};
+
+// Decodes its param as `(num n)`, and also tries it as a shape it isn't.
+class DecodeTest : public ph::Test
+{
+  public:
+    int64_t mNum{0};
+    bool mWrongShapeThrew{false};
+
+    DecodeTest(ph::Grammar const& gram, ph::Corpus& corp)
+        : Test(gram, corp, ph::TestName("DecodeTest"), {{{N, NUM}}})
+    {
+    }
+
+    void
+    run() override
+    {
+        auto [head, n] = getParam<std::tuple<ph::Symbol, int64_t>>(N);
+        EXPECT(head == NUM);
+        mNum = n;
+        try
+        {
+            getParam<std::tuple<ph::Symbol, std::string>>(N);
+        }
+        catch (std::runtime_error const&)
+        {
+            mWrongShapeThrew = true;
+        }
+    }
+};
+
+template <typename T>
+bool
+decodes(std::string const& text)
+{
+    T out{};
+    return ph::decode(parseValue(text), out);
+}
+} // namespace
+
+namespace photesthesis
+{
+template <>
+struct Decoder<Point>
+    : StructDecoder<Point, &Point::mTag, &Point::mX, &Point::mY>
+{
+};
+} // namespace photesthesis
+
+void
+testDecodeShapes()
+{
+    using ph::decode;
+    ph::Value blob(std::vector<uint8_t>{1, 2, 255});
+    EXPECT(decode<ph::Value>(blob) == blob);
+    EXPECT(decode<std::vector<uint8_t>>(blob) ==
+           std::vector<uint8_t>({1, 2, 255}));
+    EXPECT(decode<ph::Symbol>(parseValue("foo")) == ph::Symbol("foo"));
+    EXPECT(decode<bool>(ph::Value::Bool(true)));
+    EXPECT(decode<int64_t>(parseValue("-7")) == -7);
+    EXPECT(decode<std::string>(ph::Value(std::string("hi"))) == "hi");
+
+    auto [head, n, rest] =
+        decode<std::tuple<ph::Symbol, int64_t, std::vector<ph::Value>>>(
+            parseValue("(foo 5 (a b))"));
+    EXPECT(head == ph::Symbol("foo") && n == 5 && rest.size() == 2);
+    auto nested = decode<std::tuple<
+        ph::Symbol, std::tuple<ph::Symbol, int64_t, int64_t>>>(
+        parseValue("(expr (add 5 7))"));
+    EXPECT(std::get<2>(std::get<1>(nested)) == 7);
+    EXPECT((decode<std::pair<int64_t, ph::Symbol>>(parseValue("(1 x)")) ==
+            std::make_pair(int64_t(1), ph::Symbol("x"))));
+
+    EXPECT(decode<std::vector<int64_t>>(parseValue("(3 1 2)")) ==
+           std::vector<int64_t>({3, 1, 2}));
+    EXPECT(decode<std::vector<int64_t>>(ph::Value()).empty());
+    std::set<ph::Value> set{ph::Value::Int64(2), ph::Value::Int64(1)};
+    EXPECT(decode<std::set<int64_t>>(ph::Value(set)) ==
+           std::set<int64_t>({1, 2}));
+    std::map<ph::Value, ph::Value> map{
+        {ph::Value::Int64(1), ph::Value(std::string("one"))},
+        {ph::Value::Int64(2), ph::Value(std::string("two"))}};
+    EXPECT((decode<std::map<int64_t, std::string>>(ph::Value(map)) ==
+            std::map<int64_t, std::string>{{1, "one"}, {2, "two"}}));
+
+    EXPECT(!decode<std::optional<int64_t>>(ph::Value()).has_value());
+    EXPECT(decode<std::optional<int64_t>>(parseValue("4")) == 4);
+
+    Point p = decode<Point>(parseValue("(pt 3 4)"));
+    EXPECT(p.mTag == ph::Symbol("pt") && p.mX == 3 && p.mY == 4);
+}
+
+void
+testDecodeRejectsWrongShapes()
+{
+    using Triple = std::tuple<ph::Symbol, int64_t, int64_t>;
+    // Tuple and struct arity must match exactly.
+    EXPECT(decodes<Triple>("(add 5 7)"));
+    EXPECT(!decodes<Triple>("(add 5)"));
+    EXPECT(!decodes<Triple>("(add 5 7 9)"));
+    EXPECT(!decodes<Triple>("()"));
+    EXPECT(!decodes<Triple>("add"));
+    EXPECT(!decodes<Point>("(pt 3)"));
+    EXPECT(!decodes<Point>("(pt 3 4 5)"));
+    using Pair = std::pair<int64_t, int64_t>;
+    EXPECT(!decodes<Pair>("(1 2 3)"));
+
+    // Scalars must have the right type.
+    EXPECT(!decodes<Triple>("(add 5 x)"));
+    EXPECT(!decodes<Triple>("(5 5 7)"));
+    EXPECT(!decodes<int64_t>("x"));
+    EXPECT(!decodes<ph::Symbol>("5"));
+    EXPECT(!decodes<bool>("5"));
+    EXPECT(!decodes<std::string>("x"));
+    EXPECT(!decodes<std::vector<uint8_t>>("(1 2)"));
+    EXPECT(!decodes<int64_t>("()"));
+
+    // Every element of a collection must decode, and it must be a list.
+    EXPECT(!decodes<std::vector<int64_t>>("(1 x 3)"));
+    EXPECT(!decodes<std::vector<int64_t>>("5"));
+    EXPECT(!decodes<std::set<int64_t>>("(1 (2))"));
+    using Map = std::map<int64_t, int64_t>;
+    EXPECT(decodes<Map>("((1 2) (3 4))"));
+    EXPECT(!decodes<Map>("((1 2) (3))"));
+    EXPECT(!decodes<Map>("((1 2) 3)"));
+    EXPECT(!decodes<std::optional<int64_t>>("x"));
+
+    bool threw = false;
+    try
+    {
+        ph::decode<Triple>(parseValue("(add 5)"));
+    }
+    catch (std::runtime_error const& e)
+    {
+        threw = std::string(e.what()).find("cannot decode value") !=
+                std::string::npos;
+    }
+    EXPECT(threw);
+}
+
+void
+testGetParamDecodes()
+{
+    ph::Grammar gram = remoteGrammar();
+    ph::Corpus corp;
+    DecodeTest test(gram, corp);
+    test.runOnce(numPlan(test.getTestName(), 4));
+    EXPECT(test.mNum == 4);
+    EXPECT(test.mWrongShapeThrew);
+}
+
+#pragma endregion // Decode
+
+#pragma region // StaticGrammar
+
+namespace
+{
+// The example from static_grammar.h, which declares exprGrammar.
+using namespace ph::dsl;
+constexpr auto staticExprGrammar = grammar(
+    rule("add", prod(int64(0)), prod(ref("expr"), ref("expr"))),
+    rule("let", prod(int64(0)),
+         prod(sym("x"), ref("expr"), addContext("x", ref("expr")))),
+    rule("var", prod(sym("x"))),
+    rule("expr", prod(int64(1)), prod(ref("add")), prod(ref("let")),
+         inContext("x", prod(ref("var")))));
+} // namespace
+
+void
+testStaticGeneratorMatchesGrammar()
+{
+    ph::Grammar gram = exprGrammar();
+    ph::Grammar converted = staticExprGrammar.toGrammar();
+    ph::StaticGenerator gen(staticExprGrammar);
+    ph::TestName tname("StaticTest");
+    // A parameter named x puts x in context from the start.
+    std::vector<ph::ParamSpecs> specs{{{N, EXPR}}, {{N, EXPR}, {X, EXPR}}};
+    bool samePlans = true;
+    bool sameChoices = true;
+    bool sameConverted = true;
+    bool sameDecoded = true;
+    for (auto const& spec : specs)
+    {
+        for (size_t depth : {1, 2, 6})
+        {
+            for (uint64_t seed = 0; seed < 200; ++seed)
+            {
+                ph::RandomEngine gramGen(seed), staticGen(seed),
+                    convertedGen(seed);
+                std::vector<uint8_t> gramChoices, staticChoices;
+                ph::Plan expected = gram.randomlyPopulatePlan(
+                    tname, spec, gramGen, depth, gramChoices);
+                ph::Plan got = gen.randomlyPopulatePlan(
+                    tname, spec, staticGen, depth, staticChoices);
+                samePlans = samePlans && got == expected;
+                sameChoices = sameChoices && staticChoices == gramChoices;
+                sameConverted =
+                    sameConverted && converted.randomlyPopulatePlan(
+                                         tname, spec, convertedGen, depth) ==
+                                         expected;
+                ph::ChoiceSequence seq(gramChoices);
+                sameDecoded =
+                    sameDecoded &&
+                    gen.populatePlanFromChoices(tname, spec, seq, depth) ==
+                        expected;
+            }
+        }
+    }
+    EXPECT(samePlans);
+    EXPECT(sameChoices);
+    EXPECT(sameConverted);
+    EXPECT(sameDecoded);
+}
+
+#pragma endregion // StaticGrammar
+
+int
+main()
+{
+    // The status page is opened when the first Test is constructed.
+    std::string statusName =
+        "/photesthesis-test-units-" + std::to_string(getpid());
+    setenv("PHOTESTHESIS_STATUS", statusName.c_str(), 1);
+
+    __sanitizer_cov_8bit_counters_init(gFakeCounters,
+                                       gFakeCounters + sizeof(gFakeCounters));
+    initFakePCs();
+    __sanitizer_cov_pcs_init(gFakePCs,
+                             gFakePCs + sizeof(gFakePCs) / sizeof(uintptr_t));
+
+    testReplayForeverStopsWhenAllRejected();
+    testReplayClearsFlagOnException();
+    testReplayMedianIsMidpoint();
+    testMeasureMedianAndMad();
+    testMeasuredTranscriptsDeduplicated();
+    testCoverageExportMatchesCounters();
+    testFunctionFingerprintsCombineCopies();
+    testIncrementalCheckSkipsUnchanged();
+    testStatusPageReadBack();
+    testTypedStructureHashesMatchValues();
+    testTypedObservationsMatchValues();
+    testOnlineCheckMatchesPostHocDiff();
+    testScheduleRecentFailuresFirst();
+    testShardMergeMatchesUnsharded();
+    testDifferentialAgreeing();
+    testDifferentialDiverging();
+    testStatefulPrefixReuseMatchesColdRun();
+    testCampaignFavoursNovelArm();
+    testCampaignWorkersDrawDisjointStreams();
+    testShrinkFindsMinimalPlan();
+    testReductionsAreSimplerDerivations();
+    testReplaceAtPathChecksRange();
+    testShrinkCrashingPlan();
+    testChoicesDecodeToSamePlan();
+    testFuzzTargetRecordsNewTrajectories();
+    testFuzzTargetMutatesWholeDecisions();
+    testFuzzTargetAbortsOnFailure();
+    testBlobPrintsAndParses();
+    testEncodedValuesRoundTrip();
+    testMalformedEncodingsRejected();
+    testRemoteOutcomes();
+    testCoverageExportWithSubprocessCoverage();
+    testXoshiroVectors();
+    testXoshiroBelowInRange();
+    testXoshiroStreamsDisjoint();
+    testFastHashVectors();
+    testFastHashStreamingMatchesOneShot();
+    testEdgeSignatureSimilarity();
+    testNearDuplicateIndexFindsSimilar();
+    testNearDuplicatesOnlySkippedInExpansion();
+    testTaskObservationsMergeInKeyOrder();
+    testTaskObserverDuplicateKeysThrow();
+    testMatchTableAgreesWithMatch();
+    testMatchTableDispatch();
+    testDecodeShapes();
+    testDecodeRejectsWrongShapes();
+    testGetParamDecodes();
+    testStaticGeneratorMatchesGrammar();
+
+    shm_unlink(statusName.c_str());
+    if (gFailures != 0)
+    {
+        std::cerr << gFailures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all unit tests passed" << std::endl;
+    return 0;
+}
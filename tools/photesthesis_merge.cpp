@@ -0,0 +1,48 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+// photesthesis-merge: merge the corpora written by sharded checks (see
+// Test::setShard and PHOTESTHESIS_SHARD) back into the corpus they started
+// from.
+//
+// Usage: photesthesis-merge BASE SHARD...
+//
+// Each SHARD is a copy of the corpus at path BASE after one job checked (and
+// possibly updated or expanded) its slice of it. The changes each SHARD made
+// relative to BASE, including those to its sidecars, are applied to BASE in
+// place.
+
+#include <photesthesis/corpus.h>
+
+#include <exception>
+#include <iostream>
+
+namespace ph = photesthesis;
+
+int
+main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " BASE SHARD..." << std::endl;
+        return 2;
+    }
+    try
+    {
+        ph::Corpus base(argv[1], false);
+        ph::Corpus merged(argv[1], false);
+        for (int i = 2; i < argc; ++i)
+        {
+            ph::Corpus shard(argv[i], false);
+            merged.mergeChanges(base, shard);
+        }
+        merged.save();
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
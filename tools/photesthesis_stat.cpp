@@ -0,0 +1,246 @@
+// Copyright 2021 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+// photesthesis-stat: display the StatusPages published by running tests (see
+// include/photesthesis/status.h), in the spirit of AFL's afl-whatsup.
+//
+// Usage: photesthesis-stat [-w] [-r] [NAME...]
+//
+//   -w    redisplay every second until interrupted
+//   -r    remove the named (or all found) segments instead of displaying them
+//
+// With no NAME arguments, every status segment found in /dev/shm is shown.
+
+#include <photesthesis/status.h>
+
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace ph = photesthesis;
+
+namespace
+{
+
+std::vector<std::string>
+findStatusSegments()
+{
+    std::vector<std::string> names;
+    if (DIR* dir = opendir("/dev/shm"))
+    {
+        while (struct dirent* ent = readdir(dir))
+        {
+            std::string name = std::string("/") + ent->d_name;
+            if (ent->d_name[0] == '.')
+            {
+                continue;
+            }
+            if (auto page = ph::mapStatusPage(name))
+            {
+                ph::unmapStatusPage(page);
+                names.emplace_back(name);
+            }
+        }
+        closedir(dir);
+    }
+    return names;
+}
+
+char const*
+phaseName(uint64_t phase)
+{
+    switch (static_cast<ph::StatusPhase>(phase))
+    {
+    case ph::StatusPhase::Idle:
+        return "idle";
+    case ph::StatusPhase::Initializing:
+        return "initializing";
+    case ph::StatusPhase::Checking:
+        return "checking";
+    case ph::StatusPhase::Expanding:
+        return "expanding";
+    case ph::StatusPhase::Replaying:
+        return "replaying";
+    case ph::StatusPhase::Done:
+        return "done";
+    }
+    return "unknown";
+}
+
+std::string
+duration(uint64_t nanos)
+{
+    uint64_t secs = nanos / 1000000000;
+    std::string s;
+    if (secs >= 86400)
+    {
+        s += std::to_string(secs / 86400) + "d ";
+    }
+    if (secs >= 3600)
+    {
+        s += std::to_string((secs / 3600) % 24) + "h ";
+    }
+    if (secs >= 60)
+    {
+        s += std::to_string((secs / 60) % 60) + "m ";
+    }
+    return s + std::to_string(secs % 60) + "s";
+}
+
+std::string
+ago(uint64_t now, uint64_t then)
+{
+    if (then == 0)
+    {
+        return "never";
+    }
+    return duration(now > then ? now - then : 0) + " ago";
+}
+
+struct Totals
+{
+    uint64_t mAlive{0};
+    uint64_t mExecutions{0};
+    uint64_t mExecsPerSec{0};
+    uint64_t mHangs{0};
+    uint64_t mFailures{0};
+};
+
+void
+display(std::string const& name, ph::StatusPage const& page, Totals& totals)
+{
+    auto relaxed = std::memory_order_relaxed;
+    uint64_t now = ph::statusNow();
+    bool alive = kill(static_cast<pid_t>(page.mPid), 0) == 0;
+    uint64_t phase = page.mPhase.load(relaxed);
+    char testName[ph::StatusPage::TestNameSize];
+    std::memcpy(testName, page.mTestName, sizeof(testName));
+    testName[sizeof(testName) - 1] = '\0';
+
+    uint64_t execs = page.mExecutions.load(relaxed);
+    uint64_t eps = (alive && phase != static_cast<uint64_t>(
+                                          ph::StatusPhase::Done))
+                       ? page.mExecsPerSec.load(relaxed)
+                       : 0;
+    totals.mAlive += alive;
+    totals.mExecutions += execs;
+    totals.mExecsPerSec += eps;
+    totals.mHangs += page.mHangs.load(relaxed);
+    totals.mFailures += page.mFailures.load(relaxed);
+
+    std::cout << name << " (pid " << page.mPid
+              << (alive ? ", running" : ", exited") << ")" << std::endl
+              << "  test         : " << testName << std::endl
+              << "  phase        : " << phaseName(phase) << std::endl
+              << "  run time     : "
+              << duration(page.mUpdateTime.load(relaxed) -
+                          page.mStartTime.load(relaxed))
+              << std::endl
+              << "  last update  : "
+              << ago(now, page.mUpdateTime.load(relaxed)) << std::endl
+              << "  executions   : " << execs << " (" << eps << "/sec)"
+              << std::endl
+              << "  trajectories : " << page.mTrajectories.load(relaxed)
+              << std::endl
+              << "  last novelty : "
+              << ago(now, page.mLastNoveltyTime.load(relaxed)) << std::endl
+              << "  rejections   : " << page.mRejections.load(relaxed)
+              << std::endl
+              << "  hangs        : " << page.mHangs.load(relaxed) << std::endl
+              << "  failures     : " << page.mFailures.load(relaxed)
+              << std::endl
+              << std::endl;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    bool watch = false, remove = false;
+    std::vector<std::string> names;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        if (arg == "-w")
+        {
+            watch = true;
+        }
+        else if (arg == "-r")
+        {
+            remove = true;
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            std::cerr << "usage: " << argv[0] << " [-w] [-r] [NAME...]"
+                      << std::endl;
+            return 2;
+        }
+        else
+        {
+            names.emplace_back(arg[0] == '/' ? arg : "/" + arg);
+        }
+    }
+    if (names.empty())
+    {
+        names = findStatusSegments();
+    }
+    if (remove)
+    {
+        for (auto const& name : names)
+        {
+            shm_unlink(name.c_str());
+        }
+        return 0;
+    }
+    do
+    {
+        if (watch)
+        {
+            // Clear screen and home the cursor.
+            std::cout << "\x1b[2J\x1b[H";
+        }
+        Totals totals;
+        size_t nShown = 0;
+        for (auto const& name : names)
+        {
+            if (auto page = ph::mapStatusPage(name))
+            {
+                display(name, *page, totals);
+                ph::unmapStatusPage(page);
+                ++nShown;
+            }
+            else
+            {
+                std::cout << name << ": no status page" << std::endl
+                          << std::endl;
+            }
+        }
+        if (nShown > 1)
+        {
+            std::cout << "summary: " << totals.mAlive << "/" << nShown
+                      << " running, " << totals.mExecutions
+                      << " executions (" << totals.mExecsPerSec
+                      << "/sec), " << totals.mHangs << " hangs, "
+                      << totals.mFailures << " failures" << std::endl;
+        }
+        else if (nShown == 0 && names.empty())
+        {
+            std::cout << "no status segments found" << std::endl;
+        }
+        std::cout.flush();
+        if (watch)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    } while (watch);
+    return 0;
+}